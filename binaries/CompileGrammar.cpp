@@ -0,0 +1,122 @@
+// CompileGrammar.cpp - a tool that loads a PCFG specification and writes it
+//   as a binary grammar snapshot
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+
+// The grammar is loaded from text as usual and written with
+// PCFG::writeSnapshot.  The other tools accept the snapshot anywhere they
+// accept a structure file (-sfile) and load it without parsing the grammar
+// or rebuilding terminal groups (see grammar_snapshot.h).  The terminals
+// folder must still be given to those tools, and the snapshot must be
+// recompiled whenever the terminals files change.
+//
+
+
+#include <string>
+#include <cstdio>
+#include "pcfg.h"
+#include "terminal_file.h"
+
+void help() {
+  printf("\n"
+    "CompileGrammar - a tool for compiling a learned PCFG into a binary\n"
+    "                 snapshot that loads quickly\n"
+    "------------------------------------------------------------------------\n\n"
+    "Usage Info:\n"
+    "./CompileGrammar <options>\n"
+    "\tOptions:\n"
+    "\t-out <filename>: Write the snapshot to the given file\n"
+    "\t-sfile <filename>: (optional) Use the following file as the structure file\n"
+    "\t-tfolder <path>: (optional) Use the following folder as the terminals folder\n"
+    "\t\tThis folder name MUST end in \"/\"\n"
+    "\t-madvise <hints>: (optional) Access advice for terminals files, a comma-\n"
+    "\t\tseparated list of sequential, willneed, hugepage, and populate\n"
+    "\t\t(default none; see terminal_file.h)\n"
+    "\n\n\n");
+  return;
+}
+
+
+int main(int argc, char *argv[]) {
+  std::string structure_file = "grammar/nonterminalRules.txt";
+  std::string terminal_folder = "grammar/terminalRules/";
+  std::string output_file;
+
+  // Parse command-line arguments
+  if (argc == 1) {
+    help();
+    return 0;
+  }
+  for (int i = 1; i < argc; ++i) {
+    std::string commandLineInput = argv[i];
+
+    if (commandLineInput.find("-out") == 0) {
+      ++i;
+      if (i < argc)
+        output_file = argv[i];
+      else {
+        fprintf(stderr, "\nError: no file found after -out option!\n");
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-madvise") == 0) {
+      ++i;
+      if (!TerminalFile::setAccessAdviceOption(i < argc ? argv[i] : NULL)) {
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-sfile") == 0) {
+      ++i;
+      if (i < argc)
+        structure_file = argv[i];
+      else {
+        fprintf(stderr, "\nError: no file found after -sfile option!\n");
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-tfolder") == 0) {
+      ++i;
+      if (i < argc)
+        terminal_folder = argv[i];
+      else {
+        fprintf(stderr, "\nError: no folder found after -tfolder option!\n");
+        help();
+        return 1;
+      }
+    }
+  }
+
+  if (output_file == "") {
+    fprintf(stderr, "\nError: no output file specified!\n");
+    help();
+    return 1;
+  }
+
+  fprintf(stderr, "\nUsing structure file: %s\n"
+                  "Using terminal folder: %s\n"
+                  "Writing snapshot to: %s\n\n",
+                  structure_file.c_str(), terminal_folder.c_str(),
+                  output_file.c_str());
+
+  PCFG pcfg;
+  fprintf(stderr, "Begin loading PCFG specification...");
+  pcfg.loadGrammar(structure_file, terminal_folder);
+  fprintf(stderr, "done!\n");
+
+  fprintf(stderr, "Begin writing snapshot...");
+  if (pcfg.writeSnapshot(output_file))
+    fprintf(stderr, "done!\n");
+  else {
+    fprintf(stderr, "\nError while writing snapshot!\n");
+    return 1;
+  }
+
+  return 0;
+}
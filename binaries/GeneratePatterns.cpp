@@ -17,8 +17,14 @@
 //
 
 #include <string>
+#include <vector>
+#include <mutex>
 #include <cstdio>
+#include "big_count.h"
 #include "pcfg.h"
+#include "terminal_file.h"
+#include "pattern_writer.h"
+#include "sorted_pattern_writer.h"
 
 void help() {
   printf("\n"
@@ -36,6 +42,27 @@ void help() {
     "\t-sfile <filename>: (optional) Use the following file as the structure file\n"
     "\t-tfolder <path>: (optional) Use the following folder as the terminals folder\n"
     "\t\tThis folder name MUST end in \"/\"\n"
+    "\t-threads <n>: (optional) Generate patterns using n threads (default 1)\n"
+    "\t\tWith more than one thread, patterns are output in no particular order\n"
+    "\t-bestfirst: (optional) Enumerate each structure's patterns in order of\n"
+    "\t\tdecreasing probability using a priority queue, instead of walking\n"
+    "\t\tall combinations of terminal groups with intelligent skipping\n"
+    "\t-ordered: (optional) Output a lookup table by merging the best-first\n"
+    "\t\tenumerations of all structures, so patterns are produced already\n"
+    "\t\tsorted and nothing is written to temporary files.  Single-threaded,\n"
+    "\t\tand cannot be combined with -threads, -sorted, or -bestfirst.\n"
+    "\t-guesses <n>: (optional) With -ordered, stop once the table covers at\n"
+    "\t\tleast n guesses.  The cutoff still applies if it is also given.\n"
+    "\t-sorted: (optional) Output a lookup table instead of a raw table, i.e.,\n"
+    "\t\tpatterns sorted by decreasing probability with accumulated guess\n"
+    "\t\tnumbers.  This is the same output as piping the raw table through\n"
+    "\t\t\"sort -gr\" and sortedcountaggregator, but is done in-process.\n"
+    "\t-tempdir <path>: (optional) Folder for temporary sorted runs (default .)\n"
+    "\t-sortmem <MB>: (optional) Memory to use for sorting, in megabytes, shared\n"
+    "\t\tby all threads (default 1024)\n"
+    "\t-madvise <hints>: (optional) Access advice for terminals files, a comma-\n"
+    "\t\tseparated list of sequential, willneed, hugepage, and populate\n"
+    "\t\t(default none; see terminal_file.h)\n"
     "\n\n\n");
   return;
 }
@@ -45,6 +72,13 @@ int main(int argc, char *argv[]) {
   std::string structure_file = "grammar/nonterminalRules.txt";
   std::string terminal_folder = "grammar/terminalRules/";
   double cutoff = -1.0;
+  unsigned int num_threads = 1;
+  bool best_first = false;
+  bool sorted_output = false;
+  bool ordered_output = false;
+  BigCount guess_budget;
+  std::string temp_folder = ".";
+  unsigned int sort_memory_mb = 1024;
 
   // Parse command-line arguments
   if (argc == 1) {
@@ -71,6 +105,13 @@ int main(int argc, char *argv[]) {
         return 1;
       }
 
+    } else if (commandLineInput.find("-madvise") == 0) {
+      ++i;
+      if (!TerminalFile::setAccessAdviceOption(i < argc ? argv[i] : NULL)) {
+        help();
+        return 1;
+      }
+
     } else if (commandLineInput.find("-sfile") == 0) {
       ++i;
       if (i < argc)
@@ -90,13 +131,84 @@ int main(int argc, char *argv[]) {
         help();
         return 1;
       }
+
+    } else if (commandLineInput.find("-threads") == 0) {
+      ++i;
+      if (i < argc && sscanf(argv[i], "%u", &num_threads) == 1 &&
+          num_threads > 0) {
+        // Parsed successfully
+      } else {
+        fprintf(stderr, "\nError: -threads must be followed by a positive "
+                        "number!\n");
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-bestfirst") == 0) {
+      best_first = true;
+
+    } else if (commandLineInput.find("-ordered") == 0) {
+      ordered_output = true;
+
+    } else if (commandLineInput.find("-guesses") == 0) {
+      ++i;
+      if (i < argc && BigCount::setString(guess_budget, argv[i]) &&
+          !guess_budget.isZero()) {
+        // Parsed successfully
+      } else {
+        fprintf(stderr, "\nError: -guesses must be followed by a positive "
+                        "integer!\n");
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-sorted") == 0) {
+      sorted_output = true;
+
+    } else if (commandLineInput.find("-tempdir") == 0) {
+      ++i;
+      if (i < argc)
+        temp_folder = argv[i];
+      else {
+        fprintf(stderr, "\nError: no folder found after -tempdir option!\n");
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-sortmem") == 0) {
+      ++i;
+      if (i < argc && sscanf(argv[i], "%u", &sort_memory_mb) == 1 &&
+          sort_memory_mb > 0) {
+        // Parsed successfully
+      } else {
+        fprintf(stderr, "\nError: -sortmem must be followed by a positive "
+                        "number!\n");
+        help();
+        return 1;
+      }
     }
   }
 
+  // -ordered has its own single-threaded, sorted output, and the guess budget
+  // only applies to it
+  if (ordered_output && (num_threads != 1 || sorted_output || best_first)) {
+    fprintf(stderr, "\nError: -ordered cannot be combined with -threads, "
+                    "-sorted, or -bestfirst!\n");
+    help();
+    return 1;
+  }
+  if (!guess_budget.isZero() && !ordered_output) {
+    fprintf(stderr, "\nError: -guesses can only be used with -ordered!\n");
+    help();
+    return 1;
+  }
+
   fprintf(stderr, "\nCutoff: %e\n"
                   "Using structure file: %s\n"
-                  "Using terminal folder: %s\n\n",
-                  cutoff, structure_file.c_str(), terminal_folder.c_str());
+                  "Using terminal folder: %s\n"
+                  "Using threads: %u\n\n",
+                  cutoff, structure_file.c_str(), terminal_folder.c_str(),
+                  num_threads);
 
   PCFG pcfg;
   fprintf(stderr, "Begin loading PCFG specification...");
@@ -104,7 +216,44 @@ int main(int argc, char *argv[]) {
   fprintf(stderr, "done!\n");
 
   fprintf(stderr, "Begin generating patterns...\n");
-  if (pcfg.generatePatterns(cutoff))
+  bool success;
+  if (ordered_output) {
+    LookupTableWriter writer(stdout);
+    success = pcfg.generateOrderedPatterns(cutoff, guess_budget, &writer) &&
+              writer.finish();
+  } else if (sorted_output) {
+    // Sort in memory and spill to temp_folder, then merge all runs into the
+    // lookup table
+    std::vector<SortedPatternWriter*> sorted_writers;
+    std::vector<PatternWriter*> writers;
+    size_t memory_per_writer =
+      (static_cast<size_t>(sort_memory_mb) << 20) / num_threads;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+      sorted_writers.push_back(
+        new SortedPatternWriter(temp_folder, memory_per_writer));
+      writers.push_back(sorted_writers.back());
+    }
+    success = pcfg.generatePatterns(cutoff, writers, best_first);
+    if (success) {
+      fprintf(stderr, "Merging sorted patterns...\n");
+      success = SortedPatternWriter::mergeToLookupTable(sorted_writers, stdout);
+    }
+    for (unsigned int i = 0; i < num_threads; ++i)
+      delete sorted_writers[i];
+  } else if (num_threads == 1 && !best_first) {
+    success = pcfg.generatePatterns(cutoff);
+  } else {
+    // Each thread buffers its own output and writes whole blocks of lines to
+    // stdout under a shared lock
+    std::mutex stdout_mutex;
+    std::vector<PatternWriter*> writers;
+    for (unsigned int i = 0; i < num_threads; ++i)
+      writers.push_back(new TextPatternWriter(stdout, &stdout_mutex));
+    success = pcfg.generatePatterns(cutoff, writers, best_first);
+    for (unsigned int i = 0; i < num_threads; ++i)
+      delete writers[i];
+  }
+  if (success)
     fprintf(stderr, "done!\n");
   else {
     fprintf(stderr, "\nError while generating patterns!\n");
@@ -25,11 +25,18 @@
 // are accumulated.  It is not possible to find such strings without enumerating
 // over all strings, which is simply not feasible.
 //
+// With -threads, strings are generated on a thread pool and output in no
+// particular order.  This also works with -accupr, because a string is only
+// ever looked up in the structures that share its signature (see
+// PCFG::generateStrings), so the output can be split across threads rather
+// than across processes with separate structure files.
+//
 
 
 #include <string>
 #include <cstdio>
 #include "pcfg.h"
+#include "terminal_file.h"
 
 void help() {
   printf("\n"
@@ -48,9 +55,14 @@ void help() {
     "\t\tsumming over all tokenizations (note this is not needed if you have\n"
     "\t\ttokenized by character class because there is only one tokenization\n"
     "\t\tper string in that case\n"
+    "\t-threads <n>: (optional) Generate strings using n threads (default 1)\n"
+    "\t\tWith more than one thread, strings are output in no particular order\n"
     "\t-sfile <filename>: (optional) Use the following file as the structure file\n"
     "\t-tfolder <path>: (optional) Use the following folder as the terminals folder\n"
     "\t\tThis folder name MUST end in \"/\"\n"
+    "\t-madvise <hints>: (optional) Access advice for terminals files, a comma-\n"
+    "\t\tseparated list of sequential, willneed, hugepage, and populate\n"
+    "\t\t(default none; see terminal_file.h)\n"
     "\n\n\n");
   return;
 }
@@ -61,6 +73,7 @@ int main(int argc, char *argv[]) {
   std::string terminal_folder = "grammar/terminalRules/";
   double cutoff = -1.0;
   bool accurate_probabilities = false;
+  unsigned int num_threads = 1;
 
   // Parse command-line arguments
   if (argc == 1) {
@@ -90,6 +103,25 @@ int main(int argc, char *argv[]) {
     } else if (commandLineInput.find("-accupr") == 0) {
       accurate_probabilities = true;
 
+    } else if (commandLineInput.find("-threads") == 0) {
+      ++i;
+      if (i < argc && sscanf(argv[i], "%u", &num_threads) == 1 &&
+          num_threads > 0) {
+        // Parsed successfully
+      } else {
+        fprintf(stderr, "\nError: -threads must be followed by a positive "
+                        "number!\n");
+        help();
+        return 1;
+      }
+
+    } else if (commandLineInput.find("-madvise") == 0) {
+      ++i;
+      if (!TerminalFile::setAccessAdviceOption(i < argc ? argv[i] : NULL)) {
+        help();
+        return 1;
+      }
+
     } else if (commandLineInput.find("-sfile") == 0) {
       ++i;
       if (i < argc)
@@ -114,8 +146,10 @@ int main(int argc, char *argv[]) {
 
   fprintf(stderr, "\nCutoff: %e\n"
                   "Using structure file: %s\n"
-                  "Using terminal folder: %s\n\n",
-                  cutoff, structure_file.c_str(), terminal_folder.c_str());
+                  "Using terminal folder: %s\n"
+                  "Using threads: %u\n\n",
+                  cutoff, structure_file.c_str(), terminal_folder.c_str(),
+                  num_threads);
 
   PCFG pcfg;
   fprintf(stderr, "Begin loading PCFG specification...");
@@ -123,7 +157,8 @@ int main(int argc, char *argv[]) {
   fprintf(stderr, "done!\n");
 
   fprintf(stderr, "Begin generating strings...\n");
-  if (pcfg.generateStrings(cutoff, accurate_probabilities))
+  if (pcfg.generateStrings(cutoff, accurate_probabilities,
+                           num_threads))
     fprintf(stderr, "done!\n");
   else {
     fprintf(stderr, "\nError while generating strings!\n");
@@ -21,9 +21,10 @@
 // password file:
 // - Call PCFG::lookup on the password.  This will iterate over the structure
 //   objects and call Structure::lookup on the password.
-//   - Structure::lookup breaks the password into terminals (returning if the
-//     password cannot be parsed by this structure) and calls
-//     PatternManager::lookup on the array of terminals.
+//   - Structure::lookup checks the password against its nonterminals
+//     (returning if the password cannot be parsed by this structure) and calls
+//     PatternManager::lookupAndSetPattern, which looks up each terminal in
+//     place.
 //     - PatternManager is required because the password might be part of a 
 //       permutable pattern, and the PatternManager class is the only one that
 //       can rank and unrank permutations.
@@ -34,7 +35,8 @@
 //       grammar.
 // - Each structure can only parse a password in one or zero ways, but multiple
 //   structures could parse a given password.  Return the best parse among all
-//   structures, i.e., the one with lowest guess number.
+//   structures, i.e., the one with lowest guess number.  Source ids are only
+//   gathered for this best parse.
 // - Now we look up the probability and pattern-identifying string in the input
 //   lookup table file.  This file is sorted by decreasing probability, so we
 //   use binary search.
@@ -45,14 +47,26 @@
 // - This is printed to stdout, along with other diagnostic values.
 //
 
+#include <algorithm>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <vector>
 
 #include "pcfg.h"
+#include "terminal_file.h"
+#include "text_codec.h"
 #include "lookup_data.h"
 #include "lookup_tools.h"
+#include "binary_lookup_table.h"
+#include "work_stealing_pool.h"
+
+// With -threads and no -batch, passwords are still read and printed in blocks
+// of this many, so that output can be kept in input order
+static const unsigned int kThreadedBlockSize = 4096;
+// Number of passwords looked up by each pool task
+static const unsigned int kPasswordsPerTask = 64;
 
 void help() {
   printf("\n"
@@ -69,13 +83,104 @@ void help() {
     "\tOptions:\n"
     "\t-pfile <filename>: a password file in three-column, tab-separated format\n"
     "\t-lfile <filename>: a lookup table file in sorted, aggregrated-count format\n"
+    "\t\t(text, or binary as written by sortedcountaggregator -binary)\n"
     "\tOptional Options:\n"
     "\t-gdir <directory>: a \"grammar directory\" produced by the calculator\n"
+    "\t-sfile <filename>: use the following file as the structure file, e.g.,\n"
+    "\t\ta snapshot written by CompileGrammar (overrides -gdir)\n"
+    "\t-batch <n>: look up passwords in blocks of n, answering all table\n"
+    "\t\tsearches for a block in one sequential pass over the table\n"
+    "\t-threads <n>: look up passwords on n threads sharing one grammar\n"
+    "\t\t(default 1); output stays in input order\n"
+    "\t-madvise <hints>: access advice for terminals files, a comma-\n"
+    "\t\tseparated list of sequential, willneed, hugepage, and populate\n"
+    "\t\t(default none; see terminal_file.h)\n"
     "\n\n\n");
   return;
 }
 
 
+// Combine the result of a table search with the PCFG lookup of a password:
+// add the guess number from the table to the rank of the password in its
+// pattern.  Dies if a parseable password is missing from the table for any
+// reason but the cutoff.
+void ApplyTableLookup(const std::string& password,
+                      LookupData *lookup_data,
+                      const LookupData& table_lookup) {
+  if (table_lookup.parse_status & kCanParse) {
+    // Password was found!  Add the value in the lookup table to the
+    // rank of the password in its pattern
+    BigCount::add(lookup_data->index, lookup_data->index, table_lookup.index);
+  } else {
+    // If the password was parsed, but not found in the lookup table,
+    // the only acceptable reason for is kBeyondCutoff
+    if (table_lookup.parse_status & kBeyondCutoff) {
+      lookup_data->parse_status = kBeyondCutoff;
+    } else {
+      fprintf(stderr, "Failed to find parseable password in lookup table!\n"
+                      "Should have found password: %s with probability: %a "
+                      "and pattern_string: %s but failed!\n",
+                      password.c_str(),
+                      lookup_data->probability,
+                      lookup_data->first_string_of_pattern.c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+
+// Check for unexpected error codes and print the output line for a password to
+// stdout
+void PrintLookupResult(const std::string& fullline,
+                       const std::string& password,
+                       LookupData *lookup_data) {
+  if ((lookup_data->parse_status & kTerminalCollision) ||
+      (lookup_data->parse_status & kUnexpectedFailure)) {
+    fprintf(stderr, "Password lookup returns unexpected error code! "
+                    "Something went horribly wrong!\n"
+                    "Attempting to parse password: %s with probability: %a "
+                    "and pattern_string: %s but returned parse code: "
+                    "-%d when such codes should not be produced!\n",
+                    password.c_str(),
+                    lookup_data->probability,
+                    lookup_data->first_string_of_pattern.c_str(),
+                    static_cast<unsigned>(lookup_data->parse_status));
+    exit(EXIT_FAILURE);
+  }
+
+  // Build the output line, starting with the original line from the
+  // passwords file
+  std::string outputline = fullline;
+  outputline.push_back('\t');
+  textcodec::AppendHexFloat(lookup_data->probability, &outputline);
+  outputline.push_back('\t');
+  // Set up guess number string or print the parse_status in the guess
+  // number field (with negative value) as a diagnostic
+  if (lookup_data->parse_status & kCanParse) {
+    outputline.append(lookup_data->first_string_of_pattern);
+    outputline.push_back('\t');
+    lookup_data->index.appendTo(&outputline);
+  } else {
+    lookup_data->first_string_of_pattern = "";
+    outputline.append("\t-");
+    textcodec::AppendUint64(static_cast<unsigned>(lookup_data->parse_status),
+                            &outputline);
+  }
+  outputline.push_back('\t');
+
+  // Print all of the source ids that went into this guess
+  for (auto it = lookup_data->source_ids.begin(); 
+            it != lookup_data->source_ids.end();
+            ++it) {
+    outputline.append(*it);
+  }
+  outputline.push_back('\n');
+
+  // Output a line to stdout
+  fwrite(outputline.data(), 1, outputline.size(), stdout);
+}
+
+
 int main(int argc, char *argv[]) {
   std::string default_structure_file = "grammar/nonterminalRules.txt";
   std::string structure_file;
@@ -84,9 +189,13 @@ int main(int argc, char *argv[]) {
   std::string password_file;
   std::string lookup_file;
   std::string grammar_dir;
+  std::string override_structure_file;
+
+  unsigned int batch_size = 0;
+  unsigned int num_threads = 1;
 
   // Parse command-line arguments
-  if (argc != 5 && argc != 7) {
+  if (argc < 5 || argc % 2 == 0) {
     help();
     return 0;
   }
@@ -125,6 +234,43 @@ int main(int argc, char *argv[]) {
         help();
         return 1;
       }
+    } else if (commandLineInput.find("-madvise") == 0) {
+      ++i;
+      if (!TerminalFile::setAccessAdviceOption(i < argc ? argv[i] : NULL)) {
+        help();
+        return 1;
+      }
+    } else if (commandLineInput.find("-sfile") == 0) {
+      ++i;
+      if (i < argc)
+        override_structure_file = argv[i];
+      else {
+        fprintf(stderr, "\nError: no file found after -sfile option!\n");
+        help();
+        return 1;
+      }
+    } else if (commandLineInput.find("-batch") == 0) {
+      ++i;
+      if (i < argc && sscanf(argv[i], "%u", &batch_size) == 1 &&
+          batch_size > 0) {
+        // Parsed successfully
+      } else {
+        fprintf(stderr, "\nError: -batch must be followed by a positive "
+                        "number!\n");
+        help();
+        return 1;
+      }
+    } else if (commandLineInput.find("-threads") == 0) {
+      ++i;
+      if (i < argc && sscanf(argv[i], "%u", &num_threads) == 1 &&
+          num_threads > 0) {
+        // Parsed successfully
+      } else {
+        fprintf(stderr, "\nError: -threads must be followed by a positive "
+                        "number!\n");
+        help();
+        return 1;
+      }
     }
   }
   if (password_file == "" || lookup_file == "") {
@@ -132,6 +278,8 @@ int main(int argc, char *argv[]) {
     help();
     return 1;
   }
+  if (!override_structure_file.empty())
+    structure_file = override_structure_file;
   if (structure_file.empty())
     structure_file = default_structure_file;
   if (terminal_folder.empty())
@@ -150,11 +298,31 @@ int main(int argc, char *argv[]) {
   pcfg.loadGrammar(structure_file, terminal_folder);
   fprintf(stderr, "done!\n");
 
-  // Open lookup table for random access
-  FILE *lookupFile = fopen(lookup_file.c_str(), "rb");
-  if (lookupFile == 0) {
-    fprintf(stderr, "Error opening file: %s!\n", lookup_file.c_str());
-    exit(EXIT_FAILURE);
+  // Open lookup table for random access.  Binary tables built by
+  // sortedcountaggregator -binary are memory-mapped instead, and shared by
+  // all threads.  Text tables are searched by seeking, so each thread gets
+  // its own FILE pointer.
+  std::vector<FILE*> lookupFiles;
+  BinaryLookupTable binary_table;
+  bool use_binary_table =
+    BinaryLookupTable::isBinaryLookupTable(lookup_file);
+  if (use_binary_table) {
+    if (!binary_table.load(lookup_file)) {
+      fprintf(stderr, "Error loading binary lookup table: %s!\n",
+                      lookup_file.c_str());
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    // Batch mode only searches the table from the main thread
+    unsigned int file_count = (batch_size > 0) ? 1 : num_threads;
+    for (unsigned int i = 0; i < file_count; ++i) {
+      FILE *lookupFile = fopen(lookup_file.c_str(), "rb");
+      if (lookupFile == 0) {
+        fprintf(stderr, "Error opening file: %s!\n", lookup_file.c_str());
+        exit(EXIT_FAILURE);
+      }
+      lookupFiles.push_back(lookupFile);
+    }
   }
 
   // Open password file for reading line-by-line
@@ -166,86 +334,101 @@ int main(int argc, char *argv[]) {
   }
 
 
-  // Begin lookups -- grab passwords from password file
-  std::string fullline, password;
-  while (lookuptools::ReadPasswordLineFromStream(passwordFile,
-                                                 fullline, password)) {
-    // Lookup password using PCFG
-    LookupData *lookup_data = pcfg.lookup(password);
+  // Look up password i of a block in the PCFG and, unless table searches are
+  // batched, in the lookup table using the worker's own table handle
+  std::vector<std::string> fulllines, passwords;
+  std::vector<LookupData> table_lookups;
+  // LookupData objects are reused from block to block
+  std::vector<LookupData> lookups;
+  auto lookup_password = [&](unsigned int i, unsigned int worker_index) {
+    LookupData *lookup_data = &lookups[i];
+    pcfg.lookup(passwords[i], lookup_data);
 
     // If the password was parsed, search for it in the lookup table
-    if (lookup_data->parse_status & kCanParse) {
-      LookupData *table_lookup = 
-        lookuptools::TableLookup(lookupFile, 
+    if (batch_size == 0 && (lookup_data->parse_status & kCanParse)) {
+      LookupData table_lookup;
+      if (use_binary_table)
+        lookuptools::TableLookup(binary_table,
                                  lookup_data->probability,
-                                 lookup_data->first_string_of_pattern);
-      if (table_lookup->parse_status & kCanParse) {
-        // Password was found!  Add the value in the lookup table to the
-        // rank of the password in its pattern
-        mpz_add(lookup_data->index, lookup_data->index, table_lookup->index);
-      } else {
-        // If the password was parsed, but not found in the lookup table,
-        // the only acceptable reason for is kBeyondCutoff
-        if (table_lookup->parse_status & kBeyondCutoff) {
-          lookup_data->parse_status = kBeyondCutoff;
-        } else {
-          fprintf(stderr, "Failed to find parseable password in lookup table!\n"
-                          "Should have found password: %s with probability: %a "
-                          "and pattern_string: %s but failed!\n",
-                          password.c_str(),
-                          lookup_data->probability,
-                          lookup_data->first_string_of_pattern.c_str());
-          exit(EXIT_FAILURE);
-        }
-      }
-      mpz_clear(table_lookup->index);
-      delete table_lookup;
-    } else if ((lookup_data->parse_status & kTerminalCollision) ||
-               (lookup_data->parse_status & kUnexpectedFailure)) {
-      fprintf(stderr, "Password lookup returns unexpected error code! "
-                      "Something went horribly wrong!\n"
-                      "Attempting to parse password: %s with probability: %a "
-                      "and pattern_string: %s but returned parse code: "
-                      "-%d when such codes should not be produced!\n",
-                      password.c_str(),
-                      lookup_data->probability,
-                      lookup_data->first_string_of_pattern.c_str(),
-                      static_cast<unsigned>(lookup_data->parse_status));
-      exit(EXIT_FAILURE);
+                                 lookup_data->first_string_of_pattern,
+                                 &table_lookup);
+      else
+        lookuptools::TableLookup(lookupFiles[worker_index],
+                                 lookup_data->probability,
+                                 lookup_data->first_string_of_pattern,
+                                 &table_lookup);
+      ApplyTableLookup(passwords[i], lookup_data, table_lookup);
+    }
+  };
+
+  WorkStealingPool *pool = NULL;
+  if (num_threads > 1)
+    pool = new WorkStealingPool(num_threads);
+
+  // Begin lookups -- grab passwords from password file in blocks, or one at a
+  // time when running single-threaded without -batch
+  unsigned int block_size = batch_size;
+  if (block_size == 0)
+    block_size = (pool != NULL) ? kThreadedBlockSize : 1;
+  std::string fullline, password;
+  bool passwords_left = true;
+  while (passwords_left) {
+    fulllines.clear();
+    passwords.clear();
+    while (fulllines.size() < block_size &&
+           (passwords_left =
+              lookuptools::ReadPasswordLineFromStream(passwordFile,
+                                                      fullline, password))) {
+      fulllines.push_back(fullline);
+      passwords.push_back(password);
     }
+    unsigned int block_count = static_cast<unsigned int>(passwords.size());
+    lookups.resize(block_count);
 
-    // Set up strings for printing to stdout
-    // Set up guess number string or print the parse_status in the guess
-    // number field (with negative value) as a diagnostic
-    char final_guess_number[1024];
-    if (lookup_data->parse_status & kCanParse) {
-      mpz_get_str(final_guess_number, 10, lookup_data->index);
+    if (pool == NULL) {
+      for (unsigned int i = 0; i < block_count; ++i)
+        lookup_password(i, 0);
     } else {
-      sprintf(final_guess_number, "-%d", 
-              static_cast<unsigned>(lookup_data->parse_status));
-      lookup_data->first_string_of_pattern = "";
+      for (unsigned int begin = 0; begin < block_count;
+           begin += kPasswordsPerTask) {
+        unsigned int end = std::min(begin + kPasswordsPerTask, block_count);
+        pool->submit([&lookup_password, begin, end](unsigned int worker) {
+          for (unsigned int i = begin; i < end; ++i)
+            lookup_password(i, worker);
+        });
+      }
+      pool->wait();
     }
 
-    // Print all of the source ids that went into this guess
-    std::string final_source_ids = "";
-    for (auto it = lookup_data->source_ids.begin(); 
-              it != lookup_data->source_ids.end();
-              ++it) {
-      final_source_ids.append(*it);
+    if (batch_size > 0) {
+      // Batch mode: answer all table searches for the block in one pass
+      std::vector<const LookupData*> queries;
+      std::vector<unsigned int> query_owners;
+      for (unsigned int i = 0; i < block_count; ++i) {
+        if (lookups[i].parse_status & kCanParse) {
+          queries.push_back(&lookups[i]);
+          query_owners.push_back(i);
+        }
+      }
+
+      if (use_binary_table)
+        lookuptools::BatchTableLookup(binary_table, queries, &table_lookups);
+      else
+        lookuptools::BatchTableLookup(lookupFiles[0], queries, &table_lookups);
+      for (unsigned int i = 0; i < table_lookups.size(); ++i) {
+        unsigned int owner = query_owners[i];
+        ApplyTableLookup(passwords[owner], &lookups[owner], table_lookups[i]);
+      }
     }
 
-    // Output a line to stdout
-    printf("%s\t%a\t%s\t%s\t%s\n",
-           fullline.c_str(),  // Original line from passwords file
-           lookup_data->probability,
-           lookup_data->first_string_of_pattern.c_str(),
-           final_guess_number,
-           final_source_ids.c_str());
-    mpz_clear(lookup_data->index);
-    delete lookup_data;
+    // Output in input order
+    for (unsigned int i = 0; i < block_count; ++i)
+      PrintLookupResult(fulllines[i], passwords[i], &lookups[i]);
   }
 
-  fclose(lookupFile);
+  if (pool != NULL)
+    delete pool;
+  for (unsigned int i = 0; i < lookupFiles.size(); ++i)
+    fclose(lookupFiles[i]);
   return 0;
 }
-
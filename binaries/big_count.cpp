@@ -1,19 +1,31 @@
-// big_count.cpp - use native math until we can't anymore
-// we only deal with positive increases, and optimize comparison
-// based on forcing initial values to native if possible
+// big_count.cpp - a non-negative integer that uses native math until it
+//   can't anymore
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.2
+//
+// See header file for additional information
 
-#include "big_count.h"
+// Includes not covered in header file
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
-#include <assert.h>
 
-bool mul_overflow(const uint64_t op1, const uint64_t op2, uint64_t* dest) {
+#include "text_codec.h"
+
+#include "big_count.h"
+
+static bool mul_overflow(const uint64_t op1, const uint64_t op2,
+                         uint64_t* dest) {
   // gcc5 has __builtin_mul_overflow
   if (op2 == 0) {
     *dest = 0;
     return false;
   }
 
-  //if ((((op1|op2)  >> 31) > 0) && (op1 > std::numeric_limits<uint64_t>::max() / op2)) {
   if ((op1 > std::numeric_limits<uint64_t>::max() / op2)) {
     return true;
   } else {
@@ -22,7 +34,8 @@ bool mul_overflow(const uint64_t op1, const uint64_t op2, uint64_t* dest) {
   }
 }
 
-bool add_overflow(const uint64_t op1, const uint64_t op2, uint64_t *dest) {
+static bool add_overflow(const uint64_t op1, const uint64_t op2,
+                         uint64_t *dest) {
   // gcc5 has __builtin_add_overflow
   if (op1 > std::numeric_limits<uint64_t>::max() - op2) {
     return true;
@@ -32,119 +45,304 @@ bool add_overflow(const uint64_t op1, const uint64_t op2, uint64_t *dest) {
   }
 }
 
-void BigCount::mul(BigCount& dest, const BigCount& op1, const uint64_t op2) {
-  if (op1.usemp) {
-    dest.initmp();
-    mpz_mul_ui(dest.mpval, op1.mpval, op2);
-    return;
-  } else {
+
+// unsigned long int is not 64 bits everywhere, so 64-bit values go through
+// mpz_import and mpz_export where it is smaller
+static void SetMpzFromUint64(mpz_t dest, uint64_t value) {
+  if (sizeof(unsigned long int) >= sizeof(uint64_t))
+    mpz_set_ui(dest, static_cast<unsigned long int>(value));
+  else
+    mpz_import(dest, 1, -1, sizeof(uint64_t), 0, 0, &value);
+}
+
+static uint64_t GetUint64FromMpz(const mpz_t value) {
+  if (sizeof(unsigned long int) >= sizeof(uint64_t))
+    return mpz_get_ui(value);
+  uint64_t result = 0;
+  mpz_export(&result, NULL, -1, sizeof(uint64_t), 0, 0, value);
+  return result;
+}
+
+static bool FitsUint64(const mpz_t value) {
+  return mpz_sizeinbase(value, 2) <= 64;
+}
+
+
+// All mixed and overflowing operations are done in GMP.  The result is built
+// in a temporary, so dest may alias either operand.
+void BigCount::applyMpz(BigCount& dest, const BigCount& op1,
+                        const BigCount& op2,
+                        void (*operation)(mpz_ptr, mpz_srcptr, mpz_srcptr)) {
+  mpz_t scratch1, scratch2, result;
+  mpz_init(scratch1);
+  mpz_init(scratch2);
+  mpz_init(result);
+  operation(result, op1.getMpz(scratch1), op2.getMpz(scratch2));
+  dest.takeMpz(result);
+  mpz_clear(scratch1);
+  mpz_clear(scratch2);
+  mpz_clear(result);
+}
+
+
+void BigCount::add(BigCount& dest, const BigCount& op1, const BigCount& op2) {
+  if (!op1.usemp && !op2.usemp) {
     uint64_t result;
-    bool overflow = mul_overflow(op1.nativeval, op2, &result);
-// print
-    if (overflow) {
-      BigCount temp(op1);
-      temp.initmp();
-      dest.initmp();
-      mpz_set_ui(temp.mpval, temp.nativeval);
-      mpz_mul_ui(dest.mpval, temp.mpval, op2);
+    if (!add_overflow(op1.nativeval, op2.nativeval, &result)) {
+      dest.setNative(result);
       return;
     }
-    dest.nativeval = result;
-    return;
   }
+  applyMpz(dest, op1, op2, mpz_add);
 }
 
 void BigCount::add(BigCount& dest, const BigCount& op1, const uint64_t op2) {
-  if (op1.usemp) {
-    dest.initmp();
-    mpz_add_ui(dest.mpval, op1.mpval, op2);
+  add(dest, op1, BigCount(op2));
+}
+
+
+void BigCount::sub(BigCount& dest, const BigCount& op1, const BigCount& op2) {
+  if (!op1.usemp && !op2.usemp) {
+    if (op1.nativeval < op2.nativeval) {
+      fprintf(stderr, "Negative result in BigCount::sub!\n");
+      exit(EXIT_FAILURE);
+    }
+    dest.setNative(op1.nativeval - op2.nativeval);
     return;
-  } else {
+  }
+  applyMpz(dest, op1, op2, mpz_sub);
+}
+
+void BigCount::sub(BigCount& dest, const BigCount& op1, const uint64_t op2) {
+  sub(dest, op1, BigCount(op2));
+}
+
+
+void BigCount::mul(BigCount& dest, const BigCount& op1, const BigCount& op2) {
+  if (!op1.usemp && !op2.usemp) {
     uint64_t result;
-    bool overflow = add_overflow(op1.nativeval, op2, &result);
-// print
-    if (overflow) {
-      BigCount temp(op1);
-      temp.initmp();
-      dest.initmp();
-      mpz_set_ui(temp.mpval, temp.nativeval);
-      mpz_add_ui(dest.mpval, temp.mpval, op2);
+    if (!mul_overflow(op1.nativeval, op2.nativeval, &result)) {
+      dest.setNative(result);
       return;
     }
-    dest.nativeval = result;
+  }
+  applyMpz(dest, op1, op2, mpz_mul);
+}
+
+void BigCount::mul(BigCount& dest, const BigCount& op1, const uint64_t op2) {
+  mul(dest, op1, BigCount(op2));
+}
+
+
+void BigCount::div(BigCount& dest, const BigCount& op1, const BigCount& op2) {
+  if (op2.isZero()) {
+    fprintf(stderr, "Division by zero in BigCount::div!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!op1.usemp && !op2.usemp) {
+    dest.setNative(op1.nativeval / op2.nativeval);
     return;
   }
+  applyMpz(dest, op1, op2, mpz_tdiv_q);
 }
 
+void BigCount::div(BigCount& dest, const BigCount& op1, const uint64_t op2) {
+  div(dest, op1, BigCount(op2));
+}
+
+
+// 20! is the largest factorial that fits in 64 bits
+void BigCount::factorial(BigCount& dest, const unsigned long int n) {
+  if (n <= 20) {
+    uint64_t result = 1;
+    for (unsigned long int i = 2; i <= n; ++i)
+      result *= i;
+    dest.setNative(result);
+    return;
+  }
+  mpz_t result;
+  mpz_init(result);
+  mpz_fac_ui(result, n);
+  dest.takeMpz(result);
+  mpz_clear(result);
+}
+
+
+// Values are canonical, so a GMP value is always larger than a native one
 int BigCount::cmp(const BigCount& op1, const BigCount& op2) {
-  if (op1.usemp == false && op2.usemp == false) {
-    if (op1.nativeval > op2.nativeval) {
+  if (!op1.usemp && !op2.usemp) {
+    if (op1.nativeval > op2.nativeval)
       return 1;
-    } else if (op1.nativeval == op2.nativeval) {
+    else if (op1.nativeval == op2.nativeval)
       return 0;
-    } else if (op1.nativeval < op2.nativeval) {
+    else
       return -1;
-    }
-  } else if (op1.usemp == true && op2.usemp == false) {
+  } else if (op1.usemp && !op2.usemp) {
     return 1;
-  } else if (op1.usemp == false && op2.usemp == true) {
+  } else if (!op1.usemp && op2.usemp) {
     return -1;
-  } else if (op1.usemp == true && op2.usemp == true) {
-    return mpz_cmp(op1.mpval, op2.mpval);
   }
-  assert(0); // can't happen
-  return 0;
+  return mpz_cmp(op1.mpval, op2.mpval);
 }
 
+int BigCount::cmp(const BigCount& op1, const uint64_t op2) {
+  return cmp(op1, BigCount(op2));
+}
+
+
 void BigCount::get(mpz_t dest, const BigCount& src) {
   if (src.usemp) {
     mpz_set(dest, src.mpval);
   } else {
-    mpz_set_ui(dest, src.nativeval);
+    SetMpzFromUint64(dest, src.nativeval);
   }
-  return;
 }
 
-void BigCount::initmp() {
-  if (usemp) {
-    return;
+
+void BigCount::set(BigCount& dest, const mpz_t src) {
+  if (mpz_sgn(src) < 0) {
+    fprintf(stderr, "Negative value in BigCount::set!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (FitsUint64(src)) {
+    dest.setNative(GetUint64FromMpz(src));
   } else {
+    dest.initmp();
+    mpz_set(dest.mpval, src);
+  }
+}
+
+
+bool BigCount::setString(BigCount& dest, const char *str) {
+  return setString(dest, str, strlen(str));
+}
+
+
+// Plain digits that fit in 64 bits are parsed natively.  Anything else is
+// left to GMP, which needs a null-terminated copy.
+bool BigCount::setString(BigCount& dest, const char *str,
+                         const size_t length) {
+  uint64_t native_result;
+  if (textcodec::ParseUint64(str, length, &native_result)) {
+    dest.setNative(native_result);
+    return true;
+  }
+
+  std::string terminated(str, length);
+  mpz_t result;
+  mpz_init(result);
+  bool success = (mpz_set_str(result, terminated.c_str(), 10) == 0 &&
+                  mpz_sgn(result) >= 0);
+  if (success)
+    dest.takeMpz(result);
+  mpz_clear(result);
+  return success;
+}
+
+
+std::string BigCount::toString() const {
+  std::string result;
+  appendTo(&result);
+  return result;
+}
+
+
+void BigCount::appendTo(std::string *output) const {
+  if (!usemp) {
+    textcodec::AppendUint64(nativeval, output);
+    return;
+  }
+  // mpz_sizeinbase may overestimate by one, so trim to the real length
+  size_t start = output->size();
+  output->resize(start + mpz_sizeinbase(mpval, 10) + 1);
+  mpz_get_str(&(*output)[start], 10, mpval);
+  output->resize(start + strlen(output->c_str() + start));
+}
+
+
+// Integers up to 2^53 are exact as doubles.  Larger ones are converted by GMP
+// so that they are truncated the same way they always were.
+double BigCount::getDouble() const {
+  if (!usemp && nativeval <= (UINT64_C(1) << 53))
+    return static_cast<double>(nativeval);
+  mpz_t scratch;
+  mpz_init(scratch);
+  double result = mpz_get_d(getMpz(scratch));
+  mpz_clear(scratch);
+  return result;
+}
+
+
+void BigCount::initmp() {
+  if (!usemp) {
     mpz_init(mpval);
     usemp = true;
-    return;
   }
 }
 
-BigCount::~BigCount() {
+void BigCount::clearmp() {
   if (usemp) {
-    usemp = false;
     mpz_clear(mpval);
+    usemp = false;
   }
-  return;
 }
 
-BigCount::BigCount() {
-  nativeval = 0;
-  usemp = false;
-  return;
+void BigCount::setNative(const uint64_t value) {
+  clearmp();
+  nativeval = value;
 }
 
-BigCount::BigCount(const uint64_t init) {
-  nativeval = init;
-  usemp = false;
-  return;
+mpz_srcptr BigCount::getMpz(mpz_t scratch) const {
+  if (usemp)
+    return mpval;
+  SetMpzFromUint64(scratch, nativeval);
+  return scratch;
 }
 
-BigCount::BigCount(const mpz_t init) {
-  usemp = false;
-  uint64_t check = mpz_get_ui(init);
-  if (mpz_cmp_ui(init, check) > 0) {
+void BigCount::takeMpz(mpz_t value) {
+  if (mpz_sgn(value) < 0) {
+    fprintf(stderr, "Negative result in BigCount arithmetic!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (FitsUint64(value)) {
+    setNative(GetUint64FromMpz(value));
+  } else {
     initmp();
-    mpz_set(mpval, init);
-    return;
+    mpz_swap(mpval, value);
+  }
+}
+
+
+BigCount::BigCount() : nativeval(0), usemp(false) {}
+
+BigCount::BigCount(const uint64_t init) : nativeval(init), usemp(false) {}
+
+BigCount::BigCount(const mpz_t init) : nativeval(0), usemp(false) {
+  set(*this, init);
+}
+
+BigCount::BigCount(const BigCount& other)
+  : nativeval(other.nativeval), usemp(false) {
+  if (other.usemp) {
+    initmp();
+    mpz_set(mpval, other.mpval);
+  }
+}
+
+BigCount& BigCount::operator=(const BigCount& other) {
+  if (this == &other)
+    return *this;
+  if (other.usemp) {
+    initmp();
+    mpz_set(mpval, other.mpval);
   } else {
-    nativeval = check;
+    setNative(other.nativeval);
   }
+  return *this;
+}
+
+BigCount::~BigCount() {
+  clearmp();
 }
 
 #ifdef TEST
@@ -205,11 +403,31 @@ void test_mul() {
     }
 }
 
+// Multiply past 64 bits, then divide and subtract back down
+void test_sub_div() {
+  unsigned long int a, b;
+
+    a = rnd() << 30;
+    b = rnd() + 1;
+
+    BigCount o1(a);
+    BigCount::mul(o1, o1, a);
+    BigCount::mul(o1, o1, b);
+    BigCount::div(o1, o1, b);
+    BigCount::div(o1, o1, a);
+    BigCount::sub(o1, o1, a);
+
+    if (BigCount::cmp(o1, 0) || o1.toString() != "0") {
+      assert(0);
+    }
+}
+
 int main() {
   int counter = 0;
   while (1) {
     test_add();
     test_mul();
+    test_sub_div();
     counter++;
     if (counter % 100000 == 0) printf("%u passed\n", counter);
     //if (counter > 1000000) break;
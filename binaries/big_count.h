@@ -1,27 +1,94 @@
-// big_count.h - use native math until we can't anymore
-// only handle integer multiplication and addition
+// big_count.h - a non-negative integer that uses native math until it can't
+//   anymore
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.2
+//
+// Guess numbers, string counts, and ranks are unbounded, so they were kept in
+// GMP mpz_t variables.  Almost all of them fit in 64 bits, though, and every
+// mpz_t costs a heap allocation on init and a free on clear, which showed up
+// near the top of LookupGuessNumbers profiles.  A BigCount holds its value in
+// a uint64_t and only switches to an mpz_t when a result overflows.
+//
+// The representation is canonical: usemp is true only if the value does not
+// fit in 64 bits.  Results that shrink back into 64 bits (sub and div) are
+// moved back to native storage, so cmp can order a native value below any
+// GMP value without looking at either.
+//
+// Arithmetic follows the GMP convention of static functions with the
+// destination first, and dest may be the same object as either operand.
+// Values are never negative: sub dies if the result would be.
+//
 
 #ifndef BIG_COUNT_H__
+#define BIG_COUNT_H__
+
 #include <gmp.h>
 #include <cstdint>
+#include <string>
 
 class BigCount {
-  public:
-    static void mul(BigCount& dest, const BigCount& op1, const uint64_t op2);
-    static void add(BigCount& dest, const BigCount& op1, const uint64_t op2);
-    static int cmp(const BigCount& op1, const BigCount& op2);
-    static void get(mpz_t dest, const BigCount& src);
-    BigCount();
-    BigCount(const uint64_t init);
-    BigCount(const mpz_t init);
-    ~BigCount();
-
-  private:
-    mpz_t mpval;
-    uint64_t nativeval;
-    bool usemp;
-
-    void initmp();
+ public:
+  BigCount();
+  BigCount(const uint64_t init);
+  explicit BigCount(const mpz_t init);
+  BigCount(const BigCount& other);
+  BigCount& operator=(const BigCount& other);
+  ~BigCount();
+
+  static void add(BigCount& dest, const BigCount& op1, const BigCount& op2);
+  static void add(BigCount& dest, const BigCount& op1, const uint64_t op2);
+  // Die if op2 is larger than op1
+  static void sub(BigCount& dest, const BigCount& op1, const BigCount& op2);
+  static void sub(BigCount& dest, const BigCount& op1, const uint64_t op2);
+  static void mul(BigCount& dest, const BigCount& op1, const BigCount& op2);
+  static void mul(BigCount& dest, const BigCount& op1, const uint64_t op2);
+  // Truncating division.  Die if the divisor is 0.
+  static void div(BigCount& dest, const BigCount& op1, const BigCount& op2);
+  static void div(BigCount& dest, const BigCount& op1, const uint64_t op2);
+  static void factorial(BigCount& dest, const unsigned long int n);
+  // Return a positive value if op1 > op2, 0 if equal, negative if op1 < op2
+  static int cmp(const BigCount& op1, const BigCount& op2);
+  static int cmp(const BigCount& op1, const uint64_t op2);
+
+  // Conversion to and from GMP.  get expects dest to be initialized.
+  static void get(mpz_t dest, const BigCount& src);
+  static void set(BigCount& dest, const mpz_t src);
+  // Parse a base-10 string as mpz_set_str does.  Return false if it is not a
+  // valid non-negative number, leaving dest unchanged.
+  static bool setString(BigCount& dest, const char *str);
+  // Same, for the length characters at str, which need not be null-terminated
+  static bool setString(BigCount& dest, const char *str, const size_t length);
+
+  // Base-10 representation
+  std::string toString() const;
+  // Append the base-10 representation to output
+  void appendTo(std::string *output) const;
+  // Same result as mpz_get_d, i.e., truncated rather than rounded
+  double getDouble() const;
+  bool isZero() const { return !usemp && nativeval == 0; }
+
+ private:
+  mpz_t mpval;
+  uint64_t nativeval;
+  bool usemp;
+
+  // Compute op1 operation op2 in GMP and store the result in dest
+  static void applyMpz(BigCount& dest, const BigCount& op1,
+                       const BigCount& op2,
+                       void (*operation)(mpz_ptr, mpz_srcptr, mpz_srcptr));
+
+  void initmp();
+  void clearmp();
+  // Store a native value, dropping any GMP value
+  void setNative(const uint64_t value);
+  // Return this value as an mpz, using scratch (initialized) if it is native
+  mpz_srcptr getMpz(mpz_t scratch) const;
+  // Canonicalize value and store it, leaving value in an unspecified state
+  void takeMpz(mpz_t value);
 };
-#define BIG_COUNT_H__
-#endif
+
+
+#endif  // BIG_COUNT_H__
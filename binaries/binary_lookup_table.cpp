@@ -0,0 +1,349 @@
+// binary_lookup_table.cpp - a compact, memory-mapped binary format for lookup
+//   tables, and a writer that builds it
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binary_lookup_table.h"
+
+const char BinaryLookupTableWriter::kMagic[8] =
+  { 'G', 'C', 'F', 'L', 'K', 'U', 'P', '1' };
+
+
+BinaryLookupTable::~BinaryLookupTable() {
+  if (mapped_data_ != NULL)
+    munmap(mapped_data_, mapped_size_);
+}
+
+
+bool BinaryLookupTable::isBinaryLookupTable(const std::string& filename) {
+  FILE *fileptr = fopen(filename.c_str(), "rb");
+  if (fileptr == NULL)
+    return false;
+  char magic[sizeof(BinaryLookupTableWriter::kMagic)];
+  bool result = (fread(magic, sizeof(magic), 1, fileptr) == 1 &&
+                 memcmp(magic, BinaryLookupTableWriter::kMagic,
+                        sizeof(magic)) == 0);
+  fclose(fileptr);
+  return result;
+}
+
+
+// Map the table and set up pointers to each section, checking that every
+// section lies within the file
+bool BinaryLookupTable::load(const std::string& filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Error opening file: %s!\n", filename.c_str());
+    return false;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    perror("Error getting size of binary lookup table: ");
+    close(fd);
+    return false;
+  }
+  mapped_size_ = sb.st_size;
+  if (mapped_size_ < sizeof(BinaryLookupTableHeader)) {
+    fprintf(stderr, "Binary lookup table %s is too small!\n",
+                    filename.c_str());
+    close(fd);
+    return false;
+  }
+  mapped_data_ = mmap(NULL, mapped_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped_data_ == MAP_FAILED) {
+    mapped_data_ = NULL;
+    perror("Error mapping binary lookup table: ");
+    return false;
+  }
+
+  const char *base = static_cast<const char*>(mapped_data_);
+  header_ = reinterpret_cast<const BinaryLookupTableHeader*>(base);
+  if (memcmp(header_->magic, BinaryLookupTableWriter::kMagic,
+             sizeof(header_->magic)) != 0) {
+    fprintf(stderr, "%s is not a binary lookup table!\n", filename.c_str());
+    return false;
+  }
+
+  uint64_t n = header_->entry_count;
+  uint64_t limbs = header_->guess_limbs;
+  struct Section { uint64_t offset; uint64_t size; };
+  Section sections[] = {
+    { header_->probabilities_offset, n * sizeof(double) },
+    { header_->guesses_offset, n * limbs * sizeof(uint64_t) },
+    { header_->pattern_offsets_offset, (n + 1) * sizeof(uint64_t) },
+    { header_->patterns_offset, header_->patterns_size },
+    { header_->index_offset, header_->index_count * sizeof(double) },
+    { header_->total_count_offset, limbs * sizeof(uint64_t) }
+  };
+  for (unsigned int i = 0; i < sizeof(sections) / sizeof(sections[0]); ++i) {
+    if (sections[i].offset > mapped_size_ ||
+        sections[i].size > mapped_size_ - sections[i].offset) {
+      fprintf(stderr, "Binary lookup table %s is truncated or corrupt!\n",
+                      filename.c_str());
+      return false;
+    }
+  }
+  if (limbs == 0 || header_->index_stride == 0 ||
+      header_->index_count != (n + header_->index_stride - 1) /
+                              header_->index_stride) {
+    fprintf(stderr, "Binary lookup table %s has a corrupt header!\n",
+                    filename.c_str());
+    return false;
+  }
+
+  probabilities_ =
+    reinterpret_cast<const double*>(base + header_->probabilities_offset);
+  guesses_ = reinterpret_cast<const uint64_t*>(base + header_->guesses_offset);
+  pattern_offsets_ =
+    reinterpret_cast<const uint64_t*>(base + header_->pattern_offsets_offset);
+  patterns_ = base + header_->patterns_offset;
+  index_ = reinterpret_cast<const double*>(base + header_->index_offset);
+  return true;
+}
+
+
+void BinaryLookupTable::getLimbs(mpz_t result, const uint64_t* limbs) const {
+  mpz_init(result);
+  if (header_->guess_limbs == 1)
+    mpz_set_ui(result, limbs[0]);
+  else
+    mpz_import(result, header_->guess_limbs, -1, sizeof(uint64_t), 0, 0, limbs);
+}
+
+
+// Single-limb guess numbers are copied without going through GMP
+void BinaryLookupTable::getGuessNumber(BigCount& result,
+                                       const uint64_t entry) const {
+  const uint64_t *limbs = guesses_ + entry * header_->guess_limbs;
+  if (header_->guess_limbs == 1) {
+    result = limbs[0];
+    return;
+  }
+  mpz_t guess_number;
+  getLimbs(guess_number, limbs);
+  BigCount::set(result, guess_number);
+  mpz_clear(guess_number);
+}
+
+
+const char* BinaryLookupTable::getPattern(const uint64_t entry,
+                                          size_t *length) const {
+  *length = pattern_offsets_[entry + 1] - pattern_offsets_[entry];
+  return patterns_ + pattern_offsets_[entry];
+}
+
+
+void BinaryLookupTable::getTotalCount(mpz_t result) const {
+  const char *base = static_cast<const char*>(mapped_data_);
+  getLimbs(result, reinterpret_cast<const uint64_t*>(
+                     base + header_->total_count_offset));
+}
+
+
+// Probabilities are in decreasing order, so search with std::greater.  The
+// sparse index narrows the search to a single block of index_stride entries:
+// if index entry k is the first one not greater than key, the answer lies in
+// ((k - 1) * stride, k * stride].
+uint64_t BinaryLookupTable::lowerBound(const double key) const {
+  const double* index_end = index_ + header_->index_count;
+  const double* block = std::lower_bound(index_, index_end, key,
+                                         std::greater<double>());
+  uint64_t block_index = block - index_;
+  uint64_t stride = header_->index_stride;
+  uint64_t low = (block_index == 0) ? 0 : (block_index - 1) * stride + 1;
+  uint64_t high = std::min(block_index * stride, header_->entry_count);
+  if (block_index == header_->index_count)
+    high = header_->entry_count;
+  return std::lower_bound(probabilities_ + low, probabilities_ + high, key,
+                          std::greater<double>()) - probabilities_;
+}
+
+
+BinaryLookupTableWriter::~BinaryLookupTableWriter() {
+  FILE *files[] = { outfile_, probabilities_file_, guesses_file_,
+                    pattern_offsets_file_, patterns_file_ };
+  for (unsigned int i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+    if (files[i] != NULL)
+      fclose(files[i]);
+  }
+}
+
+
+// Open the output file and anonymous staging files for each section whose
+// size is not known in advance
+bool BinaryLookupTableWriter::open(const std::string& filename) {
+  outfile_ = fopen(filename.c_str(), "wb");
+  if (outfile_ == NULL) {
+    fprintf(stderr, "Error opening file: %s!\n", filename.c_str());
+    return false;
+  }
+  probabilities_file_ = tmpfile();
+  guesses_file_ = tmpfile();
+  pattern_offsets_file_ = tmpfile();
+  patterns_file_ = tmpfile();
+  if (probabilities_file_ == NULL || guesses_file_ == NULL ||
+      pattern_offsets_file_ == NULL || patterns_file_ == NULL) {
+    perror("Error creating temporary files for binary lookup table: ");
+    return false;
+  }
+  return true;
+}
+
+
+// Guess numbers are staged as a limb count followed by the limbs, since the
+// final width depends on the total count
+bool BinaryLookupTableWriter::addEntry(const double probability,
+                                       const mpz_t guess_number,
+                                       const std::string& pattern) {
+  if (entry_count_ % kIndexStride == 0)
+    index_.push_back(probability);
+
+  uint64_t limbs[64];
+  size_t num_limbs = 0;
+  if (mpz_sizeinbase(guess_number, 2) > 64 * 64) {
+    fprintf(stderr, "Guess number is too large for binary lookup table!\n");
+    return false;
+  }
+  mpz_export(limbs, &num_limbs, -1, sizeof(uint64_t), 0, 0, guess_number);
+  uint32_t limb_count = static_cast<uint32_t>(num_limbs);
+
+  if (fwrite(&probability, sizeof(probability), 1, probabilities_file_) != 1 ||
+      fwrite(&limb_count, sizeof(limb_count), 1, guesses_file_) != 1 ||
+      fwrite(limbs, sizeof(uint64_t), num_limbs, guesses_file_) != num_limbs ||
+      fwrite(&patterns_size_, sizeof(patterns_size_), 1,
+             pattern_offsets_file_) != 1 ||
+      fwrite(pattern.data(), 1, pattern.size(), patterns_file_) !=
+        pattern.size()) {
+    perror("Error writing binary lookup table: ");
+    return false;
+  }
+  patterns_size_ += pattern.size();
+  ++entry_count_;
+  return true;
+}
+
+
+bool BinaryLookupTableWriter::writeLimbs(FILE *outfile, const mpz_t value,
+                                         const uint64_t num_limbs) {
+  std::vector<uint64_t> limbs(num_limbs, 0);
+  size_t count = 0;
+  mpz_export(&limbs[0], &count, -1, sizeof(uint64_t), 0, 0, value);
+  return (fwrite(&limbs[0], sizeof(uint64_t), num_limbs, outfile) ==
+          num_limbs);
+}
+
+
+bool BinaryLookupTableWriter::padToAlignment(FILE *outfile) {
+  static const char zeros[8] = { 0 };
+  off_t position = ftello(outfile);
+  if (position < 0)
+    return false;
+  size_t padding = (8 - (position % 8)) % 8;
+  return (fwrite(zeros, 1, padding, outfile) == padding);
+}
+
+
+bool BinaryLookupTableWriter::appendFile(FILE *from, FILE *outfile) {
+  if (fflush(from) != 0 || fseeko(from, 0, SEEK_SET) != 0)
+    return false;
+  std::vector<char> buffer(1 << 20);
+  size_t read_size;
+  while ((read_size = fread(&buffer[0], 1, buffer.size(), from)) > 0) {
+    if (fwrite(&buffer[0], 1, read_size, outfile) != read_size)
+      return false;
+  }
+  return !ferror(from) && padToAlignment(outfile);
+}
+
+
+// Lay out the header and copy each staged section into place
+bool BinaryLookupTableWriter::finish(const mpz_t total_count) {
+  // Every guess number is at most total_count + 1
+  mpz_t largest_guess;
+  mpz_init(largest_guess);
+  mpz_add_ui(largest_guess, total_count, 1);
+  uint64_t guess_limbs = (mpz_sizeinbase(largest_guess, 2) + 63) / 64;
+  mpz_clear(largest_guess);
+  if (guess_limbs > 64) {
+    fprintf(stderr, "Total count is too large for binary lookup table!\n");
+    return false;
+  }
+
+  // Terminate the pattern offsets with the size of the heap
+  if (fwrite(&patterns_size_, sizeof(patterns_size_), 1,
+             pattern_offsets_file_) != 1)
+    return false;
+
+  BinaryLookupTableHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.entry_count = entry_count_;
+  header.guess_limbs = guess_limbs;
+  header.index_stride = kIndexStride;
+  header.index_count = index_.size();
+  // The header is a multiple of 8 bytes, so sections stay aligned
+  uint64_t offset = sizeof(header);
+  header.probabilities_offset = offset;
+  offset += entry_count_ * sizeof(double);
+  header.guesses_offset = offset;
+  offset += entry_count_ * guess_limbs * sizeof(uint64_t);
+  header.pattern_offsets_offset = offset;
+  offset += (entry_count_ + 1) * sizeof(uint64_t);
+  header.patterns_offset = offset;
+  header.patterns_size = patterns_size_;
+  offset += (patterns_size_ + 7) / 8 * 8;
+  header.index_offset = offset;
+  offset += index_.size() * sizeof(double);
+  header.total_count_offset = offset;
+
+  bool success = (fwrite(&header, sizeof(header), 1, outfile_) == 1) &&
+                 appendFile(probabilities_file_, outfile_);
+
+  // Widen each staged guess number to the fixed width
+  if (success && (fflush(guesses_file_) != 0 ||
+                  fseeko(guesses_file_, 0, SEEK_SET) != 0))
+    success = false;
+  for (uint64_t i = 0; success && i < entry_count_; ++i) {
+    uint64_t limbs[64];
+    uint32_t limb_count;
+    if (fread(&limb_count, sizeof(limb_count), 1, guesses_file_) != 1 ||
+        limb_count > guess_limbs ||
+        fread(limbs, sizeof(uint64_t), limb_count, guesses_file_) !=
+          limb_count) {
+      success = false;
+      break;
+    }
+    for (uint64_t j = limb_count; j < guess_limbs; ++j)
+      limbs[j] = 0;
+    if (fwrite(limbs, sizeof(uint64_t), guess_limbs, outfile_) != guess_limbs)
+      success = false;
+  }
+
+  success = success &&
+            appendFile(pattern_offsets_file_, outfile_) &&
+            appendFile(patterns_file_, outfile_) &&
+            (index_.empty() ||
+             fwrite(&index_[0], sizeof(double), index_.size(), outfile_) ==
+               index_.size()) &&
+            writeLimbs(outfile_, total_count, guess_limbs) &&
+            (fflush(outfile_) == 0);
+  if (!success)
+    perror("Error writing binary lookup table: ");
+  return success;
+}
@@ -0,0 +1,164 @@
+// binary_lookup_table.h - a compact, memory-mapped binary format for lookup
+//   tables, and a writer that builds it
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// The text lookup table produced by sortedcountaggregator has one line per
+// pattern: probability (as a hex float), guess number of the pattern's first
+// string, and the pattern string.  Searching it means seeking around the file
+// and reparsing lines, which costs dozens of system calls per lookup.
+//
+// The binary format holds the same data as parallel fixed-width arrays, so
+// the table can be memory-mapped and binary searched directly:
+//
+//   Header           (see BinaryLookupTableHeader below)
+//   probabilities    entry_count doubles, in decreasing order
+//   guess numbers    entry_count fixed-width unsigned integers of guess_limbs
+//                    64-bit limbs each, least significant limb first
+//   pattern offsets  entry_count + 1 uint64_t offsets into the pattern heap;
+//                    pattern i is [offsets[i], offsets[i + 1])
+//   pattern heap     all pattern strings, concatenated without separators
+//   sparse index     index_count doubles, probabilities[k * index_stride]
+//   total count      the "Total count" value, in guess_limbs limbs
+//
+// Every section starts on an 8-byte boundary.  Numbers are stored in the
+// native byte order, so tables are not portable between architectures of
+// differing endianness.
+//
+// Searches first binary search the small sparse index, which stays in cache,
+// and then the block of index_stride probabilities that it points to.
+//
+
+#ifndef BINARY_LOOKUP_TABLE_H__
+#define BINARY_LOOKUP_TABLE_H__
+
+#include <gmp.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "big_count.h"
+#include "gcfmacros.h"
+
+struct BinaryLookupTableHeader {
+  char magic[8];
+  uint64_t entry_count;
+  uint64_t guess_limbs;
+  uint64_t index_stride;
+  uint64_t index_count;
+  uint64_t probabilities_offset;
+  uint64_t guesses_offset;
+  uint64_t pattern_offsets_offset;
+  uint64_t patterns_offset;
+  uint64_t patterns_size;
+  uint64_t index_offset;
+  uint64_t total_count_offset;
+};
+
+
+// Read-only view of a binary lookup table file
+class BinaryLookupTable {
+ public:
+  BinaryLookupTable():
+    mapped_data_(NULL),
+    mapped_size_(0),
+    header_(NULL),
+    probabilities_(NULL),
+    guesses_(NULL),
+    pattern_offsets_(NULL),
+    patterns_(NULL),
+    index_(NULL) {}
+  ~BinaryLookupTable();
+
+  // Return true if the given file starts with the binary table magic
+  static bool isBinaryLookupTable(const std::string& filename);
+
+  // Map the file into memory and check its layout.  Return false on failure.
+  bool load(const std::string& filename);
+
+  uint64_t size() const { return header_->entry_count; }
+  double getProbability(const uint64_t entry) const {
+    return probabilities_[entry];
+  }
+  void getGuessNumber(BigCount& result, const uint64_t entry) const;
+  // Return a pointer to the (not null-terminated) pattern and set length
+  const char* getPattern(const uint64_t entry, size_t *length) const;
+  void getTotalCount(mpz_t result) const;
+
+  // Return the first entry whose probability is not greater than key, i.e.,
+  // the place key would be inserted.  Returns size() if every entry is more
+  // probable than key.
+  uint64_t lowerBound(const double key) const;
+
+ private:
+  void getLimbs(mpz_t result, const uint64_t* limbs) const;
+
+  void *mapped_data_;
+  size_t mapped_size_;
+  const BinaryLookupTableHeader* header_;
+  const double* probabilities_;
+  const uint64_t* guesses_;
+  const uint64_t* pattern_offsets_;
+  const char* patterns_;
+  const double* index_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(BinaryLookupTable);
+};
+
+
+// Builds a binary lookup table from entries given in table order.  Sections
+// are staged in temporary files because the number of entries and the width
+// of the guess numbers are only known at the end.
+class BinaryLookupTableWriter {
+ public:
+  BinaryLookupTableWriter():
+    outfile_(NULL),
+    probabilities_file_(NULL),
+    guesses_file_(NULL),
+    pattern_offsets_file_(NULL),
+    patterns_file_(NULL),
+    entry_count_(0),
+    patterns_size_(0) {}
+  // Closes all files; a table that was not finished is left incomplete
+  ~BinaryLookupTableWriter();
+
+  // Open the output and staging files.  Return false on failure.
+  bool open(const std::string& filename);
+  bool addEntry(const double probability,
+                const mpz_t guess_number,
+                const std::string& pattern);
+  // Write the complete table.  Return false on failure.
+  bool finish(const mpz_t total_count);
+
+  static const char kMagic[8];
+  static const uint64_t kIndexStride = 256;
+
+ private:
+  // Write limbs of value, padded with zero limbs up to num_limbs
+  static bool writeLimbs(FILE *outfile, const mpz_t value,
+                         const uint64_t num_limbs);
+  // Append the contents of from (from its start) to outfile, then pad
+  // outfile to an 8-byte boundary
+  static bool appendFile(FILE *from, FILE *outfile);
+  static bool padToAlignment(FILE *outfile);
+
+  FILE *outfile_;
+  FILE *probabilities_file_;
+  FILE *guesses_file_;
+  FILE *pattern_offsets_file_;
+  FILE *patterns_file_;
+  uint64_t entry_count_;
+  uint64_t patterns_size_;
+  std::vector<double> index_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(BinaryLookupTableWriter);
+};
+
+
+#endif  // BINARY_LOOKUP_TABLE_H__
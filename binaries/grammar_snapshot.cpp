@@ -0,0 +1,179 @@
+// grammar_snapshot.cpp - a memory-mapped binary snapshot of a loaded grammar
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "grammar_snapshot.h"
+
+const char GrammarSnapshotWriter::kMagic[8] =
+  { 'G', 'C', 'F', 'G', 'R', 'A', 'M', '4' };
+
+
+GrammarSnapshotWriter::~GrammarSnapshotWriter() {
+  if (outfile_ != NULL)
+    fclose(outfile_);
+}
+
+
+bool GrammarSnapshotWriter::open(const std::string& filename) {
+  outfile_ = fopen(filename.c_str(), "wb");
+  if (outfile_ == NULL) {
+    fprintf(stderr, "Error opening file: %s!\n", filename.c_str());
+    return false;
+  }
+  writeBytes(kMagic, sizeof(kMagic));
+  return !failed_;
+}
+
+
+void GrammarSnapshotWriter::writeUint64(const uint64_t value) {
+  writeBytes(&value, sizeof(value));
+}
+
+
+void GrammarSnapshotWriter::writeDouble(const double value) {
+  writeBytes(&value, sizeof(value));
+}
+
+
+void GrammarSnapshotWriter::writeString(const std::string& value) {
+  writeUint64(value.size());
+  writeBytes(value.data(), value.size());
+}
+
+
+void GrammarSnapshotWriter::writeBytes(const void *data, const size_t size) {
+  if (failed_ || size == 0)
+    return;
+  if (outfile_ == NULL || fwrite(data, size, 1, outfile_) != 1)
+    failed_ = true;
+}
+
+
+bool GrammarSnapshotWriter::finish() {
+  if (outfile_ == NULL)
+    return false;
+  if (fclose(outfile_) != 0)
+    failed_ = true;
+  outfile_ = NULL;
+  if (failed_)
+    fprintf(stderr, "Error writing grammar snapshot!\n");
+  return !failed_;
+}
+
+
+GrammarSnapshotReader::~GrammarSnapshotReader() {
+  if (mapped_data_ != NULL)
+    munmap(mapped_data_, mapped_size_);
+}
+
+
+bool GrammarSnapshotReader::isGrammarSnapshot(const std::string& filename) {
+  FILE *fileptr = fopen(filename.c_str(), "rb");
+  if (fileptr == NULL)
+    return false;
+  char magic[sizeof(GrammarSnapshotWriter::kMagic)];
+  bool result = (fread(magic, sizeof(magic), 1, fileptr) == 1 &&
+                 memcmp(magic, GrammarSnapshotWriter::kMagic,
+                        sizeof(magic)) == 0);
+  fclose(fileptr);
+  return result;
+}
+
+
+bool GrammarSnapshotReader::load(const std::string& filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Error opening file: %s!\n", filename.c_str());
+    return false;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    perror("Error getting size of grammar snapshot: ");
+    close(fd);
+    return false;
+  }
+  mapped_size_ = sb.st_size;
+  if (mapped_size_ < sizeof(GrammarSnapshotWriter::kMagic)) {
+    fprintf(stderr, "Grammar snapshot %s is too small!\n", filename.c_str());
+    close(fd);
+    return false;
+  }
+  mapped_data_ = mmap(NULL, mapped_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped_data_ == MAP_FAILED) {
+    mapped_data_ = NULL;
+    perror("Error mapping grammar snapshot: ");
+    return false;
+  }
+
+  position_ = static_cast<const char*>(mapped_data_);
+  end_ = position_ + mapped_size_;
+  const void *magic;
+  if (!readBytes(&magic, sizeof(GrammarSnapshotWriter::kMagic)) ||
+      memcmp(magic, GrammarSnapshotWriter::kMagic,
+             sizeof(GrammarSnapshotWriter::kMagic)) != 0) {
+    fprintf(stderr, "%s is not a grammar snapshot!\n", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+void GrammarSnapshotReader::readFrom(const GrammarSnapshotReader& source,
+                                     const char *position) {
+  position_ = position;
+  end_ = source.end_;
+}
+
+
+// Fields are not aligned, so numbers are copied out of the mapping
+bool GrammarSnapshotReader::readUint64(uint64_t *value) {
+  const void *data;
+  if (!readBytes(&data, sizeof(*value)))
+    return false;
+  memcpy(value, data, sizeof(*value));
+  return true;
+}
+
+
+bool GrammarSnapshotReader::readDouble(double *value) {
+  const void *data;
+  if (!readBytes(&data, sizeof(*value)))
+    return false;
+  memcpy(value, data, sizeof(*value));
+  return true;
+}
+
+
+bool GrammarSnapshotReader::readString(std::string *value) {
+  const char *saved_position = position_;
+  uint64_t size;
+  const void *data;
+  if (!readUint64(&size) || !readBytes(&data, size)) {
+    position_ = saved_position;
+    return false;
+  }
+  value->assign(static_cast<const char*>(data), size);
+  return true;
+}
+
+
+bool GrammarSnapshotReader::readBytes(const void **data, const size_t size) {
+  if (position_ == NULL || size > static_cast<size_t>(end_ - position_))
+    return false;
+  *data = position_;
+  position_ += size;
+  return true;
+}
@@ -0,0 +1,127 @@
+// grammar_snapshot.h - a memory-mapped binary snapshot of a loaded grammar
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Loading a grammar from text is slow: PCFG::loadGrammar parses every
+// structure line, Nonterminal::initializeTerminalGroups scans each terminals
+// file to find its groups, and every UnseenTerminalGroup scans the seen
+// terminals again to find the ones its generator mask can produce.  For large
+// grammars this takes minutes, and every tool (and every parallel worker)
+// repeats it.
+//
+// A snapshot, written by the CompileGrammar tool, records the results of that
+// work.  PCFG::loadGrammar recognizes a snapshot by its magic and maps it
+// instead of parsing the structures file, and nonterminals and terminal
+// groups are rebuilt from their records without searching for group bounds
+// or unseen terminals.  As with a grammar loaded from text, the terminal
+// groups of a nonterminal are only created once they are needed, so loading
+// a snapshot reads little more than the structure records.  Terminals files are still mapped and their seen
+// terminals indexed (see seen_terminal_index.h), since seen terminals are
+// read from them, and each nonterminal record identifies its terminals file
+// by size, inode, and modification time, so a snapshot that no longer matches
+// its terminals is rejected (see terminal_file.h).
+//
+// The snapshot is a sequence of records, read front to back:
+//
+//   magic            8 bytes, kMagic
+//   nonterminals     a count, then one record per nonterminal (see
+//                    Nonterminal::writeSnapshot), each with one record per
+//                    terminal group (see SeenTerminalGroup::writeSnapshot and
+//                    UnseenTerminalGroup::writeSnapshot)
+//   structures       a count, then one record per structure: probability,
+//                    representation, and source ids
+//
+// Records are built from three fields: 64-bit unsigned integers, doubles, and
+// strings (a 64-bit length followed by the bytes).  Numbers are stored in the
+// native byte order, so snapshots are not portable between architectures of
+// differing endianness.
+//
+
+#ifndef GRAMMAR_SNAPSHOT_H__
+#define GRAMMAR_SNAPSHOT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "gcfmacros.h"
+
+// Appends records to a snapshot file.  Write errors are remembered, so
+// callers only need to check the result of finish.
+class GrammarSnapshotWriter {
+ public:
+  GrammarSnapshotWriter(): outfile_(NULL), failed_(false) {}
+  // Closes the file; a snapshot that was not finished is left incomplete
+  ~GrammarSnapshotWriter();
+
+  // Open the output file and write the magic.  Return false on failure.
+  bool open(const std::string& filename);
+
+  void writeUint64(const uint64_t value);
+  void writeDouble(const double value);
+  void writeString(const std::string& value);
+  void writeBytes(const void *data, const size_t size);
+
+  // Flush and close the file.  Return false if any write failed.
+  bool finish();
+
+  static const char kMagic[8];
+
+ private:
+  FILE *outfile_;
+  bool failed_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(GrammarSnapshotWriter);
+};
+
+
+// Read-only mapping of a snapshot file, read front to back.  Reads return
+// false, and leave their output unchanged, if the snapshot is truncated.
+class GrammarSnapshotReader {
+ public:
+  GrammarSnapshotReader():
+    mapped_data_(NULL),
+    mapped_size_(0),
+    position_(NULL),
+    end_(NULL) {}
+  ~GrammarSnapshotReader();
+
+  // Return true if the given file starts with the snapshot magic
+  static bool isGrammarSnapshot(const std::string& filename);
+
+  // Map the file into memory and check the magic.  Return false on failure.
+  bool load(const std::string& filename);
+
+  bool readUint64(uint64_t *value);
+  bool readDouble(double *value);
+  bool readString(std::string *value);
+  // Point data at the next size bytes of the snapshot, which stay mapped for
+  // the life of the reader
+  bool readBytes(const void **data, const size_t size);
+
+  // True once every record has been read
+  bool atEnd() const { return position_ == end_; }
+
+  // The records that have not been read yet start at position.  A reader
+  // that has not loaded a file can be pointed at them with readFrom, to read
+  // them again later; nothing is mapped twice, so source must outlive it.
+  const char* position() const { return position_; }
+  void readFrom(const GrammarSnapshotReader& source, const char *position);
+
+ private:
+  void *mapped_data_;
+  size_t mapped_size_;
+  const char *position_;
+  const char *end_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(GrammarSnapshotReader);
+};
+
+
+#endif  // GRAMMAR_SNAPSHOT_H__
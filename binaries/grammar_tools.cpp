@@ -21,7 +21,9 @@
 
 #include <string.h>
 #include <assert.h>
-#include <unordered_map>
+#include <cstdint>
+
+#include "text_codec.h"
 
 #include "grammar_tools.h"
 
@@ -98,7 +100,7 @@ bool ReadStructureLine(FILE *fileptr,
       goto error;  // strtok failed!
     } else {
       // Read in probability as a hex float and assign to out-parameter
-      probability = strtod(probability_str, NULL);
+      probability = textcodec::ParseDouble(probability_str);
 
       // Check that probability is well-formed
       if (probability <= 0.0 || probability > 1.0) {
@@ -200,217 +202,55 @@ bool ReadLineFromCharArray(const char *source, size_t source_length,
   return true;
 }
 
-// out parameter data for nonterminal line
-struct pnldata {
-  const char *terminal;
-  double probability;
-  const char *source_ids;
-};
-
-// Read a line from a source buffer, taken from a nonterminal file, and parse
-// out the fields that are returned in the out-parameters.
-//
-// NOTE: This function uses strtok which destroys that source buffer.
+// Parse a line of a terminals file in place.  The line has the form:
+//   terminal<tab>probability<tab>source ids
+// where the probability is a hex float.
 //
 // Return true on success, output the offending line to stderr on failure
 bool ParseNonterminalLine(const char *source, const unsigned int length,
-                          const char **terminal,
-                          double& probability,
-                          const char **source_ids) {
-
-  // most terminal rules have <12.8m entries
-  // except for DigSym6 which has <20.5m entries
-  // set this to avoid rehashing of the map
-  // load factor is 2/3, close to optimal ln(2)
-  const size_t SIZE = 1.5*20500000;
-
-  // do not reparse previously seen lines
-  // protect if multithreaded
-  static std::unordered_map<void *, struct pnldata> map(SIZE);
-
-  // scratch space
-  static char *line = (char *)malloc(1024);
-  assert(line != 0);
-
-  void * key = (void *)source;
-  // XXXstroucki safer to use string?
-  // std::string key(source, length);
-  auto it = map.find(key);
-  if (it == map.end()) {
-    // Tokenize the buffer using strtok
-    char *terminalptr;
-    char *tokstate;
-
-    // get writable copy of string
-    assert(length + 1 < 1024);
-    strncpy(line, source, length);
-    line[length] = 0;
-
-    terminalptr = strtok_r(line, "\t", &tokstate);
-    if (terminalptr == NULL) {
-      fprintf(stderr, "Terminal field not found!\n");
-      return false;
-    }
-
-    char *probability_str;
-    probability_str = strtok_r(NULL, "\t", &tokstate);
-    if (probability_str == NULL) {
-      fprintf(stderr, "Probability field not found!\n");
-      return false;
-    }
-    // Read in probability as a hex float and assign to out-parameter
-    probability = strtod(probability_str, NULL);
-    // Check that probability is well-formed
-    if (probability <= 0.0 || probability > 1.0) {
-      fprintf(stderr, "Probability field not parsed correctly!\n");
-      return false;
-    }
-
-    // The remainder of the line will be source ids
-    char *sourceidsptr;
-    sourceidsptr = strtok_r(NULL, "\n", &tokstate);
-    if (sourceidsptr == NULL) {
-      fprintf(stderr,
-              "Source IDs field not found!\n");
-      return false;
-    }
-
-    // XXXXstroucki can internalize the sourceids by inserting in
-    // a set and getting the first of the iterator returned
-    struct pnldata value = {strdup(terminalptr), probability, strdup(sourceidsptr)};
-    auto foo = map.insert({key, value});
-    // insert returns pair<iterator, bool>
-    it = foo.first;
-  }
-
-  auto& data = it->second;
-  *terminal = data.terminal;
-  probability = data.probability;
-  *source_ids = data.source_ids;
-
-  return true;
-}
-
-
-// Given a source pointer of size source_length, count the number of terminal
-// groups in the data and place the result in an out parameter.
-//
-// Return true on success, return false on any failure to parse
-bool CountTerminalGroupsInText(const char *source, size_t source_length,
-                               uint64_t& number_of_groups) {
-  // Count the number of terminal groups in the terminal_data
-  const char *current_position = source;
-  size_t bytes_remaining = source_length;
-  number_of_groups = 0;
-  double last_probability = 0.0;
-
-  while (bytes_remaining > 0) {
-    // Read a line from source into a buffer
-    unsigned int bytes_read;
-    // Note: bytes_read below is passed-by-reference (see declaration of
-    // ReadLineFromCharArray)
-    if (!grammartools::ReadLineFromCharArray2(current_position,
-                                             bytes_read)) {
-      fprintf(stderr,
-        "Newline character not found with read starting at byte %ld!\n",
-        current_position - source);
-      return false;
-    }
-    if (bytes_read == 1) {
-      // Blank line, so expect unseen terminals
-      last_probability = 0.0;
-      current_position += bytes_read;
-      bytes_remaining -= bytes_read;
-      continue;
-    }
-
-    // Get probability from the line so we can see if it is different from
-    // the last probability seen
-    const char *terminal, *source_ids;
-    double probability;
-    if (!grammartools::ParseNonterminalLine(current_position, bytes_read, &terminal,
-                                            probability, &source_ids)) {
-      fprintf(stderr,
-        "Line could not be parsed with read starting at byte %ld!\n",
-        current_position - source);
-      return false;
-    }
-
-    // Check for a change in probability
-    if (probability != last_probability)
-      ++number_of_groups;
-
-    // Update last_probability
-    last_probability = probability;
-    // Jump ahead the data pointer
-    current_position += bytes_read;
-    bytes_remaining -= bytes_read;
-  }
-  return true;
-}
-
-
-// Given a source pointer of size source_length, check if the current line is
-// at the end of a terminal group.  The boolean is returned in an out parameter.
-//
-// The current line is at the end of a terminal group if:
-// - The next line has a different probability from the current line
-// - The next line is blank
-// - There is a current line but no next line (end of source)
-//
-// If the current line is blank, this is not considered the end of a group.
-//
-// Return true on success, return false on any failure to parse
-bool IsEndOfTerminalGroup(const char *source, size_t source_length,
-                          bool& end_of_group) {
-  unsigned int bytes_read;
-
-  if (!ReadLineFromCharArray2(source, bytes_read)) {
+                          TerminalLine *line) {
+  unsigned int line_length = length;
+  if (line_length > 0 && source[line_length - 1] == '\n')
+    --line_length;
+
+  const char *terminal_end =
+    static_cast<const char *>(memchr(source, '\t', line_length));
+  if (terminal_end == NULL || terminal_end == source) {
+    fprintf(stderr, "Terminal field not found in line: %.*s\n",
+            static_cast<int>(line_length), source);
     return false;
   }
 
-  unsigned int firstlength = bytes_read;
-
-  // Case: current line is blank -- this is not counted as an end of group
-  if (bytes_read == 1) {
-    end_of_group = false;
-    return true;
-  }
-
-  // Case: no next line
-  if ((source_length - bytes_read) == 0) {
-    end_of_group = true;
-    return true;
-  }
-
-  // Now that we know there is a next line, grab it
-  const char *peek = source + bytes_read;
-  if (!ReadLineFromCharArray2(peek, bytes_read)) {
+  const char *probability_str = terminal_end + 1;
+  const char *probability_end = static_cast<const char *>(
+    memchr(probability_str, '\t', source + line_length - probability_str));
+  if (probability_end == NULL || probability_end == probability_str) {
+    fprintf(stderr, "Probability field not found in line: %.*s\n",
+            static_cast<int>(line_length), source);
     return false;
   }
-
-  unsigned int peeklength = bytes_read;
-
-  // Case: next line is blank
-  if (bytes_read == 1) {
-    end_of_group = true;
-    return true;
-  }
-
-  // Case: next line has differing probability from current line
-  // Parse both lines and extract the probabilities (ignore other fields,
-  // but still return false on parse error)
-  const char *terminal, *source_ids;
-  double current_probability, next_probability;
-  if (!ParseNonterminalLine(source, firstlength, &terminal,
-                            current_probability, &source_ids)) {
+  // Read in probability as a hex float and check that it is well-formed
+  double probability = textcodec::ParseDouble(probability_str);
+  if (probability <= 0.0 || probability > 1.0) {
+    fprintf(stderr, "Probability field not parsed correctly in line: %.*s\n",
+            static_cast<int>(line_length), source);
     return false;
   }
-  if (!ParseNonterminalLine(peek, peeklength, &terminal,
-                            next_probability, &source_ids)) {
+
+  // The remainder of the line will be source ids
+  const char *source_ids = probability_end + 1;
+  if (source_ids == source + line_length) {
+    fprintf(stderr, "Source IDs field not found in line: %.*s\n",
+            static_cast<int>(line_length), source);
     return false;
   }
-  end_of_group = (current_probability != next_probability);
+
+  line->terminal = source;
+  line->source_ids = source_ids;
+  line->probability = probability;
+  line->terminal_length = terminal_end - source;
+  line->source_ids_length = source + line_length - source_ids;
+  line->length = length;
   return true;
 }
 
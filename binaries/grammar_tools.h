@@ -65,37 +65,26 @@ bool ReadLineFromCharArray2(const char *source,
 bool ReadLineFromCharArray(const char *source, size_t source_length,
                            char *destination, unsigned int &bytes_read);
 
-// Read a line from a source buffer, taken from a nonterminal file, and parse
-// out the fields that are returned in the out-parameters.
-// 
-// NOTE: This function uses strtok which destroys that source buffer.
+// The fields of a line of a terminals file.  terminal and source_ids point
+// into the line itself and are not null-terminated.  length is the length of
+// the whole line, including its newline.
+struct TerminalLine {
+  const char *terminal;
+  const char *source_ids;
+  double probability;
+  unsigned int terminal_length;
+  unsigned int source_ids_length;
+  unsigned int length;
+};
+
+// Parse a line of the given length (including its newline, if any) from a
+// source buffer, taken from a nonterminal file, into line.  Nothing is copied
+// or cached, so this function is thread-safe and the fields of line remain
+// valid as long as the source buffer does.
 // 
 // Return true on success, output the offending line to stderr on failure
 bool ParseNonterminalLine(const char *source, const unsigned int length,
-                          const char **terminal, 
-                          double& probability,
-                          const char **source_ids);
-
-// Given a source pointer of size source_length, count the number of terminal
-// groups in the data and place the result in an out parameter.
-//
-// Return true on success, return false on any failure to parse
-bool CountTerminalGroupsInText(const char *source, size_t source_length,
-                               uint64_t& number_of_groups);
-
-// Given a source pointer of size source_length, check if the current line is
-// at the end of a terminal group.  The boolean is returned in an out parameter.
-//
-// The current line is at the end of a terminal group if:
-// - The next line has a different probability from the current line
-// - The next line is blank
-// - There is a current line but no next line (end of source)
-//
-// If the current line is blank, this is not considered the end of a group.
-//
-// Return true on success, return false on any failure to parse
-bool IsEndOfTerminalGroup(const char *source, size_t source_length,
-                          bool& end_of_group);
+                          TerminalLine *line);
 
 // Given a string of source_ids, which is a comma-separated list of values,
 // parse out the values and add them to the given std::unordered set
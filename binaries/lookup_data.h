@@ -17,14 +17,21 @@
 // non-parseable code, such as kTerminalNotFound, ignore the index, 
 // probability, and other fields.
 //
+// Lookups fill in LookupData objects owned by the caller, usually on the
+// stack, and none of the fields allocate for typical passwords, so a lookup
+// does not touch the heap.  Source ids are the exception: they are only
+// filled in for the structure that wins a PCFG::lookup.
+//
 
 #ifndef LOOKUP_DATA_H__
 #define LOOKUP_DATA_H__
 
-#include <gmp.h>
 #include <cstdint>
+#include <string>
 #include <unordered_set>
 
+#include "big_count.h"
+
 // ParseStatus is an enum of bit flags
 enum ParseStatus {
     kCanParse = 1 << 0,
@@ -44,13 +51,32 @@ inline ParseStatus operator|(ParseStatus a, ParseStatus b) {
 struct LookupData {
     ParseStatus parse_status;
     double probability;
-    mpz_t index;
+    BigCount index;
     std::unordered_set<std::string> source_ids;
     std::string first_string_of_pattern;
+
+    // Return to the state of a default-constructed object, keeping any
+    // memory already allocated
+    void clear() {
+      parse_status = kUnexpectedFailure;
+      probability = -1;
+      index = 0;
+      source_ids.clear();
+      first_string_of_pattern.clear();
+    }
 };
 
-struct TerminalLookupData : LookupData {
+// The lookup of a single terminal.  Source ids are not parsed; source_ids
+// points to the source_ids_length bytes of their unparsed, comma-separated
+// form (see grammartools::AddSourceIDsFromString), which stays valid for the
+// life of the grammar and is not null-terminated.
+struct TerminalLookupData {
+    ParseStatus parse_status;
+    double probability;
+    BigCount index;
     uint64_t terminal_group_index;
+    const char *source_ids;
+    unsigned int source_ids_length;
 };
 
 
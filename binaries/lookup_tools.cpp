@@ -19,6 +19,10 @@
 #include <cstring>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <unordered_map>
+
+#include "text_codec.h"
 
 #include "lookup_tools.h"
 
@@ -74,7 +78,7 @@ bool ReadLookupTableLine(FILE *fileptr,
       goto error;  // strtok failed!
     } else {
       // Read in probability as a hex float and assign to out-parameter      
-      probability = strtod(probability_str, NULL);
+      probability = textcodec::ParseDouble(probability_str);
 
       // Check that probability is well-formed
       if (probability <= 0.0 || probability > 1.0) {
@@ -217,10 +221,10 @@ double FindLastProbability(FILE *lookupFile) {
   fseeko(lookupFile, -1, SEEK_CUR);
 
   // Parse the probability and return
-  // Need to use strtod and this requires a char * -- a file stream won't work
+  // Parsing requires a char * -- a file stream won't work
   char buf[1024];
   fgets(buf, 1024, lookupFile);
-  return strtod(buf, NULL);
+  return textcodec::ParseDouble(buf);
 }
 
 
@@ -394,33 +398,103 @@ ParseStatus BinarySearchLookupTable(FILE *lookupFile, double key) {
 
 
 
+// Bisect the byte range [low, high), where low and high are always the starts
+// of lines, starting from low = start:
+//
+// Invariant: a) Every line that starts before low has probability > key
+//            b) The line at high has probability <= key, or is the
+//               "Total count" line
+// - high = (seek to file size - 1; RewindOneLine)
+// while (low < high)
+// - mid = (high - low)/2 + low
+// - midpos = start of the line containing mid (RewindOneLine(mid + 1))
+// - if ((Probability at midpos) > key)
+//   - low = ForwardOneLine(midpos)
+// - else
+//   - high = midpos
+// - seek to low
+//
+// low <= midpos <= mid < high, so each step shrinks the range.
+//
+// Die on file operation errors.
+//
+void SeekLookupTable(FILE *lookupFile, double key, off_t start) {
+  off_t low = start;
+  // The "Total count" line ends the entries
+  if (fseeko(lookupFile, -1, SEEK_END) != 0) {
+    perror("Error seeking to end of lookup table file: ");
+    exit(EXIT_FAILURE);
+  }
+  RewindOneLine(lookupFile);
+  off_t high = ftello(lookupFile);
+  if (high < 0) {
+    perror("Error getting position of file from ftello: ");
+    exit(EXIT_FAILURE);
+  }
+
+  double read_probability;
+  std::string guess_number, pattern_string;
+  while (low < high) {
+    off_t mid = ((high - low) / 2) + low;
+
+    // Move to the start of the line containing mid.  Rewinding from the first
+    // line fails harmlessly and leaves the file at its start.
+    if (fseeko(lookupFile, mid + 1, SEEK_SET) != 0) {
+      fprintf(stderr, "Tried seeking to position %jd\n",
+                      static_cast<intmax_t>(mid + 1));
+      perror("Error seeking to mid in lookup table file: ");
+      exit(EXIT_FAILURE);
+    }
+    RewindOneLine(lookupFile);
+    off_t midpos = ftello(lookupFile);
+    if (midpos < 0) {
+      perror("Error getting position of file from ftello: ");
+      exit(EXIT_FAILURE);
+    }
+
+    if (!ReadLookupTableLine(lookupFile, read_probability, guess_number,
+                             pattern_string)) {
+      fprintf(stderr, "Unable to read probability from lookup table file!\n");
+      exit(EXIT_FAILURE);
+    }
+    if (read_probability > key) {
+      low = ftello(lookupFile);
+      if (low < 0) {
+        perror("Error getting position of file from ftello: ");
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      high = midpos;
+    }
+  }
+
+  if (fseeko(lookupFile, low, SEEK_SET) != 0) {
+    perror("Error seeking to \'low\' position in lookup table file: ");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
 // Given a FILE pointer to a lookup table, and two keys: a probability and
-// a pattern string, return a LookupData object where parse_status represents
+// a pattern string, fill in lookup_data so that parse_status represents
 // the search success and index is the rank of this pattern, i.e., guess number
-// as found in the lookup table.
+// as found in the lookup table.  Other fields are not changed.
 //
 // Note that unlike the way ranks are computed everywhere else in the guess
 // calculator framework, the guess number is one-indexed rather than zero-indexed.
 // This is because it represents a count, rather than an abstract rank or index.
 //
-LookupData *TableLookup(FILE *lookupFile, const double probability, 
-                        const std::string& patternkey) {
-  LookupData *lookup_data = new LookupData;
-  mpz_init_set_si(lookup_data->index, -1);
-
-  // If the probability is lower than anything in the lookup table, return
-  static double lowest_probability = FindLastProbability(lookupFile);
-  if (probability < lowest_probability) {
-    lookup_data->parse_status = kBeyondCutoff;
-    return lookup_data;
-  }
-
-  // Move the file pointer to the first probability in the file that matches
+void TableLookup(FILE *lookupFile, const double probability, 
+                 const std::string& patternkey, LookupData *lookup_data) {
+  // Move the file pointer to the first probability in the file that matches.
+  // This returns kBeyondCutoff if the probability is lower than anything in
+  // the lookup table.  The lowest probability is not cached here, since the
+  // function can be called on different files and from different threads.
   ParseStatus return_status = BinarySearchLookupTable(lookupFile, probability);
   if (!(return_status & kCanParse)) {
     // Key was not found!
     lookup_data->parse_status = return_status;
-    return lookup_data;
+    return;
   }
 
   // Now check for the pattern key among the matching lines -- there can be 
@@ -441,15 +515,253 @@ LookupData *TableLookup(FILE *lookupFile, const double probability,
     }
     if (patternkey == pattern_string) {
       // Found match!
-      mpz_set_str(lookup_data->index, guess_number.c_str(), 10);
+      if (!BigCount::setString(lookup_data->index, guess_number.c_str())) {
+        fprintf(stderr, "Unable to parse guess number %s in lookup table "
+                        "file!\n", guess_number.c_str());
+        exit(EXIT_FAILURE);
+      }
       lookup_data->parse_status = kCanParse;
-      return lookup_data;
+      return;
     }
   }
 
   // If here, a pattern key match was not found
   lookup_data->parse_status = kUnexpectedFailure;
-  return lookup_data;
+}
+
+
+// Binary table version of TableLookup.  Return codes match the text version:
+// kBeyondCutoff if the probability is below the last entry, and
+// kUnexpectedFailure if the probability or pattern is not in the table.
+void TableLookup(const BinaryLookupTable& lookupTable,
+                 const double probability,
+                 const std::string& patternkey, LookupData *lookup_data) {
+  uint64_t table_size = lookupTable.size();
+  if (table_size == 0 ||
+      probability < lookupTable.getProbability(table_size - 1)) {
+    lookup_data->parse_status = kBeyondCutoff;
+    return;
+  }
+
+  // Check each entry with a matching probability for the pattern key
+  for (uint64_t i = lookupTable.lowerBound(probability);
+       i < table_size && lookupTable.getProbability(i) == probability; ++i) {
+    size_t pattern_length;
+    const char *pattern = lookupTable.getPattern(i, &pattern_length);
+    if (pattern_length == patternkey.size() &&
+        memcmp(pattern, patternkey.data(), pattern_length) == 0) {
+      // Found match!
+      lookupTable.getGuessNumber(lookup_data->index, i);
+      lookup_data->parse_status = kCanParse;
+      return;
+    }
+  }
+
+  // If here, the probability or the pattern key was not found
+  lookup_data->parse_status = kUnexpectedFailure;
+}
+
+
+// Forward-only views of the two table formats used by BatchTableLookup.
+// advance() moves to the next entry and returns false at the end of the
+// table.  skip(key) passes over the entries ahead of the cursor with
+// probability above key, by binary search, so that the next advance() moves
+// to the first entry with probability at most key.
+class TableCursor {
+ public:
+  virtual ~TableCursor() {}
+  virtual bool advance() = 0;
+  virtual void skip(double key) = 0;
+  virtual double probability() const = 0;
+  virtual void getPattern(std::string& pattern) const = 0;
+  virtual void getGuessNumber(BigCount& result) const = 0;
+};
+
+
+// Reads the text table line by line from the start of the file
+class TextTableCursor : public TableCursor {
+ public:
+  explicit TextTableCursor(FILE *lookupFile)
+    : lookupFile_(lookupFile), probability_(0.0) {
+    rewind(lookupFile_);
+  }
+
+  bool advance() {
+    // Stop at the "Total count" line
+    int peek_character = fgetc(lookupFile_);
+    if (peek_character == EOF || peek_character == 'T')
+      return false;
+    ungetc(peek_character, lookupFile_);
+    if (!ReadLookupTableLine(lookupFile_, probability_, guess_number_,
+                             pattern_string_)) {
+      fprintf(stderr, "Unable to parse values from line in lookup table file!\n");
+      exit(EXIT_FAILURE);
+    }
+    return true;
+  }
+  // The file is always at the start of the line after the current entry
+  void skip(double key) {
+    off_t position = ftello(lookupFile_);
+    if (position < 0) {
+      perror("Error getting position of file from ftello: ");
+      exit(EXIT_FAILURE);
+    }
+    SeekLookupTable(lookupFile_, key, position);
+  }
+  double probability() const { return probability_; }
+  void getPattern(std::string& pattern) const { pattern = pattern_string_; }
+  void getGuessNumber(BigCount& result) const {
+    if (!BigCount::setString(result, guess_number_.c_str())) {
+      fprintf(stderr, "Unable to parse guess number %s in lookup table "
+                      "file!\n", guess_number_.c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+
+ private:
+  FILE *lookupFile_;
+  double probability_;
+  std::string guess_number_, pattern_string_;
+};
+
+
+// Walks the arrays of a binary table
+class BinaryTableCursor : public TableCursor {
+ public:
+  explicit BinaryTableCursor(const BinaryLookupTable& lookupTable)
+    : lookupTable_(lookupTable), next_entry_(0), entry_(0) {}
+
+  bool advance() {
+    if (next_entry_ >= lookupTable_.size())
+      return false;
+    entry_ = next_entry_++;
+    return true;
+  }
+  void skip(double key) {
+    next_entry_ = std::max(next_entry_, lookupTable_.lowerBound(key));
+  }
+  double probability() const { return lookupTable_.getProbability(entry_); }
+  void getPattern(std::string& pattern) const {
+    size_t pattern_length;
+    const char *pattern_data = lookupTable_.getPattern(entry_, &pattern_length);
+    pattern.assign(pattern_data, pattern_length);
+  }
+  void getGuessNumber(BigCount& result) const {
+    lookupTable_.getGuessNumber(result, entry_);
+  }
+
+ private:
+  const BinaryLookupTable& lookupTable_;
+  uint64_t next_entry_;
+  uint64_t entry_;
+};
+
+
+// The merge pass shared by both BatchTableLookup functions
+//
+// Queries are visited in order of decreasing probability, alongside the
+// table.  Within a block of table entries that share a probability, entries
+// are not ordered by pattern, so the queries with that probability are put in
+// a hash map from pattern to queries and each table entry is looked up in it.
+// Queries whose probability falls between table probabilities are not in the
+// table (kUnexpectedFailure), and queries below the last table probability
+// are beyond the cutoff (kBeyondCutoff), as in TableLookup.
+//
+// The cursor skips ahead to the next query's probability, both before the
+// first block and between blocks, so table entries between the queries are
+// not read.  A batch costs about as much as a binary search per distinct
+// probability, and never more than one pass over the table.
+static void MergeTableLookup(TableCursor *cursor,
+                             const std::vector<const LookupData*>& queries,
+                             std::vector<LookupData> *results) {
+  results->resize(queries.size());
+  for (unsigned int i = 0; i < queries.size(); ++i)
+    (*results)[i].clear();
+
+  // Sort by (probability, first_string_of_pattern), most probable first
+  std::vector<unsigned int> order(queries.size());
+  for (unsigned int i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [&queries](unsigned int a, unsigned int b) {
+    if (queries[a]->probability != queries[b]->probability)
+      return queries[a]->probability > queries[b]->probability;
+    return queries[a]->first_string_of_pattern <
+           queries[b]->first_string_of_pattern;
+  });
+
+  unsigned int next_query = 0;
+  if (!order.empty())
+    cursor->skip(queries[order[0]]->probability);
+  bool have_entry = cursor->advance();
+  double last_probability = 1.0;
+  bool no_entries = !have_entry;
+  std::string pattern;
+  while (next_query < order.size() && have_entry) {
+    double block_probability = cursor->probability();
+    last_probability = block_probability;
+
+    // Queries more probable than this block are not in the table
+    while (next_query < order.size() &&
+           queries[order[next_query]]->probability > block_probability)
+      ++next_query;
+
+    // Gather the queries for this block
+    std::unordered_multimap<std::string, unsigned int> block_queries;
+    while (next_query < order.size() &&
+           queries[order[next_query]]->probability == block_probability) {
+      unsigned int query = order[next_query];
+      block_queries.insert(std::make_pair(
+        queries[query]->first_string_of_pattern, query));
+      ++next_query;
+    }
+
+    // Scan the block, checking each entry against the queries
+    while (have_entry && cursor->probability() == block_probability) {
+      if (!block_queries.empty()) {
+        cursor->getPattern(pattern);
+        auto matches = block_queries.equal_range(pattern);
+        for (auto it = matches.first; it != matches.second; ++it) {
+          LookupData *result = &(*results)[it->second];
+          cursor->getGuessNumber(result->index);
+          result->parse_status = kCanParse;
+        }
+        block_queries.erase(matches.first, matches.second);
+      }
+      have_entry = cursor->advance();
+    }
+
+    // Skip the blocks between this one and the next query
+    if (have_entry && next_query < order.size() &&
+        queries[order[next_query]]->probability < cursor->probability()) {
+      last_probability = cursor->probability();
+      cursor->skip(queries[order[next_query]]->probability);
+      have_entry = cursor->advance();
+    }
+  }
+
+  // Remaining queries are beyond the end of the table
+  for (; next_query < order.size(); ++next_query) {
+    unsigned int query = order[next_query];
+    if (no_entries || queries[query]->probability < last_probability)
+      (*results)[query].parse_status = kBeyondCutoff;
+  }
+}
+
+
+void BatchTableLookup(FILE *lookupFile,
+                      const std::vector<const LookupData*>& queries,
+                      std::vector<LookupData> *results) {
+  TextTableCursor cursor(lookupFile);
+  MergeTableLookup(&cursor, queries, results);
+}
+
+
+void BatchTableLookup(const BinaryLookupTable& lookupTable,
+                      const std::vector<const LookupData*>& queries,
+                      std::vector<LookupData> *results) {
+  BinaryTableCursor cursor(lookupTable);
+  MergeTableLookup(&cursor, queries, results);
 }
 
 
@@ -18,9 +18,12 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 #include <cstdio>
+#include <sys/types.h>
 
 #include "lookup_data.h"
+#include "binary_lookup_table.h"
 
 namespace lookuptools {
 
@@ -74,17 +77,50 @@ double FindLastProbability(FILE *lookupFile);
 ParseStatus BinarySearchLookupTable(FILE *lookupFile, double key);
 
 
+// Move the file position to the start of the first line of the lookup table,
+// at or after the line starting at start, whose probability is at most key, or
+// to the "Total count" line if there is none.  This is the same kind of binary
+// search as above.
+//
+// Die on any unexpected error, such as file operation errors.
+void SeekLookupTable(FILE *lookupFile, double key, off_t start);
+
+
 // Given a FILE pointer to a lookup table, and two keys: a probability and
-// a pattern string, return a LookupData object where parse_status represents
+// a pattern string, fill in lookup_data so that parse_status represents
 // the search success and index is the rank of this pattern, i.e., guess number
-// as found in the lookup table.
+// as found in the lookup table.  Other fields are not changed.
 //
 // Note that unlike the way ranks are computed everywhere else in the guess
 // calculator framework, the guess number is one-indexed rather than zero-indexed.
 // This is because it represents a count, rather than an abstract rank or index.
 //
-LookupData *TableLookup(FILE *lookupFile, const double probability, 
-                        const std::string& patternkey);
+void TableLookup(FILE *lookupFile, const double probability, 
+                 const std::string& patternkey, LookupData *lookup_data);
+
+
+// Same as above, but search a memory-mapped binary lookup table, which needs
+// no file operations
+void TableLookup(const BinaryLookupTable& lookupTable,
+                 const double probability,
+                 const std::string& patternkey, LookupData *lookup_data);
+
+
+// Batch versions of TableLookup.  Each query is a LookupData from
+// PCFG::lookup whose probability and first_string_of_pattern are the keys.
+// The queries are sorted by decreasing probability and answered in a single
+// forward pass over the table, which skips ahead by binary search to each
+// query probability rather than reading every entry.
+//
+// Fills in results with one LookupData per query, in the same order as the
+// queries, with the same parse_status and index that TableLookup would give.
+// results is resized as needed, so it can be reused between batches.
+void BatchTableLookup(FILE *lookupFile,
+                      const std::vector<const LookupData*>& queries,
+                      std::vector<LookupData> *results);
+void BatchTableLookup(const BinaryLookupTable& lookupTable,
+                      const std::vector<const LookupData*>& queries,
+                      std::vector<LookupData> *results);
 
 
 } // namespace lookuptools
@@ -21,40 +21,58 @@
 // Constructor
 // Assign bases to the positions_ array in order from 0 to size - 1
 MixedRadixNumber::MixedRadixNumber(const uint64_t *radices,
-                                   const unsigned int size) {
-  positions_ = new DigitWithRadix[size];
-  size_ = size;
-  for (unsigned int i = 0; i < size_; ++i) {
-    positions_[i].base = radices[i];
-  }
-  clear();
+                                   const unsigned int size):
+    positions_(inline_positions_), size_(0) {
+  reset(radices, size);
 }
 
 // Deep copy function -- Make a new object and copy this object's properties
 // to it.
 MixedRadixNumber* MixedRadixNumber::deepCopy() const {
-  // Get radices into a single array
-  uint64_t *copy_of_radices = new uint64_t[size_];
-  for (unsigned int i = 0; i < size_; ++i) {
-    copy_of_radices[i] = positions_[i].base;
+  MixedRadixNumber* copy = new MixedRadixNumber;
+  copy->assign(*this);
+  return copy;
+}
+
+
+// Destructor
+MixedRadixNumber::~MixedRadixNumber() {
+  if (positions_ != inline_positions_)
+    delete[] positions_;
+}
+
+
+// Only allocate when the positions do not fit inline
+void MixedRadixNumber::resize(const unsigned int size) {
+  if (size > kInlineSize && size != size_) {
+    if (positions_ != inline_positions_)
+      delete[] positions_;
+    positions_ = new DigitWithRadix[size];
+  } else if (size <= kInlineSize && positions_ != inline_positions_) {
+    delete[] positions_;
+    positions_ = inline_positions_;
   }
+  size_ = size;
+}
+
 
-  // Make new object with these radices
-  MixedRadixNumber* copy = new MixedRadixNumber(copy_of_radices, size_);
-  delete[] copy_of_radices;
-  
-  // Now just need to copy positions
+void MixedRadixNumber::reset(const uint64_t *radices,
+                             const unsigned int size) {
+  resize(size);
   for (unsigned int i = 0; i < size_; ++i) {
-    copy->positions_[i].digit = positions_[i].digit;
+    positions_[i].base = radices[i];
   }
-
-  return copy;
+  clear();
 }
 
 
-// Destructor
-MixedRadixNumber::~MixedRadixNumber() {
-  delete[] positions_;
+void MixedRadixNumber::assign(const MixedRadixNumber& other) {
+  if (&other == this)
+    return;
+  resize(other.size_);
+  for (unsigned int i = 0; i < size_; ++i) {
+    positions_[i] = other.positions_[i];
+  }
 }
 
 
@@ -107,11 +125,15 @@ bool MixedRadixNumber::intelligentSkip() {
 }
 
 
-// Simple getter function
+// Simple getter functions
 uint64_t MixedRadixNumber::getPlace(unsigned int place) const {
   return positions_[place].digit;
 }
 
+uint64_t MixedRadixNumber::getRadix(unsigned int place) const {
+  return positions_[place].base;
+}
+
 // Function for setting places manually - returns true on success
 bool MixedRadixNumber::setPlace(unsigned int place, uint64_t value) {
   if (place < size_ && value < positions_[place].base) {
@@ -37,7 +37,9 @@
 // IntelligentSkip to 34600.
 //
 // The mixed-radix number is organized such that each digit and its
-// corresponding base is a single object.
+// corresponding base is a single object.  Structures rarely have more than a
+// handful of nonterminals, so up to kInlineSize positions are stored in the
+// object itself, and a number on the stack needs no heap allocation.
 //
 #ifndef MIXED_RADIX_NUMBER_H__
 #define MIXED_RADIX_NUMBER_H__
@@ -52,6 +54,8 @@ public:
     uint64_t base;
   };
 
+  // Construct a number with no positions, to be set up by reset or assign
+  MixedRadixNumber(): positions_(inline_positions_), size_(0) {}
   // Construct object with given radices and all digits set to 0
   MixedRadixNumber(const uint64_t *radices, const unsigned int size);
   ~MixedRadixNumber();
@@ -59,12 +63,19 @@ public:
   // Reset all digits to zero
   void clear();  
 
+  // Replace the radices with the given ones and set all digits to 0
+  void reset(const uint64_t *radices, const unsigned int size);
+  // Make this number a copy of other, radices and digits
+  void assign(const MixedRadixNumber& other);
+
   // The following routines return false on overflow
   bool increment();
   bool intelligentSkip();
 
-  // Simple getter function
+  // Simple getter functions
   uint64_t getPlace(unsigned int place) const;
+  uint64_t getRadix(unsigned int place) const;
+  unsigned int size() const { return size_; }
 
   // Function for setting places manually - returns true on success
   bool setPlace(unsigned int place, uint64_t value);
@@ -73,8 +84,15 @@ public:
   MixedRadixNumber* deepCopy() const;
 
 private:
+  static const unsigned int kInlineSize = 16;
+
+  // Resize positions_ to hold size positions, leaving them uninitialized
+  void resize(const unsigned int size);
+
+  // Points at inline_positions_ unless size_ is larger than kInlineSize
   DigitWithRadix *positions_;
   unsigned int size_;
+  DigitWithRadix inline_positions_[kInlineSize];
 
   // Disable copy and assignment
   DISALLOW_COPY_AND_ASSIGN(MixedRadixNumber);
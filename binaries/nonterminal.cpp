@@ -16,15 +16,7 @@
 // Includes not covered in header file
 #include <cstdlib>
 #include <algorithm>
-#include <fcntl.h>
-#include <unistd.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <errno.h>
-#include <memory>
-#include <unordered_map>
 
 #include "big_count.h"
 #include "grammar_tools.h"
@@ -41,234 +33,299 @@ Nonterminal::~Nonterminal() {
     for (unsigned int i = 0; i < terminal_groups_size_; ++i)
       delete terminal_groups_[i];
     delete[] terminal_groups_;
-  // Unmap the terminal data file
-  // XXXstroucki mmaps disappear on exit, beware that we reuse the
-  // char* now. Better to use a counted type.
-  if (terminal_data_ != NULL)
-    munmap(terminal_data_, terminal_data_size_);
+  // The terminal data file is unmapped when its last user releases
+  // terminal_file_
 }
 
-struct stringsize {
-  char *string;
-  size_t size;
-};
 
-// Init routine will use the given representation to find the correct terminals
-// file in the terminals_folder and memory map it.  It will then make a pass
-// through the terminal data to identify and store terminal group information
-// in TerminalGroup objects.
+// Return the name of the terminals file used by the given representation,
+// relative to the terminals folder.  Terminals are all downcased when stored,
+// so "U" is replaced by "L".
+std::string Nonterminal::getTerminalRepresentation(
+    const std::string& representation) {
+  std::string terminal_representation = representation;
+  std::replace(terminal_representation.begin(),
+               terminal_representation.end(),
+               'U',
+               'L');
+  return terminal_representation;
+}
+
+
+// Init routine will use the given memory-mapped terminals file (see
+// TerminalFile), and the index of its seen terminals, to identify and store
+// terminal group information in TerminalGroup objects.  This is deferred to
+// loadTerminalGroups, so here we only keep the file.
 //
-// The terminals file must be found at:
+// The terminals file must be the one found at:
 // terminals_folder + terminal_representation_.txt
-// where terminal_representation_ is representation with "U" replaced by "L"
-// because terminals are all downcased when stored.
+// where terminal_representation_ is given by getTerminalRepresentation.
+// NonterminalCollection shares one TerminalFile between all nonterminals
+// with the same terminal representation.
 //
 // Returns true on success
-bool Nonterminal::loadNonterminal(const std::string& representation,
-                                  const std::string& terminals_folder) {
-
-  // protect if multithreaded
-  static std::unordered_map<std::string, struct stringsize>mapped_data;
+bool Nonterminal::loadNonterminal(
+    const std::string& representation,
+    const std::shared_ptr<const TerminalFile>& terminal_file,
+    const std::shared_ptr<SeenTerminalIndex>& seen_index) {
   representation_ = representation;
   // Create "terminal" representation
-  terminal_representation_ = representation;
-  std::replace(terminal_representation_.begin(),
-               terminal_representation_.end(),
-               'U',
-               'L');
+  terminal_representation_ = getTerminalRepresentation(representation);
 
+  terminal_file_ = terminal_file;
+  seen_index_ = seen_index;
+  terminal_data_ = terminal_file_->data();
+  terminal_data_size_ = terminal_file_->size();
 
-  auto it = mapped_data.find(terminal_representation_);
-  if (it == mapped_data.end()) {
+  return true;
+}
 
-  // Open the terminal file with open
-  int file_handle;
-  std::string terminal_filename = 
-    terminals_folder + terminal_representation_ + ".txt";
-  file_handle = open(terminal_filename.c_str(), O_RDONLY | O_NONBLOCK);
-  if (file_handle < 0) {
-    int saved_errno = errno;
-    perror("Error opening terminal file: ");
+
+// Same as loadNonterminal, but the terminal groups are created from their
+// records in a grammar snapshot (see grammar_snapshot.h), without scanning
+// the terminal data.  The nonterminal record starts with the representation,
+// which the caller has already read, followed by the size, inode, and
+// modification time of the terminals file, the number of terminal groups and
+// of seen groups, and the groups.
+//
+// The groups are created by initializeTerminalGroupsFromSnapshot when they
+// are first needed, so here their records are only skipped.
+//
+// Returns true on success
+bool Nonterminal::loadSnapshot(
+    const std::string& representation,
+    const std::shared_ptr<const TerminalFile>& terminal_file,
+    const std::shared_ptr<SeenTerminalIndex>& seen_index,
+    GrammarSnapshotReader *reader) {
+  representation_ = representation;
+  terminal_representation_ = getTerminalRepresentation(representation);
+
+  terminal_file_ = terminal_file;
+  seen_index_ = seen_index;
+  terminal_data_ = terminal_file_->data();
+  terminal_data_size_ = terminal_file_->size();
+
+  uint64_t terminal_data_size, inode, mtime_sec, mtime_nsec;
+  if (!reader->readUint64(&terminal_data_size) ||
+      !reader->readUint64(&inode) ||
+      !reader->readUint64(&mtime_sec) ||
+      !reader->readUint64(&mtime_nsec)) {
     fprintf(stderr,
-      "Terminal filename: %s\nCalled for nonterminal represented by %s\n",
-      terminal_filename.c_str(), representation.c_str());
-    // Check if there error is too many open files in the process and output a
-    // special error message
-    if (saved_errno == EMFILE) {
-      fprintf(stderr,
-        "Error: Increase the open file limit of the OS. See INSTALL.md\n");
-    }
+      "Grammar snapshot is corrupt at nonterminal represented by %s!\n",
+      representation_.c_str());
     return false;
   }
-
-  // Get file length
-  struct stat file_statistics;
-  if (fstat(file_handle, &file_statistics) < 0) {
-    perror("Error getting file size: ");
+  if (terminal_data_size != terminal_data_size_ ||
+      inode != terminal_file_->inode() ||
+      static_cast<int64_t>(mtime_sec) != terminal_file_->mtimeSeconds() ||
+      static_cast<int64_t>(mtime_nsec) != terminal_file_->mtimeNanoseconds()) {
     fprintf(stderr,
-      "Terminal filename: %s\nCalled for nonterminal represented by %s\n",
-      terminal_filename.c_str(), representation.c_str());
+      "Terminals file for nonterminal represented by %s has changed since "
+      "the grammar snapshot was written!\n", representation_.c_str());
     return false;
   }
-  // Make sure we can cast these types and set terminal_data_size
-  if (sizeof(off_t) == sizeof(size_t)) {
-    terminal_data_size_ = static_cast<size_t>(file_statistics.st_size);
-  } else {
+
+  snapshot_ = reader;
+  snapshot_groups_ = reader->position();
+  uint64_t terminal_groups_size, seen_groups_size;
+  if (!reader->readUint64(&terminal_groups_size) ||
+      !reader->readUint64(&seen_groups_size) ||
+      seen_groups_size > terminal_groups_size) {
     fprintf(stderr,
-      "Unable to cast off_t as size_t in LoadNonterminal!"
-      " off_t has size %zu and size_t has size %zu!\n",
-      sizeof(off_t), sizeof(size_t));
+      "Grammar snapshot is corrupt at nonterminal represented by %s!\n",
+      representation_.c_str());
     return false;
   }
+  for (uint64_t i = 0; i < terminal_groups_size; ++i) {
+    bool skipped;
+    if (i < seen_groups_size)
+      skipped = SeenTerminalGroup::skipSnapshot(reader);
+    else
+      skipped = UnseenTerminalGroup::skipSnapshot(reader);
+    if (!skipped) {
+      fprintf(stderr,
+        "Grammar snapshot is corrupt at terminal group %lu of nonterminal "
+        "represented by %s!\n",
+        static_cast<unsigned long>(i), representation_.c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
 
-  // Memory map the terminal data file
-  terminal_data_ = 
-    static_cast<char *>(mmap(static_cast<caddr_t>(0), 
-                             terminal_data_size_, 
-                             PROT_READ, MAP_SHARED, file_handle, 0));
-  // waste not want not
-  close(file_handle);
-  if (static_cast<void *>(terminal_data_) == MAP_FAILED) {
-    perror("Error in memory mapping terminal data file: ");
+// Write the record read by loadSnapshot, including the representation
+void Nonterminal::writeSnapshot(GrammarSnapshotWriter *writer) const {
+  loadTerminalGroups();
+  writer->writeString(representation_);
+  writer->writeUint64(terminal_data_size_);
+  writer->writeUint64(terminal_file_->inode());
+  writer->writeUint64(terminal_file_->mtimeSeconds());
+  writer->writeUint64(terminal_file_->mtimeNanoseconds());
+  writer->writeUint64(terminal_groups_size_);
+  writer->writeUint64(seen_groups_size_);
+  for (uint64_t i = 0; i < terminal_groups_size_; ++i) {
+    if (i < seen_groups_size_)
+      static_cast<const SeenTerminalGroup *>(
+        terminal_groups_[i])->writeSnapshot(writer);
+    else
+      static_cast<const UnseenTerminalGroup *>(
+        terminal_groups_[i])->writeSnapshot(writer);
+  }
+}
+
+
+// Terminal groups are needed by every method below, which call this first.
+// Once the groups are loaded this is a single atomic read; before then,
+// threads that reach the same nonterminal wait for one of them to load it.
+void Nonterminal::loadTerminalGroups() const {
+  if (groups_loaded_.load(std::memory_order_acquire))
+    return;
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  if (groups_loaded_.load(std::memory_order_relaxed))
+    return;
+  if (!initializeTerminalGroups()) {
     fprintf(stderr,
-      "Terminal filename: %s\nCalled for nonterminal represented by %s\n",
-      terminal_filename.c_str(), representation.c_str());
-    return false;
+      "Error loading terminal groups of nonterminal represented by %s!\n",
+      representation_.c_str());
+    exit(EXIT_FAILURE);
   }
+  groups_loaded_.store(true, std::memory_order_release);
+}
 
-  struct stringsize value = {terminal_data_, terminal_data_size_};
-  mapped_data.insert({terminal_representation_, value});
 
-  it = mapped_data.find(terminal_representation_);
-  } else {
-    auto& value = it->second;
-    terminal_data_ = value.string;
-    terminal_data_size_ = value.size;
+// The seen terminal index is only needed by lookup, so it is built separately
+// from the groups
+void Nonterminal::loadSeenIndex() const {
+  if (!seen_index_->build(*terminal_file_)) {
+    fprintf(stderr, "Error indexing seen terminals of nonterminal %s!\n",
+                    representation_.c_str());
+    exit(EXIT_FAILURE);
   }
+}
 
-  // With terminal data initialized, can now initialize terminal groups
-  if (!initializeTerminalGroups())
+
+// This function is called from initializeTerminalGroups only.
+//
+// Create the terminal groups from the records that loadSnapshot skipped.
+// Their sizes were checked then, so a failure here means that a record does
+// not match the terminals file.
+//
+// Returns true on success
+bool Nonterminal::initializeTerminalGroupsFromSnapshot() const {
+  GrammarSnapshotReader reader;
+  reader.readFrom(*snapshot_, snapshot_groups_);
+  uint64_t terminal_groups_size, seen_groups_size;
+  if (!reader.readUint64(&terminal_groups_size) ||
+      !reader.readUint64(&seen_groups_size))
     return false;
 
+  terminal_groups_ = new TerminalGroup*[terminal_groups_size];
+  for (uint64_t i = 0; i < terminal_groups_size; ++i) {
+    TerminalGroup *group;
+    if (i < seen_groups_size)
+      group = SeenTerminalGroup::readSnapshot(&reader, terminal_file_.get(),
+                                              representation_);
+    else
+      group = UnseenTerminalGroup::readSnapshot(&reader, terminal_data_,
+                                                terminal_data_size_,
+                                                representation_);
+    if (group == NULL) {
+      fprintf(stderr,
+        "Grammar snapshot is corrupt at terminal group %lu of nonterminal "
+        "represented by %s!\n",
+        static_cast<unsigned long>(i), representation_.c_str());
+      return false;
+    }
+    // Keep the sizes in step with the array so the destructor only deletes
+    // groups that were created
+    terminal_groups_[i] = group;
+    terminal_groups_size_ = i + 1;
+  }
+  seen_groups_size_ = seen_groups_size;
+
   return true;
 }
 
 
-// This function is called from loadNonterminal only.
+// This function is called from loadTerminalGroups only.
 //
-// Parse the terminal data file and extract terminal groups, mostly using very
-// low-level GNU C routines.
+// Extract terminal groups from the line table of the terminal data file.  A
+// group is a run of lines with the same probability, and the seen section
+// ends at the first blank line.  Nonterminals loaded from a grammar snapshot
+// create their groups from its records instead.
 //
 // Returns true on success
-bool Nonterminal::initializeTerminalGroups() {
+bool Nonterminal::initializeTerminalGroups() const {
+  if (snapshot_ != NULL)
+    return initializeTerminalGroupsFromSnapshot();
 
-  // Get the number of terminal groups in the terminal_data
-  // Set terminal_groups_size_ via a pass by reference
-  if (!grammartools::CountTerminalGroupsInText(terminal_data_, 
-                                               terminal_data_size_,
-                                               terminal_groups_size_)) {
+  if (!terminal_file_->parseLines()) {
     fprintf(stderr,
-      "Counting terminal groups failed for nonterminal represented by %s\n!",
+      "Parsing terminal data failed for nonterminal represented by %s\n!",
       representation_.c_str());
     return false;
   }
 
+  // Count the groups first so the array can be allocated
+  const uint64_t lines_size = terminal_file_->linesSize();
+  terminal_groups_size_ = 0;
+  for (uint64_t i = 0; i < lines_size; ++i) {
+    if (isEndOfTerminalGroup(i))
+      ++terminal_groups_size_;
+  }
+
   terminal_groups_ = new TerminalGroup*[terminal_groups_size_];
 
-  // Iterate over the data and initialize the groups
-  // Keep track of group start pointers, group size, and group number
-  char *data_position = terminal_data_;
-  size_t bytes_remaining = terminal_data_size_;
-  bool in_seen_groups = true;
-  char *group_start = terminal_data_;
   uint64_t current_group_number = 0;
-  mpz_t current_group_size;
-  mpz_init(current_group_size);
-
-  std::shared_ptr<BigCount> groupSize = std::make_shared<BigCount>(1);
-
-  while (bytes_remaining > 0) {
-    // Read the current line
-    unsigned int bytes_read;
-    grammartools::ReadLineFromCharArray2(data_position,
-                                        bytes_read);
-    // If current line is blank, expect unseen terminals next and move forward
-    if (bytes_read == 1) {  // Blank line = just the newline character was read
-      in_seen_groups = false;
-
-      // Skip to next line
-      data_position += bytes_read;
-      bytes_remaining -= bytes_read;
+  uint64_t group_start = 0;
+  for (uint64_t i = 0; i < lines_size; ++i) {
+    if (!isEndOfTerminalGroup(i))
       continue;
-    }
-
-    // Parse the line
-    const char *terminal, *source_ids;
-    double probability;
-    if (!grammartools::ParseNonterminalLine(data_position, bytes_read, &terminal,
-                                            probability, &source_ids)) {
-      fprintf(stderr,
-        "Line could not be parsed with read starting at byte %ld!\n",
-        data_position - terminal_data_);
-      return false;          
-    }
-
-    // Determine if this is the last line of a group
-    bool is_end_of_group;
-    if (!grammartools::IsEndOfTerminalGroup(data_position, bytes_remaining,
-                                            is_end_of_group)) {
-      fprintf(stderr,
-        "Parsing terminal data failed at byte %ld "
-        "for nonterminal represented by %s\n!",
-        data_position - terminal_data_,
-        representation_.c_str());
-      return false;      
-    }
-
-    // If at the end of a group, initalize a new Terminal Group, else
-    // increment the current group size.
-    if (is_end_of_group) {
-      if (in_seen_groups) {
-        BigCount::get(current_group_size, *groupSize.get());
-        terminal_groups_[current_group_number] = 
-          new SeenTerminalGroup(terminal_data_, probability, 
-                                current_group_size, representation_,
-                                group_start,
-                                data_position - group_start + bytes_read);
-      } else {
-        // For unseen groups, the source_ids field will contain a generator mask
-        terminal_groups_[current_group_number] =
-          new UnseenTerminalGroup(terminal_data_, probability,
-                                  source_ids, representation_,
-                                  terminal_data_size_);
-      }
-      // Set group_start to the start of the next line
-      group_start = data_position + bytes_read;
-      ++current_group_number;
-      groupSize = std::make_shared<BigCount>(1);
+    const grammartools::TerminalLine& line = terminal_file_->line(i);
+    if (i < terminal_file_->seenLinesSize()) {
+      ++seen_groups_size_;
+      terminal_groups_[current_group_number] =
+        new SeenTerminalGroup(terminal_file_.get(), line.probability,
+                              i + 1 - group_start, representation_,
+                              group_start,
+                              terminal_file_->line(group_start).terminal);
     } else {
-      BigCount::add(*groupSize.get(), *groupSize.get(), 1);
+      // For unseen groups, the source_ids field will contain a generator mask
+      terminal_groups_[current_group_number] =
+        new UnseenTerminalGroup(terminal_data_, line.probability,
+                                std::string(line.source_ids,
+                                            line.source_ids_length),
+                                representation_, terminal_data_size_);
     }
+    group_start = i + 1;
+    ++current_group_number;
+  }
 
-    // Move counters forward
-    data_position += bytes_read;
-    bytes_remaining -= bytes_read;
-  }  // end while (bytes_remaining > 0)
-
-  mpz_clear(current_group_size);
   return true;
 }
 
 
+// A group ends at the end of its section of the line table or where the
+// probability of the next line differs
+bool Nonterminal::isEndOfTerminalGroup(const uint64_t line) const {
+  return line + 1 == terminal_file_->linesSize() ||
+         line + 1 == terminal_file_->seenLinesSize() ||
+         terminal_file_->line(line).probability !=
+           terminal_file_->line(line + 1).probability;
+}
+
+
 // Iterate over terminal groups and return the total number of strings
-void Nonterminal::countStrings(mpz_t result) const {
-  mpz_init_set_ui(result, 0);
+void Nonterminal::countStrings(BigCount& result) const {
+  loadTerminalGroups();
+  result = 0;
 
+  BigCount string_count;
   for (uint64_t i = 0; i < terminal_groups_size_; ++i) {
-    mpz_t string_count;
     terminal_groups_[i]->countStrings(string_count);
-    mpz_add(result, result, string_count);
-    mpz_clear(string_count);
+    BigCount::add(result, result, string_count);
   }
 }
 
@@ -279,71 +336,80 @@ void Nonterminal::countStrings(mpz_t result) const {
 // symbols, so we iterate over the terminal groups to make sure the given
 // string can be produced.
 //
-TerminalLookupData* Nonterminal::lookup(const std::string& inputstring) const {
-  TerminalLookupData *lookup_data = new TerminalLookupData;
-  mpz_init(lookup_data->index);
-
-  // First, check for a representation match
-  std::string inputstring_representation;
-  inputstring_representation.reserve(inputstring.size());
-  for (unsigned int i = 0; i < inputstring.size(); ++i) {
-    // Convert the inputstring to a USLD representation
-    if( inputstring[i] >= 'a' && inputstring[i] <= 'z' )
-      inputstring_representation.push_back('L');
-    else if( inputstring[i] >= 'A' && inputstring[i] <= 'Z' )
-      inputstring_representation.push_back('U');
-    else if( inputstring[i] >= '0' && inputstring[i] <= '9' )
-      inputstring_representation.push_back('D');
-    else if( inputstring[i] == 1 )
-      // If the \x01 character is found, give up
-      return NULL;
+void Nonterminal::lookup(const char *terminal, const size_t length,
+                         TerminalLookupData *lookup_data) const {
+  // First, check for a representation match, converting the terminal to a
+  // USLD representation one character at a time.  The \x01 break character
+  // never matches.
+  bool representation_matches = (length == representation_.size());
+  for (size_t i = 0; i < length && representation_matches; ++i) {
+    char character_class;
+    if( terminal[i] >= 'a' && terminal[i] <= 'z' )
+      character_class = 'L';
+    else if( terminal[i] >= 'A' && terminal[i] <= 'Z' )
+      character_class = 'U';
+    else if( terminal[i] >= '0' && terminal[i] <= '9' )
+      character_class = 'D';
+    else if( terminal[i] == 1 )
+      character_class = '\0';
     else
-      inputstring_representation.push_back('S');
+      character_class = 'S';
+    representation_matches = (character_class == representation_[i]);
   }
 
-  if (inputstring_representation != representation_ ) {
+  if (!representation_matches) {
     lookup_data->parse_status = kTerminalNotFound;
     lookup_data->probability = -1;    
-    mpz_set_si(lookup_data->index, -1);
-    return lookup_data;
+    return;
   }
 
+  loadTerminalGroups();
+  loadSeenIndex();
+
   // If representation matches, check over the terminal groups, but downcase
   // the string first.  The terminal groups' data is downcased (they can
   // match an out_representation, but terminal matching is to downcased
-  // resources.)
-  std::string downcased_string;
-  downcased_string.resize(inputstring.size());
-  std::transform(inputstring.begin(), inputstring.end(), 
-                 downcased_string.begin(), ::tolower);
-  for (uint64_t i = 0; i < terminal_groups_size_; ++i) {
-    // If index is not -1, then this terminal group can produce the input string
-    LookupData *terminal_lookup = terminal_groups_[i]->lookup(downcased_string.c_str());
-
-    if (terminal_lookup->parse_status & kCanParse) {
-      // Copy terminal_lookup into lookup_data
-      lookup_data->parse_status = kCanParse;
-      lookup_data->probability = terminal_lookup->probability;
-      mpz_set(lookup_data->index, terminal_lookup->index);
-      lookup_data->source_ids.insert(terminal_lookup->source_ids.begin(),
-                                     terminal_lookup->source_ids.end());
-      lookup_data->terminal_group_index = i;
-
-      // Free memory
-      mpz_clear(terminal_lookup->index);
-      delete terminal_lookup;
-
-      return lookup_data;
+  // resources.)  Terminals are short, so this is done on the stack.
+  char stack_buffer[kDowncaseBufferSize];
+  std::string heap_buffer;
+  char *downcased_string = stack_buffer;
+  if (length >= kDowncaseBufferSize) {
+    heap_buffer.resize(length + 1);
+    downcased_string = &heap_buffer[0];
+  }
+  std::transform(terminal, terminal + length, downcased_string, ::tolower);
+  downcased_string[length] = '\0';
+
+  // Seen terminals are found through the index.  A terminal in a seen group
+  // would be found there before any unseen group is checked, and unseen
+  // groups never match seen terminals, so only unseen groups need to be
+  // tried on a miss.
+  const SeenTerminalIndex::Location *location =
+    seen_index_->find(downcased_string, length);
+  if (location != NULL) {
+    if (location->group_index >= seen_groups_size_) {
+      fprintf(stderr,
+        "Seen terminal index does not match terminal groups for nonterminal "
+        "represented by %s!\n", representation_.c_str());
+      exit(EXIT_FAILURE);
     }
+    const SeenTerminalGroup *group = static_cast<const SeenTerminalGroup *>(
+      terminal_groups_[location->group_index]);
+    group->lookupLine(location->line, lookup_data);
+    lookup_data->terminal_group_index = location->group_index;
+    return;
+  }
 
-    mpz_clear(terminal_lookup->index);
-    delete terminal_lookup;
+  for (uint64_t i = seen_groups_size_; i < terminal_groups_size_; ++i) {
+    terminal_groups_[i]->lookup(downcased_string, lookup_data);
+    if (lookup_data->parse_status & kCanParse) {
+      lookup_data->terminal_group_index = i;
+      return;
+    }
   }
   // Otherwise, we never found a terminal group that can produce this string
   lookup_data->parse_status = kTerminalNotFound | kTerminalCantBeGenerated;
   lookup_data->probability = -1;
-  mpz_set_si(lookup_data->index, -1);
-  return lookup_data;
 }
 
 
@@ -351,27 +417,24 @@ TerminalLookupData* Nonterminal::lookup(const std::string& inputstring) const {
 // calls the lookup function to do the heavy lifting and returns true if the
 // kCanParse status is returned.
 bool Nonterminal::canProduceTerminal(const std::string& inputstring) const {
-  TerminalLookupData *lookup_data = lookup(inputstring);
-  if (lookup_data->parse_status == kCanParse) {
-    mpz_clear(lookup_data->index);
-    delete lookup_data;
-    return true;
-  }
-  // else
-  return false;
+  TerminalLookupData lookup_data;
+  lookup(inputstring.data(), inputstring.size(), &lookup_data);
+  return (lookup_data.parse_status == kCanParse);
 }
 
 
 // Simple getter functions related to terminal groups
 //
 uint64_t Nonterminal::countTerminalGroups() const {
+  loadTerminalGroups();
   return terminal_groups_size_;
 }
 //
-// When returning values based on a terminal group index, die if the index
-// is outside of the range of available terminal groups
+// When returning values based on a terminal group index, load the groups and
+// die if the index is outside of the range of available terminal groups
 //
 const std::string& Nonterminal::getFirstStringOfGroup(uint64_t group_index) const {
+  loadTerminalGroups();
   if (group_index >= terminal_groups_size_) {
     fprintf(stderr,
       "TerminalGroup index is outside of available range in "
@@ -385,6 +448,7 @@ const std::string& Nonterminal::getFirstStringOfGroup(uint64_t group_index) cons
 }
 //
 double Nonterminal::getProbabilityOfGroup(uint64_t group_index) const {
+  loadTerminalGroups();
   if (group_index >= terminal_groups_size_) {
     fprintf(stderr,
       "TerminalGroup index is outside of available range in "
@@ -397,7 +461,9 @@ double Nonterminal::getProbabilityOfGroup(uint64_t group_index) const {
   return terminal_groups_[group_index]->getProbability();  
 }
 //
-void Nonterminal::countStringsOfGroup(mpz_t result, uint64_t group_index) const {
+void Nonterminal::countStringsOfGroup(BigCount& result,
+                                      uint64_t group_index) const {
+  loadTerminalGroups();
   if (group_index >= terminal_groups_size_) {
     fprintf(stderr,
       "TerminalGroup index is outside of available range in "
@@ -407,13 +473,13 @@ void Nonterminal::countStringsOfGroup(mpz_t result, uint64_t group_index) const
     exit(EXIT_FAILURE);
   }
 
-  // countString will initalize result and set its value
   terminal_groups_[group_index]->countStrings(result);
 }
 //
 TerminalGroup::TerminalGroupStringIterator* 
   Nonterminal::getStringIteratorForGroup(
     uint64_t group_index) const {
+  loadTerminalGroups();
   if (group_index >= terminal_groups_size_) {
     fprintf(stderr,
       "TerminalGroup index is outside of available range in "
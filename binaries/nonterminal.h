@@ -21,13 +21,12 @@
 //
 // Because the number of terminals can be arbitrarily large, terminals
 // are kept on disk and accessed via a memory-mapped file.  All terminals
-// for a given nonterminal are stored in the same file, and this class
-// will handle the memory map creation/destruction and pass it to
-// TerminalGroup objects.
+// for a given nonterminal are stored in the same file, which is mapped by a
+// TerminalFile object and passed to TerminalGroup objects.
 //
-// The name of this file is the string representation of the nonterminal
-// and it will be located in the terminals_folder, given in the
-// LoadNonterminal initialization routine. The file must be sorted by
+// The name of this file is the terminal representation of the nonterminal
+// (see getTerminalRepresentation) and it will be located in the
+// terminals_folder of the NonterminalCollection. The file must be sorted by
 // descending probability, and terminal groups are identified by
 // contiguous terminals that share a probability. A blank line will separate
 // seen terminal groups from unseen groups in the file, with all seen
@@ -38,11 +37,17 @@
 #ifndef NONTERMINAL_H__
 #define NONTERMINAL_H__
 
-#include <gmp.h>
+#include <atomic>
 #include <string>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 
+#include "big_count.h"
 #include "gcfmacros.h"
+#include "grammar_snapshot.h"
+#include "seen_terminal_index.h"
+#include "terminal_file.h"
 #include "terminal_group.h"
 #include "lookup_data.h"
 
@@ -52,30 +57,58 @@ public:
   Nonterminal():
     terminal_groups_(NULL),
     terminal_groups_size_(0),
+    seen_groups_size_(0),
+    groups_loaded_(false),
+    snapshot_(NULL),
+    snapshot_groups_(NULL),
     terminal_data_(NULL),
+    terminal_data_size_(0),
     representation_(""),
     terminal_representation_("") {}
   ~Nonterminal();
 
-  // Initializer routine - memory maps the terminal data file and processes
-  // the terminal groups.
-  bool loadNonterminal(const std::string& representation,
-                       const std::string& terminals_folder);
-
-  // By convention, mpz_t types are not returned, but are passed by reference
-  // See http://stackoverflow.com/a/13396028
-  void countStrings(mpz_t result) const;
+  // Initializer routine - registers the given memory-mapped terminal data
+  // file.  The file and its index of seen terminals are shared with other
+  // nonterminals that have the same terminal representation.
+  //
+  // The terminal groups are not processed until a method below first needs
+  // them, so nonterminals that a run never reaches cost only their mapping.
+  // Loading is thread-safe, and a terminals file that cannot be parsed is
+  // reported, and the program dies, when the groups are loaded.
+  bool loadNonterminal(
+      const std::string& representation,
+      const std::shared_ptr<const TerminalFile>& terminal_file,
+      const std::shared_ptr<SeenTerminalIndex>& seen_index);
+
+  // Alternative initializer that reads the terminal groups from a grammar
+  // snapshot, and the matching writer (see grammar_snapshot.h).  As with
+  // loadNonterminal, the groups are created when they are first needed, so
+  // the reader must outlive the nonterminal.
+  bool loadSnapshot(
+      const std::string& representation,
+      const std::shared_ptr<const TerminalFile>& terminal_file,
+      const std::shared_ptr<SeenTerminalIndex>& seen_index,
+      GrammarSnapshotReader *reader);
+  void writeSnapshot(GrammarSnapshotWriter *writer) const;
+
+  // Name of the terminals file (without ".txt") for a representation
+  static std::string getTerminalRepresentation(
+      const std::string& representation);
+
+  void countStrings(BigCount& result) const;
   uint64_t countTerminalGroups() const;
 
-  // See if the given terminal can be produced by this nonterminal and return
-  // a LookupData struct with relevant fields set
-  TerminalLookupData* lookup(const std::string& inputstring) const;
+  // See if the given terminal can be produced by this nonterminal and fill in
+  // lookup_data with the relevant fields.  The terminal has the given length
+  // and need not be null-terminated.
+  void lookup(const char *terminal, const size_t length,
+              TerminalLookupData *lookup_data) const;
   bool canProduceTerminal(const std::string& inputstring) const;
 
   // Routines for getting values from the terminal groups
   const std::string& getFirstStringOfGroup(uint64_t group_index) const;
   double getProbabilityOfGroup(uint64_t group_index) const;
-  void countStringsOfGroup(mpz_t result, uint64_t group_index) const;
+  void countStringsOfGroup(BigCount& result, uint64_t group_index) const;
   TerminalGroup::TerminalGroupStringIterator* getStringIteratorForGroup(
       uint64_t group_index) const;
 
@@ -83,15 +116,42 @@ public:
   const std::string& getRepresentation() const;
 
 private:
-  // Part of the delayed initialization process -- called from LoadNonterminal
-  bool initializeTerminalGroups();
+  // Terminals shorter than this are downcased on the stack during lookup
+  static const size_t kDowncaseBufferSize = 64;
+
+  // Process the terminal groups, and build the seen terminal index, on first
+  // use.  Both die on failure.
+  void loadTerminalGroups() const;
+  void loadSeenIndex() const;
+  // Part of the delayed initialization process -- called from
+  // loadTerminalGroups
+  bool initializeTerminalGroups() const;
+  bool initializeTerminalGroupsFromSnapshot() const;
+  // Return true if the given line of the line table is the last line of a
+  // terminal group
+  bool isEndOfTerminalGroup(const uint64_t line) const;
 
   // Nonterminals are implemented as a collection of terminal group object
-  // pointers along with terminal data stored in a memory-mapped file
-  TerminalGroup* *terminal_groups_;
-  uint64_t terminal_groups_size_;
+  // pointers along with terminal data stored in a memory-mapped file.  The
+  // groups are filled in by loadTerminalGroups, hence mutable.
+  mutable TerminalGroup* *terminal_groups_;
+  mutable uint64_t terminal_groups_size_;
+  // Seen groups come first in terminal_groups_, followed by unseen groups
+  mutable uint64_t seen_groups_size_;
+  // Set, under load_mutex_, once the groups above are complete
+  mutable std::atomic<bool> groups_loaded_;
+  mutable std::mutex load_mutex_;
+  // For nonterminals loaded from a grammar snapshot, the records of the
+  // terminal groups, read by initializeTerminalGroupsFromSnapshot
+  const GrammarSnapshotReader *snapshot_;
+  const char *snapshot_groups_;
+  // Locates seen terminals without scanning the seen groups.  Built on first
+  // lookup by whichever nonterminal sharing it gets there first.
+  std::shared_ptr<SeenTerminalIndex> seen_index_;
   // The memory mapping is found at terminal_data_ and we also store the size
-  char* terminal_data_;
+  // terminal_file_ keeps the mapping alive
+  std::shared_ptr<const TerminalFile> terminal_file_;
+  const char* terminal_data_;
   size_t terminal_data_size_;
 
   std::string representation_;
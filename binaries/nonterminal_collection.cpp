@@ -16,9 +16,13 @@
 
 #include "nonterminal_collection.h"
 
-// Declare static class member
+// Declare static class members
 std::unordered_map<std::string, Nonterminal *> 
   NonterminalCollection::nonterminal_collection_;
+std::unordered_map<std::string, std::shared_ptr<const TerminalFile> >
+  NonterminalCollection::terminal_files_;
+std::unordered_map<std::string, std::shared_ptr<SeenTerminalIndex> >
+  NonterminalCollection::seen_terminal_indices_;
 
 // Destroy all Nonterminal objects in the collection
 NonterminalCollection::~NonterminalCollection() {
@@ -27,6 +31,40 @@ NonterminalCollection::~NonterminalCollection() {
             ++it) {
     delete it->second;
   }
+  nonterminal_collection_.clear();
+  // Unmaps any terminal files not still held by a Nonterminal
+  seen_terminal_indices_.clear();
+  terminal_files_.clear();
+}
+
+
+// Return the mapped terminals file for the given nonterminal representation
+// and the index of its seen terminals, mapping the file if no other
+// nonterminal has yet.  The index is empty until a nonterminal first looks
+// up a terminal (see Nonterminal::loadSeenIndex).  Return false on failure.
+bool NonterminalCollection::getTerminalFile(
+    const std::string& representation,
+    std::shared_ptr<const TerminalFile> *terminal_file,
+    std::shared_ptr<SeenTerminalIndex> *seen_index) {
+  std::string terminal_representation =
+    Nonterminal::getTerminalRepresentation(representation);
+  auto file_it = terminal_files_.find(terminal_representation);
+  if (file_it == terminal_files_.end()) {
+    std::shared_ptr<TerminalFile> new_terminal_file =
+      std::make_shared<TerminalFile>();
+    if (!new_terminal_file->load(
+          terminals_folder_ + terminal_representation + ".txt",
+          representation)) {
+      return false;
+    }
+    file_it = terminal_files_.insert(
+      std::make_pair(terminal_representation, new_terminal_file)).first;
+    seen_terminal_indices_[terminal_representation] =
+      std::make_shared<SeenTerminalIndex>();
+  }
+  *terminal_file = file_it->second;
+  *seen_index = seen_terminal_indices_.at(terminal_representation);
+  return true;
 }
 
 
@@ -40,8 +78,15 @@ Nonterminal* NonterminalCollection::getOrCreateNonterminal(
     // fprintf(stderr,
     //   "Loading nonterminal represented by %s...",
     //   representation.c_str());
+    std::shared_ptr<const TerminalFile> terminal_file;
+    std::shared_ptr<SeenTerminalIndex> seen_index;
+    if (!getTerminalFile(representation, &terminal_file, &seen_index))
+      return NULL;
+
     Nonterminal *newnonterminal = new Nonterminal();
-    if (!newnonterminal->loadNonterminal(representation, terminals_folder_)) {
+    if (!newnonterminal->loadNonterminal(representation, terminal_file,
+                                         seen_index)) {
+      delete newnonterminal;
       return NULL;
     } else {
       nonterminal_collection_.insert(
@@ -53,3 +98,54 @@ Nonterminal* NonterminalCollection::getOrCreateNonterminal(
 
   return nonterminal_collection_.at(representation);
 }
+
+
+// Write the number of nonterminals followed by their records
+void NonterminalCollection::writeSnapshot(
+    GrammarSnapshotWriter *writer) const {
+  writer->writeUint64(nonterminal_collection_.size());
+  for (auto it = nonterminal_collection_.begin();
+            it != nonterminal_collection_.end();
+            ++it) {
+    it->second->writeSnapshot(writer);
+  }
+}
+
+
+// Create the nonterminals recorded in a snapshot, so that later calls to
+// getOrCreateNonterminal find them.  Return false on failure.
+bool NonterminalCollection::loadSnapshot(GrammarSnapshotReader *reader) {
+  uint64_t nonterminal_count;
+  if (!reader->readUint64(&nonterminal_count)) {
+    fprintf(stderr, "Grammar snapshot is missing its nonterminals!\n");
+    return false;
+  }
+  for (uint64_t i = 0; i < nonterminal_count; ++i) {
+    std::string representation;
+    if (!reader->readString(&representation)) {
+      fprintf(stderr, "Grammar snapshot is corrupt at nonterminal %lu!\n",
+                      static_cast<unsigned long>(i));
+      return false;
+    }
+    if (nonterminal_collection_.count(representation) > 0) {
+      fprintf(stderr, "Grammar snapshot lists nonterminal %s twice!\n",
+                      representation.c_str());
+      return false;
+    }
+
+    std::shared_ptr<const TerminalFile> terminal_file;
+    std::shared_ptr<SeenTerminalIndex> seen_index;
+    if (!getTerminalFile(representation, &terminal_file, &seen_index))
+      return false;
+
+    Nonterminal *newnonterminal = new Nonterminal();
+    if (!newnonterminal->loadSnapshot(representation, terminal_file,
+                                      seen_index, reader)) {
+      delete newnonterminal;
+      return false;
+    }
+    nonterminal_collection_.insert(
+      std::make_pair(representation, newnonterminal));
+  }
+  return true;
+}
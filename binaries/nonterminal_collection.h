@@ -26,10 +26,12 @@
 #ifndef NONTERMINAL_COLLECTION_H__
 #define NONTERMINAL_COLLECTION_H__
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
 #include "gcfmacros.h"
+#include "grammar_snapshot.h"
 #include "nonterminal.h"
 
 class NonterminalCollection {
@@ -41,8 +43,26 @@ class NonterminalCollection {
 
   Nonterminal* getOrCreateNonterminal(const std::string& representation);
 
+  // Write every nonterminal in the collection to a grammar snapshot, or
+  // create them from one (see grammar_snapshot.h)
+  void writeSnapshot(GrammarSnapshotWriter *writer) const;
+  bool loadSnapshot(GrammarSnapshotReader *reader);
+
  private:
+  bool getTerminalFile(
+      const std::string& representation,
+      std::shared_ptr<const TerminalFile> *terminal_file,
+      std::shared_ptr<SeenTerminalIndex> *seen_index);
+
   static std::unordered_map<std::string, Nonterminal *> nonterminal_collection_;
+  // Memory-mapped terminal files, indexed by terminal representation, so that
+  // nonterminals differing only in case share a mapping
+  static std::unordered_map<std::string, std::shared_ptr<const TerminalFile> >
+    terminal_files_;
+  // Seen terminal indices of the files above, under the same keys
+  static std::unordered_map<std::string,
+                            std::shared_ptr<SeenTerminalIndex> >
+    seen_terminal_indices_;
   const std::string terminals_folder_;
 
   // Disable copy and assignment
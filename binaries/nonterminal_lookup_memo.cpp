@@ -0,0 +1,61 @@
+// nonterminal_lookup_memo.cpp - a memo of nonterminal lookups shared by the
+//   structures that look up one input string
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <cstdint>
+
+#include "nonterminal_lookup_memo.h"
+
+
+NonterminalLookupMemo::NonterminalLookupMemo() : entries_size_(0) {
+  for (unsigned int i = 0; i < kSlots; ++i)
+    slots_[i].nonterminal = NULL;
+}
+
+
+// Offsets and lengths are far below 2^16, so they are packed next to the
+// pointer bits before hashing.  The high bits of the product are the best
+// mixed.
+unsigned int NonterminalLookupMemo::hashSlot(const Nonterminal* nonterminal,
+                                             const size_t offset,
+                                             const size_t length) {
+  uint64_t packed = reinterpret_cast<uintptr_t>(nonterminal) ^
+                    (static_cast<uint64_t>(offset) << 48) ^
+                    (static_cast<uint64_t>(length) << 32);
+  return static_cast<unsigned int>(
+    (packed * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & (kSlots - 1);
+}
+
+
+const TerminalLookupData& NonterminalLookupMemo::lookup(
+    const Nonterminal* nonterminal,
+    const char *inputstring,
+    const size_t offset,
+    const size_t length) {
+  unsigned int slot = hashSlot(nonterminal, offset, length);
+  while (slots_[slot].nonterminal != NULL) {
+    if (slots_[slot].nonterminal == nonterminal &&
+        slots_[slot].offset == offset && slots_[slot].length == length)
+      return entries_[slots_[slot].entry];
+    slot = (slot + 1) & (kSlots - 1);
+  }
+
+  if (entries_size_ == kMaxEntries) {
+    nonterminal->lookup(inputstring + offset, length, &overflow_entry_);
+    return overflow_entry_;
+  }
+  slots_[slot].nonterminal = nonterminal;
+  slots_[slot].offset = static_cast<uint32_t>(offset);
+  slots_[slot].length = static_cast<uint32_t>(length);
+  slots_[slot].entry = entries_size_;
+  TerminalLookupData& lookup_data = entries_[entries_size_++];
+  nonterminal->lookup(inputstring + offset, length, &lookup_data);
+  return lookup_data;
+}
@@ -0,0 +1,82 @@
+// nonterminal_lookup_memo.h - a memo of nonterminal lookups shared by the
+//   structures that look up one input string
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// PCFG::lookup and PCFG::lookupSum look up the input string in every
+// structure with its signature, and these structures often differ only in a
+// few nonterminals, e.g., L8 D2 S1 and L8 D2 S1 D1 both start by looking up
+// the same eight letters in L8 and the same two digits in D2.  Each
+// Nonterminal::lookup checks the representation, downcases the terminal, and
+// finds it among the terminal groups, so without a memo this work is
+// repeated for every structure.
+//
+// A NonterminalLookupMemo keeps the TerminalLookupData of every lookup made
+// during one query, keyed by nonterminal and by the offset and length of the
+// terminal in the input string (with break characters removed).  All lookups
+// through one memo must be of the same input string; the memo is meant to
+// live on the stack for the duration of a single PCFG lookup, and is not
+// thread-safe.
+//
+// The memo allocates nothing: entries live in a fixed array inside the memo,
+// found through a small open-addressing table with linear probing.  A lookup
+// touches a handful of nonterminals at a handful of offsets, so kMaxEntries
+// is rarely reached; once it is, further lookups are still answered, but are
+// not memoized.
+//
+
+#ifndef NONTERMINAL_LOOKUP_MEMO_H__
+#define NONTERMINAL_LOOKUP_MEMO_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "gcfmacros.h"
+#include "lookup_data.h"
+#include "nonterminal.h"
+
+class NonterminalLookupMemo {
+ public:
+  NonterminalLookupMemo();
+
+  // Return the lookup of the length characters of inputstring starting at
+  // offset in the given nonterminal, calling Nonterminal::lookup only the
+  // first time that terminal is looked up in that nonterminal.  The result
+  // stays valid until the next call.
+  const TerminalLookupData& lookup(const Nonterminal* nonterminal,
+                                   const char *inputstring,
+                                   const size_t offset,
+                                   const size_t length);
+
+ private:
+  // kSlots is a power of two, and kMaxEntries keeps the table at most 3/4
+  // full so probes stay short
+  static const unsigned int kSlots = 128;
+  static const unsigned int kMaxEntries = 96;
+
+  // An empty slot has a NULL nonterminal
+  struct Slot {
+    const Nonterminal* nonterminal;
+    uint32_t offset;
+    uint32_t length;
+    unsigned int entry;
+  };
+
+  static unsigned int hashSlot(const Nonterminal* nonterminal,
+                               const size_t offset, const size_t length);
+
+  Slot slots_[kSlots];
+  TerminalLookupData entries_[kMaxEntries];
+  unsigned int entries_size_;
+  // Holds lookups made once entries_ is full
+  TerminalLookupData overflow_entry_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(NonterminalLookupMemo);
+};
+
+
+#endif  // NONTERMINAL_LOOKUP_MEMO_H__
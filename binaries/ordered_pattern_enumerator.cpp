@@ -0,0 +1,100 @@
+// ordered_pattern_enumerator.cpp - enumerate the patterns of a single
+//   structure in order of decreasing probability
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+
+#include "ordered_pattern_enumerator.h"
+
+OrderedPatternEnumerator::~OrderedPatternEnumerator() {
+  if (pattern_manager_ != NULL)
+    delete pattern_manager_;
+}
+
+
+// Create the pattern manager and seed the frontier with the first (most
+// probable) pattern, if it is above the cutoff
+bool OrderedPatternEnumerator::Init(const PatternMetadata& metadata,
+                                    const double cutoff) {
+  pattern_manager_ = new PatternManager;
+  if (!pattern_manager_->Init(metadata)) {
+    return false;
+  }
+  structure_size_ = metadata.getStructureSize();
+  cutoff_ = cutoff;
+
+  FrontierEntry root;
+  root.pivot = 0;
+  root.digits.assign(structure_size_, 0);
+  setPatternCounter(root.digits);
+  root.probability = pattern_manager_->getPatternProbability();
+  if (root.probability >= cutoff_)
+    frontier_.push(root);
+
+  return true;
+}
+
+
+void OrderedPatternEnumerator::setPatternCounter(
+    const std::vector<uint64_t>& digits) {
+  for (unsigned int i = 0; i < structure_size_; ++i)
+    pattern_manager_->setPatternCounterPlace(i, digits[i]);
+}
+
+
+// Pop frontier entries, pushing the children of each, until we reach one that
+// is the first of its permutations
+bool OrderedPatternEnumerator::next() {
+  while (!frontier_.empty()) {
+    FrontierEntry entry = frontier_.top();
+    frontier_.pop();
+
+    // Push children -- the pattern counter is left pointing at entry.digits
+    // after each child is evaluated
+    setPatternCounter(entry.digits);
+    for (unsigned int i = entry.pivot; i < structure_size_; ++i) {
+      uint64_t digit = entry.digits[i];
+      if (!pattern_manager_->setPatternCounterPlace(i, digit + 1))
+        continue;  // This nonterminal has no more terminal groups
+      double child_probability = pattern_manager_->getPatternProbability();
+      pattern_manager_->setPatternCounterPlace(i, digit);
+      if (child_probability < cutoff_)
+        continue;
+
+      FrontierEntry child;
+      child.probability = child_probability;
+      child.pivot = i;
+      child.digits = entry.digits;
+      child.digits[i] = digit + 1;
+      frontier_.push(child);
+    }
+
+    if (pattern_manager_->isFirstPermutation()) {
+      current_probability_ = entry.probability;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Strings of the current pattern times its number of permutations, as in
+// Structure::generatePatterns
+void OrderedPatternEnumerator::countStrings(BigCount& result) const {
+  BigCount string_count;
+  pattern_manager_->countStrings(string_count);
+  BigCount permutation_count;
+  pattern_manager_->countPermutations(permutation_count);
+  BigCount::mul(result, string_count, permutation_count);
+}
+
+
+const std::string OrderedPatternEnumerator::getFirstStringOfPattern() const {
+  return pattern_manager_->getFirstStringOfPattern();
+}
@@ -0,0 +1,106 @@
+// ordered_pattern_enumerator.h - enumerate the patterns of a single structure
+//   in order of decreasing probability
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Structure::generatePatterns walks the pattern counter in mixed-radix order
+// and relies on intelligent skipping to avoid patterns below the cutoff.
+// That still visits many below-cutoff patterns in long structures, and the
+// output comes out in no useful order.
+//
+// This class instead keeps a "frontier" of candidate patterns in a priority
+// queue, as in the pushNewValues routine of Weir's original pcfg_manager.
+// Each candidate is a vector of digits (terminal group indices, one per
+// nonterminal) plus a "pivot" position.  The highest-probability candidate is
+// popped from the queue, and its children are pushed: for each position i at
+// or after the pivot, the candidate with digit i incremented and pivot i.
+// Every digit vector has exactly one parent under this scheme (decrement its
+// last nonzero digit), so each pattern is visited exactly once.  Terminal
+// groups are sorted by decreasing probability, so a child is never more
+// probable than its parent, and patterns are popped in non-increasing
+// probability order.  Patterns with equal probability come out in pattern
+// counter order.
+//
+// Children below the cutoff are never pushed, since none of their
+// descendants could be above it.  Patterns that are not the first of their
+// permutations are still expanded (their children may be first
+// permutations) but are not returned, so the output has the same pattern
+// compaction as Structure::generatePatterns.
+//
+// Note that the frontier lives in memory, so enumerating a large structure
+// with a very low cutoff (and no guess budget to stop early) can use a lot of
+// memory.
+//
+
+#ifndef ORDERED_PATTERN_ENUMERATOR_H__
+#define ORDERED_PATTERN_ENUMERATOR_H__
+
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "big_count.h"
+#include "gcfmacros.h"
+#include "nonterminal.h"
+#include "pattern_manager.h"
+
+class OrderedPatternEnumerator {
+ public:
+  // Initialization is deferred to an Init method, as with PatternManager
+  OrderedPatternEnumerator():
+    pattern_manager_(NULL),
+    structure_size_(0),
+    cutoff_(0.0),
+    current_probability_(0.0) {}
+  ~OrderedPatternEnumerator();
+
+  // Same argument as PatternManager::Init, plus the probability cutoff.
+  // Return false on failure.
+  bool Init(const PatternMetadata& metadata, const double cutoff);
+
+  // Move to the next pattern, i.e., the most probable pattern (counting all
+  // of its permutations) not yet returned.  Return false when there are no
+  // patterns left above the cutoff.
+  bool next();
+
+  // Properties of the current pattern -- only valid after next() returns true
+  double getPatternProbability() const { return current_probability_; }
+  // Number of strings produced by the pattern and all of its permutations
+  void countStrings(BigCount& result) const;
+  const std::string getFirstStringOfPattern() const;
+
+ private:
+  struct FrontierEntry {
+    double probability;
+    unsigned int pivot;
+    std::vector<uint64_t> digits;
+  };
+  // Priority queue ordering: most probable first, ties in counter order
+  struct FrontierEntryLess {
+    bool operator()(const FrontierEntry& a, const FrontierEntry& b) const {
+      if (a.probability != b.probability)
+        return a.probability < b.probability;
+      return a.digits > b.digits;
+    }
+  };
+
+  // Point the pattern manager's counter at the given digits
+  void setPatternCounter(const std::vector<uint64_t>& digits);
+
+  PatternManager* pattern_manager_;
+  unsigned int structure_size_;
+  double cutoff_;
+  double current_probability_;
+  std::priority_queue<FrontierEntry, std::vector<FrontierEntry>,
+                      FrontierEntryLess> frontier_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(OrderedPatternEnumerator);
+};
+
+
+#endif  // ORDERED_PATTERN_ENUMERATOR_H__
@@ -37,7 +37,7 @@ sub print_usage {
   there are also several optional arguments:
     -h   this help
     -s   generate strings from the grammar in probability order through parallel generation, sorting, and then removing the probability field
-    -A   generate strings from the grammar in probability order through generation, lookup against all structures to prevent duplicates, sorting, and then removing the probability field (this operation cannot be parallelized)
+    -A   generate strings from the grammar in probability order through generation, lookup against all structures to prevent duplicates, sorting, and then removing the probability field (structures are not split; a single process generates strings on the given number of threads)
     -b   perform deterministic randomization (useful for testing)
     -p   don't split input structures file (assumes file is already split)
       -D   don't delete split files at the end
@@ -105,10 +105,14 @@ foreach my $optbool (@optBooleans) {
 }
 
 # Force certain conditions if accuStrMode is set
-# We cannot parallelize because all structures must be available in order to sum across tokenizations
+# We cannot split the structures file because all structures must be available
+# in order to sum across tokenizations, so a single process generates strings
+# on all cores instead
+my $threadswitch = "";
 if ($options->{accuStrMode}) {
-  print STDERR "Accurate strings mode specified.  Disabling parallel generation.\n";
+  print STDERR "Accurate strings mode specified.  Using one process with $options->{cores} threads.\n";
   $options->{stringsMode} = 1;
+  $threadswitch = "-threads $options->{cores}";
   $options->{cores} = 1;
 }
 
@@ -249,7 +253,7 @@ my $start_gen = time();
 my $accuswitch = "";
 $accuswitch = "-accupr" if $options->{accuStrMode};
 my $mockcmd = "./$supportBinaries[0] " .
-  "-cutoff $options->{cutoff} $accuswitch " .
+  "-cutoff $options->{cutoff} $accuswitch $threadswitch " .
   "-sfile structurepieces/structure-split.?? " .
   "> structurepieces/rawtablepieces-split.??";
 print STDERR "Will execute: '$mockcmd' \n";
@@ -276,7 +280,7 @@ for my $i (0 .. (scalar(@splitfiles) - 1)) {
       my ($outname) = $infile =~ m/structure-(.*)/;
       if (-e "structurepieces/$infile" && -s "structurepieces/$infile") {
         my $cmd = "./$supportBinaries[0] " .
-          "-cutoff $options->{cutoff} $accuswitch " .
+          "-cutoff $options->{cutoff} $accuswitch $threadswitch " .
           "-sfile structurepieces/$infile " .
           "> structurepieces/rawtablepieces-$outname";
         print STDERR "In child #" . $i . " (pid: $$): ";
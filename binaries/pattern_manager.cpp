@@ -17,7 +17,6 @@
 #include <sstream>
 #include <cstring>
 #include <cstdlib>
-#include <queue>
 
 #include "pattern_manager.h"
 
@@ -30,20 +29,17 @@ const uint64_t PatternManager::kFactorialTable[21] = {
 };
 
 
-// Destructor
-PatternManager::~PatternManager() {
+// Destructors
+PatternMetadata::~PatternMetadata() {
   delete[] group_ids_;
-  if (pattern_counter_ != NULL) {
-    delete pattern_counter_;
-  }
-
+  delete[] radices_.load();
 }
 
 
 // Init routine
 // Parse the structures string representation to initialize the object
 // Return false on any failure
-bool PatternManager::Init(
+bool PatternMetadata::Init(
     const std::string& representation,
     const char structurebreakchar,
     const unsigned int structure_size,
@@ -54,16 +50,6 @@ bool PatternManager::Init(
   nonterminals_ = nonterminals;
   base_probability_ = base_probability;
 
-  // Initialize mixed-radix number
-  // To facilitate iterating over all combinations of terminal groups produced
-  // by this structure, we use a mixed-radix number.  It is initialized using
-  // the number of terminal groups produced by each nonterminal.
-  uint64_t *num_groups = new uint64_t[structure_size];
-  for (unsigned int i = 0; i < structure_size; ++i)
-    num_groups[i] = nonterminals[i]->countTerminalGroups();
-  pattern_counter_ = new MixedRadixNumber(num_groups, structure_size);
-  delete[] num_groups;
-
   // Initialize class variables related to group counts (counts of repeated
   // nonterminals in the structure)
   // This uses the string representation of the structure to identify repeats
@@ -82,8 +68,8 @@ bool PatternManager::Init(
 
 // Helper for Init routine
 // This function initializes the group_ids_, group_counts_, has_repeats_,
-// is_giant_, and structure_size_ class variables
-bool PatternManager::InitGroupIDsAndCounts(
+// and structure_size_ class variables
+bool PatternMetadata::InitGroupIDsAndCounts(
     const std::string& representation,
     const char structurebreakchar,
     const unsigned int structure_size) {
@@ -129,146 +115,169 @@ bool PatternManager::InitGroupIDsAndCounts(
 }
 
 
+// Store radices for the mixed-radix number
+// To facilitate iterating over all combinations of terminal groups produced
+// by this structure, we use a mixed-radix number.  It is initialized using
+// the number of terminal groups produced by each nonterminal.
+const uint64_t* PatternMetadata::getRadices() const {
+  uint64_t *radices = radices_.load(std::memory_order_acquire);
+  if (radices != NULL)
+    return radices;
+  std::lock_guard<std::mutex> lock(radices_mutex_);
+  radices = radices_.load(std::memory_order_relaxed);
+  if (radices == NULL && nonterminals_ != NULL) {
+    radices = new uint64_t[structure_size_];
+    for (unsigned int i = 0; i < structure_size_; ++i)
+      radices[i] = nonterminals_[i]->countTerminalGroups();
+    radices_.store(radices, std::memory_order_release);
+  }
+  return radices;
+}
+
+
+// Copy the structure metadata and set the pattern counter to the first
+// pattern
+bool PatternManager::Init(const PatternMetadata& metadata) {
+  nonterminals_ = metadata.nonterminals_;
+  structure_size_ = metadata.structure_size_;
+  base_probability_ = metadata.base_probability_;
+  group_ids_ = metadata.group_ids_;
+  group_counts_ = &metadata.group_counts_;
+  has_repeats_ = metadata.has_repeats_;
+
+  const uint64_t *radices = metadata.getRadices();
+  if (radices == NULL)
+    return false;
+  pattern_counter_.reset(radices, structure_size_);
+  return true;
+}
+
+
 // Reset the pattern counter to the "start" which will correspond to the
 // highest-probability pattern (because nonterminals should have their
 // terminal groups in descending probability order)
 void PatternManager::resetPatternCounter() {
-  pattern_counter_->clear();
+  pattern_counter_.clear();
 }
 
 
 // Increment the pattern counter
 bool PatternManager::incrementPatternCounter() {
-  return pattern_counter_->increment();
+  return pattern_counter_.increment();
 }
 
 
 // Move to the next pattern whose probability might be higher than the
 // current pattern
 bool PatternManager::intelligentSkipPatternCounter() {
-  return pattern_counter_->intelligentSkip();
+  return pattern_counter_.intelligentSkip();
+}
+
+
+// Simple pass-throughs to the pattern counter
+uint64_t PatternManager::getPatternCounterPlace(const unsigned int place) const {
+  return pattern_counter_.getPlace(place);
+}
+
+uint64_t PatternManager::getPatternCounterRadix(const unsigned int place) const {
+  return pattern_counter_.getRadix(place);
+}
+
+bool PatternManager::setPatternCounterPlace(const unsigned int place,
+                                            const uint64_t value) {
+  return pattern_counter_.setPlace(place, value);
 }
 
 
 // Using the current state of the pattern counter, return the first string
-// of the pattern.  This is done by simply returning the first strings of
-// each of the terminal groups pointed to by the counter, and concatenating
-// them together (separated by a \x01 char).
+// of the pattern (see appendFirstStringOfPattern)
 const std::string PatternManager::getFirstStringOfPattern() const {
   std::string result("");
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    // Get current digit in this place from the pattern counter
-    uint64_t group_index = pattern_counter_->getPlace(i);
-    // Grab the corresponding string and append
-    result.append(nonterminals_[i]->getFirstStringOfGroup(group_index));
-    if (i < structure_size_ - 1) {
-      result.append("\x01");
-    }
-  }
+  appendFirstStringOfPattern(pattern_counter_, &result);
   return result;
 }
 
 
-// Using the current state of the pattern counter, return the first string
-// of the pattern.  This is done by simply returning the first strings of
-// each of the terminal groups pointed to by the counter, and concatenating
-// them together.
+// Return the first string of the first permutation of the current pattern
 const std::string PatternManager::getCanonicalizedFirstStringOfPattern() const {
+  MixedRadixNumber canonical_counter;
+  canonicalizePattern(&canonical_counter);
   std::string result("");
-  MixedRadixNumber* canonical_counter = canonicalizePattern();
+  appendFirstStringOfPattern(canonical_counter, &result);
+  return result;
+}
 
+
+// The first string of a pattern is found by simply taking the first strings
+// of each of the terminal groups pointed to by the counter, and concatenating
+// them together (separated by a \x01 char).
+void PatternManager::appendFirstStringOfPattern(
+    const MixedRadixNumber& pattern_counter, std::string *result) const {
   for (unsigned int i = 0; i < structure_size_; ++i) {
     // Get current digit in this place from the pattern counter
-    uint64_t group_index = canonical_counter->getPlace(i);
+    uint64_t group_index = pattern_counter.getPlace(i);
     // Grab the corresponding string and append
-    result.append(nonterminals_[i]->getFirstStringOfGroup(group_index));
+    result->append(nonterminals_[i]->getFirstStringOfGroup(group_index));
     if (i < structure_size_ - 1) {
-      result.append("\x01");
+      result->append("\x01");
     }
   }
-
-  delete canonical_counter;
-  return result;
 }
 
 
 // The probability of the current pattern is the product of current terminal
 // group probabilities with the base (structure) probability
 double PatternManager::getPatternProbability() const {
-  double probability = base_probability_;
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    uint64_t group_index = pattern_counter_->getPlace(i);
-    probability *= (nonterminals_[i]->getProbabilityOfGroup(group_index));
-  }
-  return probability;
+  return getPatternProbability(pattern_counter_);
 }
 
 
-// The following method returns the probability of the first permutation
-// of the current pattern, by creating a canonicalized pattern counter
-// and using this to compute the probability.
-double PatternManager::getCanonicalizedPatternProbability() const{
+double PatternManager::getPatternProbability(
+    const MixedRadixNumber& pattern_counter) const {
   double probability = base_probability_;
-  MixedRadixNumber* canonical_counter = canonicalizePattern();
-
   for (unsigned int i = 0; i < structure_size_; ++i) {
-    uint64_t group_index = canonical_counter->getPlace(i);
+    uint64_t group_index = pattern_counter.getPlace(i);
     probability *= (nonterminals_[i]->getProbabilityOfGroup(group_index));
   }
-
-  delete canonical_counter;
   return probability;
 }
 
 
-// Used by getCanonicalized* methods -- return a copy of the current
-// pattern_counter_ permuted so that isFirstPermutation will be true
+// Used by getCanonicalized* methods and lookups -- set canonical_counter to a
+// copy of the current pattern_counter_ permuted so that isFirstPermutation
+// will be true
 //
-// The basic design of this method is as follows:
-// 1. Create a hash of group ids to min-heaps.  This can be filled with
-//    just one pass over the pattern.
-// 2. Perform a second pass over the pattern, and for each element, extract-min
-//    from the appropriate min-heap and place the value in the pattern.
-// This should produce a pattern where, for each group, values are in ascending
-// sorted order, which is the canonical order.  At the end, check that this
-// function works as expected, otherwise die.
+// The canonical order is the one where, for each group, values are in
+// ascending sorted order.  Structures are short, so the values of each
+// repeated group are insertion sorted in place: each value is moved back past
+// the larger values earlier in its group.  This needs no allocation beyond
+// canonical_counter itself, which holds short structures inline.  At the end,
+// check that this function works as expected, otherwise die.
 //
-MixedRadixNumber* PatternManager::canonicalizePattern() const {
-  MixedRadixNumber* canonical_counter = pattern_counter_->deepCopy();
+void PatternManager::canonicalizePattern(
+    MixedRadixNumber* canonical_counter) const {
+  canonical_counter->assign(pattern_counter_);
   if (isFirstPermutation())
-    return canonical_counter;
-
-  // Define hash
-  typedef std::priority_queue<uint64_t, 
-                              std::vector<uint64_t>, 
-                              std::greater<uint64_t>> MinHeap;
-  std::unordered_map<unsigned int, MinHeap> sorted_group_values;
+    return;
 
-  // Make first pass to fill hash
-  for (unsigned int i = 0; i < structure_size_; ++i) {
+  for (unsigned int i = 1; i < structure_size_; ++i) {
     unsigned int group_id = group_ids_[i];
+    if (group_counts_->at(group_id) < 2)
+      continue;
     uint64_t group_index = canonical_counter->getPlace(i);
-    // Add priority queue to the hash as needed
-    if (sorted_group_values.count(group_id) == 0) {
-      MinHeap child;
-      sorted_group_values.insert(std::make_pair(group_id, child));
-    }
-    sorted_group_values[group_id].push(group_index);
-  }
-
-  // Make second pass to refill canonical counter
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    unsigned int group_id = group_ids_[i];
-    if (sorted_group_values[group_id].empty()) {
-      fprintf(stderr, "Empty priority queue found when canonicalizing pattern"
-                      " in PatternManager::canonicalizePattern!\n");
-      exit(EXIT_FAILURE);
+    // hole is the place that will receive group_index, and the places of the
+    // group before it are shifted into it while they are larger
+    unsigned int hole = i;
+    for (unsigned int j = i; j-- > 0; ) {
+      if (group_ids_[j] != group_id)
+        continue;
+      uint64_t earlier_index = canonical_counter->getPlace(j);
+      if (earlier_index <= group_index)
+        break;
+      canonical_counter->setPlace(hole, earlier_index);
+      hole = j;
     }
-    // To pop off the top element of a priority queue, we have to call top()
-    // and then pop()
-    uint64_t sorted_group_index = sorted_group_values[group_id].top();
-    sorted_group_values[group_id].pop();
-    if (!canonical_counter->setPlace(i, sorted_group_index)) {
+    if (!canonical_counter->setPlace(hole, group_index)) {
       fprintf(stderr, "Error setting place in canonical counter when "
                       "canonicalizing pattern in "
                       "PatternManager::canonicalizePattern!\n");
@@ -276,28 +285,24 @@ MixedRadixNumber* PatternManager::canonicalizePattern() const {
     }
   }
 
-  if (!checkFirstPermutation(canonical_counter)) {
+  if (!checkFirstPermutation(*canonical_counter)) {
     fprintf(stderr, "After canonicalizing, checkFirstPermutation returns false"
                     " in PatternManager::canonicalizePattern!\n");
     exit(EXIT_FAILURE);    
   }
-
-  return canonical_counter;
 }
 
 
 // The number of strings produced by the current pattern is the product of
 // the number of strings produced by each current terminal group
-void PatternManager::countStrings(mpz_t result) const {
-  mpz_init(result);
-  mpz_set_ui(result, 1);
+void PatternManager::countStrings(BigCount& result) const {
+  result = 1;
 
+  BigCount group_count;
   for (unsigned int i = 0; i < structure_size_; ++i) {
-    uint64_t group_index = pattern_counter_->getPlace(i);
-    mpz_t group_count;
+    uint64_t group_index = pattern_counter_.getPlace(i);
     nonterminals_[i]->countStringsOfGroup(group_count, group_index);
-    mpz_mul(result, result, group_count);
-    mpz_clear(group_count);
+    BigCount::mul(result, result, group_count);
   }
 }
 
@@ -309,7 +314,7 @@ TerminalGroup::TerminalGroupStringIterator** PatternManager::getStringIterators(
     new TerminalGroup::TerminalGroupStringIterator*[structure_size_];
 
   for (unsigned int i = 0; i < structure_size_; ++i) {
-    uint64_t group_index = pattern_counter_->getPlace(i);
+    uint64_t group_index = pattern_counter_.getPlace(i);
     iterators[i] = nonterminals_[i]->getStringIteratorForGroup(group_index);
   }
 
@@ -335,25 +340,28 @@ bool PatternManager::isFirstPermutation() const {
 // Given a pattern counter for this structure, with the same group ID assignments
 // as this object, check if the current pattern is the first of a permutation.
 //
-bool PatternManager::checkFirstPermutation(MixedRadixNumber* pattern_counter) const {
-  // Use hash table to store values for each group ID and check for a decrease
-  // in value
-  std::unordered_map<unsigned int, uint64_t> group_digits;
-
-  for (unsigned int i = 0; i < structure_size_; ++i) {
+// Each digit of a repeated group is compared with the previous digit of the
+// same group, found by scanning back.  Structures are short, so this is
+// cheaper than keeping the last digit of each group in a hash table.
+//
+bool PatternManager::checkFirstPermutation(
+    const MixedRadixNumber& pattern_counter) const {
+  for (unsigned int i = 1; i < structure_size_; ++i) {
 
     unsigned int group_id = group_ids_[i];
 
     // Ignore groups that are not repeated -- they only have one element so are
     // automatically monotonic    
-    if (group_counts_.at(group_id) > 1) {
-      uint64_t digit = pattern_counter->getPlace(i);
-      if (group_digits.count(group_id) > 0 &&
-          digit < group_digits.at(group_id)) {
-        // Current value is lower than the last saved value
-        return false;
+    if (group_counts_->at(group_id) > 1) {
+      uint64_t digit = pattern_counter.getPlace(i);
+      for (unsigned int j = i; j-- > 0; ) {
+        if (group_ids_[j] == group_id) {
+          // Check for a decrease from the last value of this group
+          if (digit < pattern_counter.getPlace(j))
+            return false;
+          break;
+        }
       }
-      group_digits[group_id] = digit;
     }
 
   }
@@ -365,136 +373,111 @@ bool PatternManager::checkFirstPermutation(MixedRadixNumber* pattern_counter) co
 // NOTE: This is not a const method and will overwrite the current pattern
 // counter.
 // 
-// Given a vector of terminals, look up the terminals and then perform
+// Given an input string, look up its terminals and then perform
 // several calculations to determine the rank of this inputstring in
 // the full set of strings*permutations that can be produced by this
 // pattern. Performing these calculations is easiest if we overwrite the
 // current pattern counter.
 //
-// Returns a lookup_data structure that might have kUnexpectedFailure as
-// a parse_status.  Callers to this method should check for this status
+// Fills in lookup_data, which might get kUnexpectedFailure as a
+// parse_status.  Callers to this method should check for this status
 // and print an appropriate error message (or print the parse_status as
 // an integer).
 //
 // Basic operation is as follows:
-// 1. For each terminal, call the corresponding nonterminal's lookup method
-//    gather the TerminalLookupData structs in an array.
-// 2. Check that all lookups return kCanParse.  If not, return a LookupData
-//    object with appropriate parse status.
-// 3. Use terminal_group_index fields to set pattern counter.
-// 4. Use terminal indexes as digits, and nonterminal->countStringsOfGroup
+// 1. For each terminal, call the corresponding nonterminal's lookup method.
+//    If it does not return kCanParse, set the parse status of lookup_data
+//    and return.
+// 2. Use the terminal_group_index field to set the pattern counter.
+// 3. Use terminal indexes as digits, and nonterminal->countStringsOfGroup
 //    sizes as radices and convert to base-10 to get a rank of these terminals
 //    in the current pattern (rank_in_pattern)
-// 5. Get the number of strings in the current pattern using countStrings
+// 4. Get the number of strings in the current pattern using countStrings
 //    (strings_in_pattern)
-// 6. Get the rank of this pattern in the set of permutations of this pattern
+// 5. Get the rank of this pattern in the set of permutations of this pattern
 //    using getPermutationRank (permutation_rank)
-// 7. Get the rank of this string in all permutations of this pattern
+// 6. Get the rank of this string in all permutations of this pattern
 //    LookupData->index = (permutation_rank*strings_in_pattern)+rank_in_pattern
 //    Since all permutations of this pattern contain the same number of strings,
 //    this will work.
-// 8. Set other LookupData fields:
+// 7. Set other LookupData fields:
 //    parse_status = kCanParse
-//    source_ids = union of all terminal source_ids
-//    probability = getCanonicalizedPatternProbability
-//    first_string_of_pattern = getCanonicalizedFirstStringOfPattern
-//
-// Assume the size of terminals[] is the same as structure_size_
-//
-LookupData* PatternManager::lookupAndSetPattern(const std::string *const terminals) {
-  LookupData* lookup_data = new LookupData;
-  mpz_init(lookup_data->index);
-
-  // Gather terminal lookups
-  TerminalLookupData* *terminal_lookups = new TerminalLookupData*[structure_size_];
+//    probability and first_string_of_pattern, from the canonicalized
+//    pattern counter.  The pattern is canonicalized once, into a counter on
+//    the stack, for both.
+//
+// Source ids are not touched (see Structure::addSourceIDs).
+//
+// The terminals are consecutive in inputstring, with lengths given by the
+// nonterminal representations.  Assume inputstring has no break characters
+// and is exactly as long as all of the terminals together.
+//
+void PatternManager::lookupAndSetPattern(const char *inputstring,
+                                         LookupData *lookup_data,
+                                         NonterminalLookupMemo *memo) {
+  TerminalLookupData own_terminal_lookup;
+  BigCount rank_in_pattern;
+  BigCount strings_in_group;
+  size_t terminal_offset = 0;
   for (unsigned int i = 0; i < structure_size_; ++i) {
-    terminal_lookups[i] = nonterminals_[i]->lookup(terminals[i]);
-  }
+    size_t terminal_length = nonterminals_[i]->getRepresentation().size();
+    const TerminalLookupData *terminal_lookup = &own_terminal_lookup;
+    if (memo != NULL) {
+      terminal_lookup = &memo->lookup(nonterminals_[i], inputstring,
+                                      terminal_offset, terminal_length);
+    } else {
+      nonterminals_[i]->lookup(inputstring + terminal_offset, terminal_length,
+                               &own_terminal_lookup);
+    }
+    terminal_offset += terminal_length;
 
-  // Check parse status
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    if (!(terminal_lookups[i]->parse_status & kCanParse)) {
-      lookup_data->parse_status = terminal_lookups[i]->parse_status;
+    // Check parse status
+    if (!(terminal_lookup->parse_status & kCanParse)) {
+      lookup_data->parse_status = terminal_lookup->parse_status;
       lookup_data->probability = -1;
-      mpz_set_si(lookup_data->index, -1);
-      // Clear all terminal lookup mpzs and return
-      for (unsigned int j = 0; j < structure_size_; ++j) {
-        mpz_clear(terminal_lookups[j]->index);
-        delete terminal_lookups[j];
-      }
-      delete[] terminal_lookups;
-      return lookup_data;
+      return;
     }
-  }
 
-  // Set pattern counter
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    if (!pattern_counter_->setPlace(i, terminal_lookups[i]->terminal_group_index)) {
+    // Set pattern counter
+    if (!pattern_counter_.setPlace(i, terminal_lookup->terminal_group_index)) {
       lookup_data->parse_status = kUnexpectedFailure;
       lookup_data->probability = -1;
-      mpz_set_si(lookup_data->index, -1);
-      // Clear all terminal lookup mpzs and return
-      for (unsigned int j = 0; j < structure_size_; ++j) {
-        mpz_clear(terminal_lookups[j]->index);
-        delete terminal_lookups[j];
-      }
-      delete[] terminal_lookups;
-      return lookup_data;      
+      return;
     }
-  }
 
-  // Compute rank_in_pattern
-  mpz_t rank_in_pattern;
-  mpz_init_set_ui(rank_in_pattern, 0);
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    mpz_t strings_in_group;
-    nonterminals_[i]->countStringsOfGroup(strings_in_group, 
-                                          pattern_counter_->getPlace(i));
+    // Compute rank_in_pattern
+    nonterminals_[i]->countStringsOfGroup(strings_in_group,
+                                          terminal_lookup->terminal_group_index);
     // Use the formula from: http://stackoverflow.com/a/759319
-    mpz_mul(rank_in_pattern, rank_in_pattern, strings_in_group);
-    mpz_add(rank_in_pattern, rank_in_pattern, terminal_lookups[i]->index);
-
-    mpz_clear(strings_in_group);
+    BigCount::mul(rank_in_pattern, rank_in_pattern, strings_in_group);
+    BigCount::add(rank_in_pattern, rank_in_pattern, terminal_lookup->index);
   }
 
-  mpz_t strings_in_pattern;
+  BigCount strings_in_pattern;
   countStrings(strings_in_pattern);
-  mpz_t permutation_rank;
+  BigCount permutation_rank;
   getPermutationRank(permutation_rank);
 
   // Compute the rank of this string
-  mpz_mul(lookup_data->index, permutation_rank, strings_in_pattern);
-  mpz_add(lookup_data->index, lookup_data->index, rank_in_pattern);
-  // Clear intermediate values
-  mpz_clear(strings_in_pattern);
-  mpz_clear(rank_in_pattern);
-  mpz_clear(permutation_rank);
+  BigCount::mul(lookup_data->index, permutation_rank, strings_in_pattern);
+  BigCount::add(lookup_data->index, lookup_data->index, rank_in_pattern);
 
   // Set other fields of lookup_data
   lookup_data->parse_status = kCanParse;
-  lookup_data->probability = getCanonicalizedPatternProbability();
-  lookup_data->first_string_of_pattern = getCanonicalizedFirstStringOfPattern();
-  // Union source ids
-  for (unsigned int i = 0; i < structure_size_; ++i) {
-    lookup_data->source_ids.insert(terminal_lookups[i]->source_ids.begin(),
-                                   terminal_lookups[i]->source_ids.end());
-  }
-
-  // Clear all terminal lookup mpzs and return
-  for (unsigned int j = 0; j < structure_size_; ++j) {
-    mpz_clear(terminal_lookups[j]->index);
-    delete terminal_lookups[j];
-  }
-  delete[] terminal_lookups;
-  return lookup_data;
+  MixedRadixNumber canonical_counter;
+  canonicalizePattern(&canonical_counter);
+  lookup_data->probability = getPatternProbability(canonical_counter);
+  lookup_data->first_string_of_pattern.clear();
+  appendFirstStringOfPattern(canonical_counter,
+                             &lookup_data->first_string_of_pattern);
 }
 
 
 
 // Use the formula for permutations of multisets to calculate the number of
 // permutations for the current pattern
-void PatternManager::countPermutations(mpz_t result) const {
-  mpz_init_set_ui(result, 1);
+void PatternManager::countPermutations(BigCount& result) const {
+  result = 1;
 
   // Return 1 if this pattern has no repeats
   // (since this means it has no permutations)
@@ -511,10 +494,9 @@ void PatternManager::countPermutations(mpz_t result) const {
   for (auto it = counts_within_groups->begin(); 
             it != counts_within_groups->end();
             ++it) {    
-    mpz_t group_perms;
+    BigCount group_perms;
     getPermutationsOfGroup(group_perms, &(it->second));
-    mpz_mul(result, result, group_perms);
-    mpz_clear(group_perms);
+    BigCount::mul(result, result, group_perms);
   }
 
   delete counts_within_groups;
@@ -533,8 +515,8 @@ std::map<unsigned int, std::map<uint64_t, unsigned int>>*
 
   for (unsigned int i = 0; i < structure_size_; ++i) {
     unsigned int group_id = group_ids_[i];
-    if (group_counts_.at(group_id) > 1) {
-      uint64_t digit = pattern_counter_->getPlace(i);      
+    if (group_counts_->at(group_id) > 1) {
+      uint64_t digit = pattern_counter_.getPlace(i);      
       // Add new hash table for this group if needed
       if (counts_within_groups->count(group_id) == 0) {
         std::map<uint64_t, unsigned int> child;
@@ -563,33 +545,27 @@ std::map<unsigned int, std::map<uint64_t, unsigned int>>*
 // each distinct value.  Using the terminology from Wikipedia, n is the total
 // cardinality of the multiset, and m_i are the multiplicities of each member.
 // 
-void PatternManager::getPermutationsOfGroup(mpz_t result,
+void PatternManager::getPermutationsOfGroup(BigCount& result,
     std::map<uint64_t, unsigned int>* counts) const {
-  mpz_init(result);
-
   // First, get n!
   unsigned long int total_count = 0;
   for (auto it = counts->begin(); it != counts->end(); ++it) {
     total_count += it->second;
   }
   if (total_count < kMaxFactorial)
-    mpz_set_ui(result, kFactorialTable[total_count]);
+    result = kFactorialTable[total_count];
   else
-    mpz_fac_ui(result, total_count);
+    BigCount::factorial(result, total_count);
 
   // Now divide out the multiplicities
   for (auto it = counts->begin(); it != counts->end(); ++it) {
     if (it->second > 1) {  // Skip dividing by 1
       if (it->second < kMaxFactorial)
-        mpz_div_ui(result, result, kFactorialTable[it->second]);
+        BigCount::div(result, result, kFactorialTable[it->second]);
       else {
-        mpz_t temp_factorial;
-        mpz_init(temp_factorial);
-        mpz_fac_ui(temp_factorial, it->second);
-
-        mpz_div(result, result, temp_factorial);
-
-        mpz_clear(temp_factorial);
+        BigCount temp_factorial;
+        BigCount::factorial(temp_factorial, it->second);
+        BigCount::div(result, result, temp_factorial);
       }
     }
   }
@@ -686,8 +662,8 @@ void PatternManager::getPermutationsOfGroup(mpz_t result,
 // So if we multiply before dividing and use BigInts, we don't need to
 // worry about the divisions creating fractions.
 //
-void PatternManager::getPermutationRank(mpz_t result) const {
-  mpz_init_set_ui(result, 0);
+void PatternManager::getPermutationRank(BigCount& result) const {
+  result = 0;
 
   // Return 0 if this pattern has no repeats
   // (since this means it has no permutations)
@@ -703,24 +679,23 @@ void PatternManager::getPermutationRank(mpz_t result) const {
   // Since we are using a std::map, this will iterate in order of group_id
   for (auto it = counts_within_groups->begin(); 
        it != counts_within_groups->end(); ++it) {
-    mpz_t rank;
-    mpz_init_set_ui(rank, 0);
+    BigCount rank;
 
     // Get group id and permutations
     unsigned int group_id = it->first;
-    mpz_t group_perms;
+    BigCount group_perms;
     getPermutationsOfGroup(group_perms, &(it->second));
 
     // Iterate over this groups' digits in the current pattern and compute the
     // permutation rank using the magic formula.  This destroys this groups'
     // hash in counts_within_groups.
     unsigned int k = 0;
-    unsigned int current_size = group_counts_.at(group_id);
-    mpz_t current_perms;
+    unsigned int current_size = group_counts_->at(group_id);
     // current_perms always stores the number of permutations of values from
     // k to the end of the string
-    mpz_init_set(current_perms, group_perms);
-    while (k < structure_size_ && mpz_cmp_ui(current_perms, 1) > 0) {
+    BigCount current_perms(group_perms);
+    BigCount tempval;
+    while (k < structure_size_ && BigCount::cmp(current_perms, 1) > 0) {
       // Skip ahead if in the wrong group
       if (group_ids_[k] != group_id) {
         ++k;
@@ -728,7 +703,7 @@ void PatternManager::getPermutationRank(mpz_t result) const {
       }
 
       // Get the current digit and its multiplicity (digit_count)
-      uint64_t digit = pattern_counter_->getPlace(k);
+      uint64_t digit = pattern_counter_.getPlace(k);
       unsigned int digit_count = it->second.at(digit);
 
       // Determine the weak rank of this digit, i.e., the sum of the
@@ -740,27 +715,22 @@ void PatternManager::getPermutationRank(mpz_t result) const {
         weak_digit_rank += it2->second;
 
       // Now implement the magic formulas
-      mpz_t tempval;
-      mpz_init(tempval);
       // Formula for updating rank:
       // rank += (current_perms * weak_digit_rank / current_size)
-      mpz_mul_ui(tempval, current_perms, weak_digit_rank);
-      mpz_div_ui(tempval, tempval, current_size);
-      mpz_add(rank, rank, tempval);
-      mpz_clear(tempval);
+      BigCount::mul(tempval, current_perms, weak_digit_rank);
+      BigCount::div(tempval, tempval, current_size);
+      BigCount::add(rank, rank, tempval);
       // current_perms *= digit_count; current_perms /= current_size
-      mpz_mul_ui(current_perms, current_perms, digit_count);
-      mpz_div_ui(current_perms, current_perms, current_size);
+      BigCount::mul(current_perms, current_perms, digit_count);
+      BigCount::div(current_perms, current_perms, current_size);
       --(it->second[digit]);  // Consume / reduce the multiplicity of this
                               // digit going forward
       
       --current_size;
       ++k;
     }
-    mpz_clear(current_perms);
-
     // Sanity check, rank should be between 0 and group_perms - 1
-    if (mpz_cmp(rank, group_perms) >= 0) {
+    if (BigCount::cmp(rank, group_perms) >= 0) {
       fprintf(stderr, "Unexpected error when computing permutation rank"
                       " in PatternManager::getPermutationRank!\n");
       exit(EXIT_FAILURE);
@@ -769,11 +739,8 @@ void PatternManager::getPermutationRank(mpz_t result) const {
     // We now have the rank of this permutation, and the total number of
     // possible permutations.  Treat the rank as a digit in a mixed-radix
     // number and compute overall rank in homogeneous base.
-    mpz_mul(result, result, group_perms);
-    mpz_add(result, result, rank);
-
-    mpz_clear(group_perms);
-    mpz_clear(rank);
+    BigCount::mul(result, result, group_perms);
+    BigCount::add(result, result, rank);
   }
 
   delete counts_within_groups;
@@ -72,37 +72,106 @@
 #ifndef PATTERN_MANAGER_H__
 #define PATTERN_MANAGER_H__
 
-#include <gmp.h>
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <map>
+#include <mutex>
 #include <cstdint>
 
+#include "big_count.h"
 #include "gcfmacros.h"
 #include "lookup_data.h"
 #include "nonterminal.h"
+#include "nonterminal_lookup_memo.h"
 #include "mixed_radix_number.h"
 #include "terminal_group.h"
 
-class PatternManager {
+// The parts of a pattern manager that depend only on its structure: the
+// nonterminals, the group ids and counts, and the radices of the pattern
+// counter.  Computing these means parsing the structure representation, so
+// each Structure builds a PatternMetadata once, when it is loaded, and every
+// PatternManager over that structure shares it.  A PatternManager then only
+// holds the state of its own pattern counter.
+//
+// The radices are the terminal group counts of the nonterminals, and asking
+// for them loads the nonterminals (see Nonterminal::loadNonterminal), so
+// they are computed when the first PatternManager needs them rather than in
+// Init.
+class PatternMetadata {
 public:
   // Initialization is complex, so it is deferred to an Init method
-  PatternManager():
+  PatternMetadata():
     nonterminals_(NULL),
     structure_size_(0),
     base_probability_(0.0),
     group_ids_(NULL),
-    pattern_counter_(NULL),
+    radices_(NULL),
     has_repeats_(false) {}
-  ~PatternManager();
+  ~PatternMetadata();
 
-  // Use the given structure properties to initialize class variables
+  // Use the given structure properties to initialize class variables.  The
+  // nonterminals array must outlive this object.
   bool Init(const std::string& representation,
             const char structurebreakchar,
             const unsigned int structure_size,
             Nonterminal* *nonterminals,
             const double base_probability);
 
+  unsigned int getStructureSize() const { return structure_size_; }
+
+private:
+  friend class PatternManager;
+
+  // Helper Init function
+  bool InitGroupIDsAndCounts(const std::string& representation,
+                        const char structurebreakchar,
+                        const unsigned int structure_size);
+
+  // Structure = a sequence of nonterminal pointers with a given probability
+  Nonterminal* *nonterminals_;
+  unsigned int structure_size_;
+  double base_probability_;
+
+  // A sequence of group ids that aligns with the structure
+  unsigned int *group_ids_;
+  // A map from current group ids to their counts in the structure
+  std::unordered_map<unsigned int, unsigned int> group_counts_;
+
+  // Return the radices, computing them on the first call.  Thread-safe.
+  const uint64_t* getRadices() const;
+
+  // The number of terminal groups produced by each nonterminal.  Set, under
+  // radices_mutex_, by the first call to getRadices.
+  mutable std::atomic<uint64_t*> radices_;
+  mutable std::mutex radices_mutex_;
+
+  // Are any nonterminals repeated?  If not, many complex operations can be
+  // avoided.
+  bool has_repeats_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(PatternMetadata);
+};
+
+
+class PatternManager {
+public:
+  // Initialization is deferred to an Init method
+  PatternManager():
+    nonterminals_(NULL),
+    structure_size_(0),
+    base_probability_(0.0),
+    group_ids_(NULL),
+    group_counts_(NULL),
+    has_repeats_(false) {}
+
+  // Point this pattern manager at the given structure metadata, which must
+  // outlive it, and reset the pattern counter.  The pattern counter only
+  // allocates for structures longer than it holds inline, so pattern managers
+  // are cheap to create.
+  bool Init(const PatternMetadata& metadata);
+
   // Reset the pattern to the "first" or beginning pattern
   void resetPatternCounter();
   // Move to the next pattern - return false on overflow
@@ -111,6 +180,13 @@ public:
   // current pattern - return false on overflow
   bool intelligentSkipPatternCounter();
 
+  // Direct access to single places of the pattern counter, used to split the
+  // pattern space of a structure into independent ranges
+  uint64_t getPatternCounterPlace(const unsigned int place) const;
+  uint64_t getPatternCounterRadix(const unsigned int place) const;
+  // Returns false if the place or value is out of range
+  bool setPatternCounterPlace(const unsigned int place, const uint64_t value);
+
   // Get the first string that would be produced by the current pattern
   const std::string getFirstStringOfPattern() const;
   // The lookup table will only contain the first string of a permutation, but
@@ -121,9 +197,7 @@ public:
   // Get its probability
   double getPatternProbability() const;
   // Get the number of strings it would produce
-  // By convention, mpz_t types are not returned, but are passed by reference
-  // See http://stackoverflow.com/a/13396028  
-  void countStrings(mpz_t result) const;
+  void countStrings(BigCount& result) const;
   // Get an array of iterators for terminals of the current pattern
   TerminalGroup::TerminalGroupStringIterator** getStringIterators() const;
 
@@ -132,33 +206,33 @@ public:
   bool isFirstPermutation() const;
   // Get the number of permutations of the current pattern
   // This returns 1 if the pattern cannot be compacted
-  void countPermutations(mpz_t result) const;
+  void countPermutations(BigCount& result) const;
 
-  // Given a vector of terminals, look up the terminals and then perform
-  // several calculations to determine the rank of this inputstring in
-  // the full set of strings*permutations that can be produced by this
-  // pattern.
+  // Given an input string (without break characters), look up its terminals
+  // and then perform several calculations to determine the rank of this
+  // inputstring in the full set of strings*permutations that can be produced
+  // by this pattern.  The results are written to lookup_data, except for
+  // source ids.
   //
   // Note: this is not a const method and will change the value of the
   // pattern counter to one which can produce the given terminals. Hence
   // the longer name than for other lookup methods in the guess calculator
   // framework.
-  LookupData* lookupAndSetPattern(const std::string *const terminals);
+  //
+  // If memo is given, terminals are looked up through it, so that lookups
+  // already made for the same input string by other structures are reused.
+  void lookupAndSetPattern(const char *inputstring, LookupData *lookup_data,
+                           NonterminalLookupMemo *memo = NULL);
 
 
 private:
   static const uint64_t kFactorialTable[21];  // This is assigned in the .cpp file
   static const unsigned int kMaxFactorial = 20;  // 21! is larger than UINT64_MAX
 
-  // Helper Init function
-  bool InitGroupIDsAndCounts(const std::string& representation,
-                        const char structurebreakchar,
-                        const unsigned int structure_size);
-
   // Used by the lookup method -- return the rank of this pattern in its
   // possible permutations, i.e., if isFirstPermutation is true, the rank will
   // be 0.  Otherwise, this will return a number from 1 to countPermutations.
-  void getPermutationRank(mpz_t result) const;
+  void getPermutationRank(BigCount& result) const;
 
   // Return a hash of hashes for each repeating group in the current pattern
   std::map<unsigned int, std::map<uint64_t, unsigned int>>*
@@ -166,38 +240,42 @@ private:
   // Given a hash of digits to counts for a single nonterminal (such as one of
   // the hashes returned by getCountsWithinRepeatingGroups), return the number
   // of permutations.
-  void getPermutationsOfGroup(mpz_t result,
+  void getPermutationsOfGroup(BigCount& result,
                               std::map<uint64_t, unsigned int>* counts) const;
 
+  // Used by getCanonicalized* methods and lookups -- set canonical_counter to
+  // a copy of the current pattern_counter_ permuted so that
+  // isFirstPermutation will be true
+  void canonicalizePattern(MixedRadixNumber* canonical_counter) const;
+
+  // The probability and first string of the pattern given by a pattern
+  // counter for this structure, such as a canonicalized one.  The first
+  // string is appended to result.
+  //
   // For all permutations of a pattern, the theoretical probabilities are the
   // same.  However, since we are dealing with small floating-point numbers
-  // the order in which they are multiplied is actually important.
-  // The following method returns the probability of the first permutation
-  // of the current pattern.
-  double getCanonicalizedPatternProbability() const;
-
-  // Used by getCanonicalized* methods -- return a copy of the current
-  // pattern_counter_ permuted so that isFirstPermutation will be true
-  MixedRadixNumber* canonicalizePattern() const;
+  // the order in which they are multiplied is actually important, so lookups
+  // use the probability of the first permutation of the current pattern.
+  double getPatternProbability(const MixedRadixNumber& pattern_counter) const;
+  void appendFirstStringOfPattern(const MixedRadixNumber& pattern_counter,
+                                  std::string *result) const;
 
   // Given a pattern counter, check if the current pattern is the first
   // of a permutation.  Used by isFirstPermutation and as a check in
   // canonicalizePattern.
-  bool checkFirstPermutation(MixedRadixNumber* pattern_counter) const;
+  bool checkFirstPermutation(const MixedRadixNumber& pattern_counter) const;
 
-  // Structure = a sequence of nonterminal pointers with a given probability
-  Nonterminal* *nonterminals_;
+  // Copied from the PatternMetadata, which owns the arrays (see
+  // PatternMetadata for descriptions)
+  Nonterminal* const *nonterminals_;
   unsigned int structure_size_;
   double base_probability_;
-
-  // A sequence of group ids that aligns with the structure
-  unsigned int *group_ids_;
-  // A map from current group ids to their counts in the structure
-  std::unordered_map<unsigned int, unsigned int> group_counts_;
+  const unsigned int *group_ids_;
+  const std::unordered_map<unsigned int, unsigned int> *group_counts_;
 
   // We will iterate through the structure using a mixed-radix number which
   // also aligns with the structure (i.e., is of size structure_size_)
-  MixedRadixNumber* pattern_counter_;
+  MixedRadixNumber pattern_counter_;
 
   // Are any nonterminals repeated?  If not, many complex operations can be
   // avoided.
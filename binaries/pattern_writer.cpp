@@ -0,0 +1,157 @@
+// pattern_writer.cpp - destinations for the patterns produced by
+//   Structure::generatePatterns
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <cstdlib>
+
+#include "text_codec.h"
+
+#include "pattern_writer.h"
+
+TextPatternWriter::~TextPatternWriter() {
+  if (!flush()) {
+    fprintf(stderr, "Error writing patterns in ~TextPatternWriter!\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+// Format a raw table line into the buffer, and flush once it is large
+bool TextPatternWriter::writePattern(const double probability,
+                                     const BigCount& count,
+                                     const std::string& pattern) {
+  textcodec::AppendHexFloat(probability, &buffer_);
+  buffer_.push_back('\t');
+  count.appendTo(&buffer_);
+  buffer_.push_back('\t');
+  buffer_.append(pattern);
+  buffer_.push_back('\n');
+
+  if (buffer_.size() >= kFlushSize)
+    return flush();
+  return true;
+}
+
+
+// Write the buffer to the output file, holding the output mutex if we have one
+bool TextPatternWriter::flush() {
+  if (buffer_.empty())
+    return true;
+
+  size_t written;
+  if (outfile_mutex_ != NULL) {
+    std::lock_guard<std::mutex> lock(*outfile_mutex_);
+    written = fwrite(buffer_.data(), 1, buffer_.size(), outfile_);
+  } else {
+    written = fwrite(buffer_.data(), 1, buffer_.size(), outfile_);
+  }
+
+  bool success = (written == buffer_.size());
+  buffer_.clear();
+  return success;
+}
+
+
+LookupTableWriter::LookupTableWriter(FILE *outfile)
+  : outfile_(outfile),
+    next_guess_(1),  // Start at the first guess
+    last_probability_(1.0) {}
+
+
+LookupTableWriter::~LookupTableWriter() {}
+
+
+// Write the line for this pattern and advance the guess number past all of
+// its strings
+bool LookupTableWriter::writePattern(const double probability,
+                                     const BigCount& count,
+                                     const std::string& pattern) {
+  // Make sure probabilities are always decreasing
+  if (last_probability_ < probability) {
+    fprintf(stderr, "Found instance where patterns are not sorted by "
+                    "decreasing probability! Found probability %a followed "
+                    "by %a!\n", last_probability_, probability);
+    return false;
+  }
+  last_probability_ = probability;
+
+  line_.clear();
+  textcodec::AppendHexFloat(probability, &line_);
+  line_.push_back('\t');
+  next_guess_.appendTo(&line_);
+  line_.push_back('\t');
+  line_.append(pattern);
+  line_.push_back('\n');
+  if (fwrite(line_.data(), 1, line_.size(), outfile_) != line_.size())
+    return false;
+  BigCount::add(next_guess_, next_guess_, count);
+  return true;
+}
+
+
+bool LookupTableWriter::flush() {
+  return (fflush(outfile_) == 0);
+}
+
+
+bool LookupTableWriter::finish() {
+  BigCount total;
+  countGuesses(total);
+  if (fprintf(outfile_, "Total count\t%s\n", total.toString().c_str()) < 0)
+    return false;
+  return flush();
+}
+
+
+// next_guess_ is one past the last guess covered so far
+void LookupTableWriter::countGuesses(BigCount& result) const {
+  BigCount::sub(result, next_guess_, 1);
+}
+
+
+TextStringWriter::~TextStringWriter() {
+  if (!flush()) {
+    fprintf(stderr, "Error writing strings in ~TextStringWriter!\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+// Format an output line into the buffer, and flush once it is large
+bool TextStringWriter::writeString(const double probability,
+                                   const std::string& str) {
+  textcodec::AppendHexFloat(probability, &buffer_);
+  buffer_.push_back('\t');
+  buffer_.append(str);
+  buffer_.push_back('\n');
+
+  if (buffer_.size() >= kFlushSize)
+    return flush();
+  return true;
+}
+
+
+// Same as TextPatternWriter::flush
+bool TextStringWriter::flush() {
+  if (buffer_.empty())
+    return true;
+
+  size_t written;
+  if (outfile_mutex_ != NULL) {
+    std::lock_guard<std::mutex> lock(*outfile_mutex_);
+    written = fwrite(buffer_.data(), 1, buffer_.size(), outfile_);
+  } else {
+    written = fwrite(buffer_.data(), 1, buffer_.size(), outfile_);
+  }
+
+  bool success = (written == buffer_.size());
+  buffer_.clear();
+  return success;
+}
@@ -0,0 +1,140 @@
+// pattern_writer.h - destinations for the patterns produced by
+//   Structure::generatePatterns and the strings produced by
+//   Structure::generateStrings
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Pattern generation used to print each pattern directly to stdout.  To let
+// several threads generate patterns at once (and to allow output formats
+// other than the raw text table) structures hand each pattern to a
+// PatternWriter instead.  A PatternWriter is only ever used by one thread at
+// a time; parallel generation gives each worker thread its own writer.
+//
+// TextPatternWriter produces the "raw table" format:
+//   probability<tab>count<tab>first string of pattern
+// with the probability written as a hex float.  Lines are collected in a
+// private buffer and written to the output FILE in large blocks.  If an
+// output mutex is given, it is held while a block is written, so several
+// writers can share one FILE without interleaving partial lines.
+//
+// LookupTableWriter produces the "lookup table" format written by
+// sortedcountaggregator:
+//   probability<tab>guess number of the pattern's first string<tab>pattern
+// followed by a final "Total count<tab>n" line written by finish().  Patterns
+// must be given to it in order of non-increasing probability.
+//
+// TextStringWriter is the counterpart of TextPatternWriter for string
+// generation, and produces lines of the form:
+//   probability<tab>string
+// It buffers and shares its output FILE in the same way.
+//
+
+#ifndef PATTERN_WRITER_H__
+#define PATTERN_WRITER_H__
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "big_count.h"
+#include "gcfmacros.h"
+
+class PatternWriter {
+ public:
+  PatternWriter() {}
+  virtual ~PatternWriter() {}
+
+  // Record one pattern, its probability, and the number of strings it covers
+  // (including all permutations).  Return false on failure.
+  virtual bool writePattern(const double probability,
+                            const BigCount& count,
+                            const std::string& pattern) = 0;
+
+  // Push any buffered patterns to their destination.  Return false on failure.
+  virtual bool flush() = 0;
+
+ private:
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(PatternWriter);
+};
+
+
+class TextPatternWriter : public PatternWriter {
+ public:
+  TextPatternWriter(FILE *outfile, std::mutex *outfile_mutex = NULL)
+    : outfile_(outfile),
+      outfile_mutex_(outfile_mutex) {}
+  // Flushes remaining output
+  ~TextPatternWriter();
+
+  bool writePattern(const double probability,
+                    const BigCount& count,
+                    const std::string& pattern);
+  bool flush();
+
+ private:
+  // Write out the buffer once it grows past this size
+  static const size_t kFlushSize = 1 << 20;
+
+  FILE *outfile_;
+  std::mutex *outfile_mutex_;
+  std::string buffer_;
+};
+
+
+class LookupTableWriter : public PatternWriter {
+ public:
+  explicit LookupTableWriter(FILE *outfile);
+  ~LookupTableWriter();
+
+  // Returns false if the pattern is more probable than the previous one
+  bool writePattern(const double probability,
+                    const BigCount& count,
+                    const std::string& pattern);
+  bool flush();
+  // Write the "Total count" line and flush.  Return false on failure.
+  bool finish();
+
+  // Number of strings covered by the patterns written so far
+  void countGuesses(BigCount& result) const;
+
+ private:
+  FILE *outfile_;
+  // Guess number of the first string of the next pattern
+  BigCount next_guess_;
+  double last_probability_;
+  // Reused to format each line
+  std::string line_;
+};
+
+
+class TextStringWriter {
+ public:
+  TextStringWriter(FILE *outfile, std::mutex *outfile_mutex = NULL)
+    : outfile_(outfile),
+      outfile_mutex_(outfile_mutex) {}
+  // Flushes remaining output
+  ~TextStringWriter();
+
+  // Record one string and its probability.  Return false on failure.
+  bool writeString(const double probability, const std::string& str);
+  // Push any buffered strings to the output file.  Return false on failure.
+  bool flush();
+
+ private:
+  // Write out the buffer once it grows past this size
+  static const size_t kFlushSize = 1 << 20;
+
+  FILE *outfile_;
+  std::mutex *outfile_mutex_;
+  std::string buffer_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(TextStringWriter);
+};
+
+
+#endif  // PATTERN_WRITER_H__
@@ -16,8 +16,14 @@
 // Includes not covered in header file
 #include <cstdio>
 #include <cstdlib>
+#include <climits>
 #include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <queue>
 #include "grammar_tools.h"
+#include "work_stealing_pool.h"
 
 #include "pcfg.h"
 
@@ -29,6 +35,8 @@ PCFG::~PCFG() {
     delete[] structures_;
   if (nonterminal_collection_ != NULL)
     delete nonterminal_collection_;
+  if (snapshot_reader_ != NULL)
+    delete snapshot_reader_;
 }
 
 
@@ -42,6 +50,10 @@ PCFG::~PCFG() {
 bool PCFG::loadGrammar(
     const std::string& structuresfilename,
     const std::string& terminals_folder) {
+  // Snapshots written by CompileGrammar are loaded without parsing
+  if (GrammarSnapshotReader::isGrammarSnapshot(structuresfilename))
+    return loadSnapshot(structuresfilename, terminals_folder);
+
   FILE *structurefile = fopen(structuresfilename.c_str(), "r");
   if (structurefile == NULL) {
     int saved_errno = errno;
@@ -125,20 +137,99 @@ bool PCFG::loadGrammar(
 
   fclose(structurefile);
 
+  buildStructureIndex();
   return true;
 }
 
 
+// Index structures by signature
+void PCFG::buildStructureIndex() {
+  for (unsigned int i = 0; i < structures_size_; ++i)
+    structure_index_[structures_[i].getSignature()].push_back(i);
+}
+
+
+// Load a grammar snapshot (see grammar_snapshot.h): the nonterminals are
+// created first, from their records, and then the structures, which find
+// their nonterminals already in the collection.  The snapshot stays mapped,
+// since terminal groups are only read from it when they are first needed.
+//
+// As with loadGrammar, die on failure.
+bool PCFG::loadSnapshot(const std::string& snapshotfilename,
+                        const std::string& terminals_folder) {
+  snapshot_reader_ = new GrammarSnapshotReader;
+  GrammarSnapshotReader& reader = *snapshot_reader_;
+  if (!reader.load(snapshotfilename))
+    exit(EXIT_FAILURE);
+
+  nonterminal_collection_ = new NonterminalCollection(terminals_folder);
+  if (!nonterminal_collection_->loadSnapshot(&reader)) {
+    fprintf(stderr, "Error loading nonterminals from grammar snapshot %s!\n",
+                    snapshotfilename.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t structures_size;
+  if (!reader.readUint64(&structures_size) || structures_size > UINT_MAX) {
+    fprintf(stderr, "Grammar snapshot %s is missing its structures!\n",
+                    snapshotfilename.c_str());
+    exit(EXIT_FAILURE);
+  }
+  structures_size_ = static_cast<unsigned int>(structures_size);
+  structures_ = new Structure[structures_size_];
+  for (unsigned int i = 0; i < structures_size_; ++i) {
+    double probability;
+    std::string representation, source_ids;
+    if (!reader.readDouble(&probability) ||
+        !reader.readString(&representation) ||
+        !reader.readString(&source_ids)) {
+      fprintf(stderr, "Grammar snapshot %s is corrupt at structure %u!\n",
+                      snapshotfilename.c_str(), i);
+      exit(EXIT_FAILURE);
+    }
+    if (!structures_[i].loadStructure(representation, probability, source_ids,
+                                      nonterminal_collection_)) {
+      fprintf(stderr,
+        "Error calling LoadStructure on structure \"%s\" in file \"%s\"!\n",
+        representation.c_str(), snapshotfilename.c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!reader.atEnd()) {
+    fprintf(stderr, "Grammar snapshot %s has trailing data!\n",
+                    snapshotfilename.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  buildStructureIndex();
+  return true;
+}
+
+
+// Write the loaded grammar as a snapshot that loadGrammar can read in place
+// of the structures file
+bool PCFG::writeSnapshot(const std::string& snapshotfilename) const {
+  GrammarSnapshotWriter writer;
+  if (!writer.open(snapshotfilename))
+    return false;
+
+  nonterminal_collection_->writeSnapshot(&writer);
+  writer.writeUint64(structures_size_);
+  for (unsigned int i = 0; i < structures_size_; ++i)
+    structures_[i].writeSnapshot(&writer);
+
+  return writer.finish();
+}
+
+
 // Return the total count of strings over all structures
-// Returns the mpz_t type which is a big integer type from the GMP library
-void PCFG::countStrings(mpz_t result) const {
-  mpz_init(result);
+void PCFG::countStrings(BigCount& result) const {
+  result = 0;
 
+  BigCount structure_count;
   for (unsigned int i = 0; i < structures_size_; ++i) {
-    mpz_t structure_count;
     structures_[i].countStrings(structure_count);
-    mpz_add(result, result, structure_count);
-    mpz_clear(structure_count);
+    BigCount::add(result, result, structure_count);
   }
 }
 
@@ -148,11 +239,205 @@ void PCFG::countStrings(mpz_t result) const {
 //
 // Return true on success
 bool PCFG::generatePatterns(const double cutoff) const {
+  TextPatternWriter writer(stdout);
   for (unsigned int i = 0; i < structures_size_; ++i) {
-    if (!structures_[i].generatePatterns(cutoff))
+    if (!structures_[i].generatePatterns(cutoff, &writer))
       return false;
   }
-  return true;
+  return writer.flush();
+}
+
+
+// Generate patterns on a pool of writers.size() threads
+//
+// Most of the work of pattern generation is concentrated in a few very large
+// structures, so handing out whole structures would leave most threads idle
+// at the end.  Large structures are instead split on their first varying
+// nonterminal into ranges of terminal groups [0,1), [1,2), [2,4), [4,8), ...
+// Terminal groups are sorted by descending probability, so the low ranges
+// hold most of the patterns above the cutoff and are kept small, while the
+// long tail of low-probability groups is mostly skipped and can be handed
+// out in big chunks.  Idle threads steal whatever is left.
+//
+// Return true on success
+bool PCFG::generatePatterns(const double cutoff,
+                            const std::vector<PatternWriter*>& writers,
+                            const bool best_first) const {
+  std::atomic<bool> success(true);
+  {
+    WorkStealingPool pool(writers.size());
+    for (unsigned int i = 0; i < structures_size_; ++i) {
+      const Structure* structure = &structures_[i];
+      // Skipping structures below the cutoff here keeps their nonterminals
+      // from being loaded by getSplitRadix
+      if (structure->getProbability() < cutoff)
+        continue;
+      if (best_first) {
+        // Ordered output needs the whole structure in one task
+        pool.submit([structure, cutoff, &writers, &success]
+                    (unsigned int worker) {
+          BigCount no_budget;
+          if (!structure->generateOrderedPatterns(cutoff, no_budget,
+                                                  writers[worker]))
+            success = false;
+        });
+        continue;
+      }
+
+      uint64_t split_radix = structure->getSplitRadix();
+      if (split_radix < 2 ||
+          structure->estimatePatternCount() < kSplitPatternCount) {
+        pool.submit([structure, cutoff, &writers, &success]
+                    (unsigned int worker) {
+          if (!structure->generatePatterns(cutoff, writers[worker]))
+            success = false;
+        });
+        continue;
+      }
+
+      uint64_t split_begin = 0;
+      while (split_begin < split_radix) {
+        uint64_t range_size = (split_begin > 0) ? split_begin : 1;
+        uint64_t split_end = (split_radix - split_begin > range_size) ?
+                             split_begin + range_size : split_radix;
+        pool.submit([structure, cutoff, split_begin, split_end, &writers,
+                     &success](unsigned int worker) {
+          if (!structure->generatePatterns(cutoff, writers[worker],
+                                           split_begin, split_end))
+            success = false;
+        });
+        split_begin = split_end;
+      }
+    }
+    pool.wait();
+  }
+
+  for (unsigned int i = 0; i < writers.size(); ++i) {
+    if (!writers[i]->flush())
+      success = false;
+  }
+  return success;
+}
+
+
+// Global best-first generation
+//
+// Each structure gets an enumerator that yields its patterns in decreasing
+// probability, and a heap over the enumerators (keyed by their current
+// pattern) yields the patterns of the whole grammar in decreasing
+// probability.  Only one pattern per structure is held at a time, plus the
+// enumerators' own frontiers.
+//
+// To produce exactly the table that "LC_ALL=C sort -gr" would, all patterns
+// that share a probability are collected and ordered by descending count and
+// then descending pattern, which is how sort breaks ties on whole lines.
+//
+// Return true on success
+bool PCFG::generateOrderedPatterns(const double cutoff,
+                                   const BigCount& guess_budget,
+                                   PatternWriter* writer) const {
+  struct HeapEntry {
+    double probability;
+    unsigned int structure_index;
+    OrderedPatternEnumerator* enumerator;
+  };
+  // Most probable first, ties in structure order
+  auto heap_entry_less = [](const HeapEntry& a, const HeapEntry& b) {
+    if (a.probability != b.probability)
+      return a.probability < b.probability;
+    return a.structure_index > b.structure_index;
+  };
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>,
+                      decltype(heap_entry_less)> heap(heap_entry_less);
+
+  for (unsigned int i = 0; i < structures_size_; ++i) {
+    // Such a structure has no patterns above the cutoff
+    if (structures_[i].getProbability() < cutoff)
+      continue;
+    OrderedPatternEnumerator* enumerator =
+      structures_[i].newOrderedPatternEnumerator(cutoff);
+    if (enumerator == NULL) {
+      while (!heap.empty()) {
+        delete heap.top().enumerator;
+        heap.pop();
+      }
+      return false;
+    }
+    if (enumerator->next()) {
+      HeapEntry entry = { enumerator->getPatternProbability(), i, enumerator };
+      heap.push(entry);
+    } else {
+      delete enumerator;
+    }
+  }
+
+  // Patterns sharing the current probability
+  struct TiedPattern {
+    std::string count;
+    std::string pattern;
+  };
+  std::vector<TiedPattern> tied_patterns;
+  auto tied_pattern_precedes = [](const TiedPattern& a, const TiedPattern& b) {
+    int count_comparison = a.count.compare(b.count);
+    if (count_comparison != 0)
+      return count_comparison > 0;
+    return a.pattern.compare(b.pattern) > 0;
+  };
+
+  bool success = true;
+  bool has_budget = !guess_budget.isZero();
+  bool budget_reached = false;
+  BigCount strings_written;
+  BigCount count;
+
+  while (success && !budget_reached && !heap.empty()) {
+    // Pop every pattern with the top probability.  An enumerator whose next
+    // pattern has the same probability goes straight back on the heap and is
+    // popped again in this loop.
+    double probability = heap.top().probability;
+    tied_patterns.clear();
+    while (!heap.empty() && heap.top().probability == probability) {
+      HeapEntry entry = heap.top();
+      heap.pop();
+
+      entry.enumerator->countStrings(count);
+      TiedPattern tied_pattern;
+      tied_pattern.count = count.toString();
+      tied_pattern.pattern = entry.enumerator->getFirstStringOfPattern();
+      tied_patterns.push_back(tied_pattern);
+
+      if (entry.enumerator->next()) {
+        entry.probability = entry.enumerator->getPatternProbability();
+        heap.push(entry);
+      } else {
+        delete entry.enumerator;
+      }
+    }
+
+    std::sort(tied_patterns.begin(), tied_patterns.end(),
+              tied_pattern_precedes);
+    for (unsigned int i = 0; i < tied_patterns.size(); ++i) {
+      BigCount::setString(count, tied_patterns[i].count.c_str());
+      if (!writer->writePattern(probability, count,
+                                tied_patterns[i].pattern)) {
+        fprintf(stderr,
+                "Error writing pattern in PCFG::generateOrderedPatterns!\n");
+        success = false;
+        break;
+      }
+      BigCount::add(strings_written, strings_written, count);
+      if (has_budget && BigCount::cmp(strings_written, guess_budget) >= 0) {
+        budget_reached = true;
+        break;
+      }
+    }
+  }
+
+  while (!heap.empty()) {
+    delete heap.top().enumerator;
+    heap.pop();
+  }
+  return success && writer->flush();
 }
 
 
@@ -163,37 +448,115 @@ bool PCFG::generatePatterns(const double cutoff) const {
 // probability.  We need to send that method an appropriate object that it
 // can make calls on.
 //
+// Such a lookup only consults the structures listed under the string's
+// signature in structure_index_, and the string is only output by the most
+// probable of them, so the structures of one signature never depend on any
+// others.  On several threads, each signature's structures are generated
+// together by one task, writing to its worker's TextStringWriter.  Without
+// accurate probabilities, every structure is a task of its own.
+//
 // Return true on success
 bool PCFG::generateStrings(const double cutoff,
-                           const bool accurate_probabilities) const {
-  for (unsigned int i = 0; i < structures_size_; ++i) {
-    if (accurate_probabilities) {
-      if (!structures_[i].generateStrings(cutoff,
-                                          true,
-                                          this))
+                           const bool accurate_probabilities,
+                           const unsigned int num_threads) const {
+  const PCFG* parent = accurate_probabilities ? this : NULL;
+  if (num_threads <= 1) {
+    TextStringWriter writer(stdout);
+    for (unsigned int i = 0; i < structures_size_; ++i) {
+      if (!structures_[i].generateStrings(cutoff, &writer,
+                                          accurate_probabilities, parent))
         return false;
+    }
+    return writer.flush();
+  }
+
+  // Each thread buffers its own output and writes whole blocks of lines to
+  // stdout under a shared lock
+  std::mutex stdout_mutex;
+  std::vector<TextStringWriter*> writers;
+  for (unsigned int i = 0; i < num_threads; ++i)
+    writers.push_back(new TextStringWriter(stdout, &stdout_mutex));
+
+  std::atomic<bool> success(true);
+  {
+    WorkStealingPool pool(num_threads);
+    auto generate = [this, cutoff, accurate_probabilities, parent, &writers,
+                     &success](const std::vector<unsigned int>& group,
+                               unsigned int worker) {
+      for (unsigned int i = 0; i < group.size() && success; ++i) {
+        if (!structures_[group[i]].generateStrings(cutoff, writers[worker],
+                                                   accurate_probabilities,
+                                                   parent))
+          success = false;
+      }
+    };
+    if (accurate_probabilities) {
+      for (auto it = structure_index_.begin(); it != structure_index_.end();
+           ++it) {
+        const std::vector<unsigned int>* group = &it->second;
+        pool.submit([&generate, group](unsigned int worker) {
+          generate(*group, worker);
+        });
+      }
     } else {
-      if (!structures_[i].generateStrings(cutoff))
-        return false;
+      for (unsigned int i = 0; i < structures_size_; ++i) {
+        // Skipping structures below the cutoff here saves a task for each
+        if (structures_[i].getProbability() < cutoff)
+          continue;
+        pool.submit([&generate, i](unsigned int worker) {
+          generate(std::vector<unsigned int>(1, i), worker);
+        });
+      }
     }
+    pool.wait();
   }
-  return true;
+
+  for (unsigned int i = 0; i < writers.size(); ++i) {
+    if (!writers[i]->flush())
+      success = false;
+    delete writers[i];
+  }
+  return success;
 }
 
 
 // Given a string, count up the ways it can be parsed over all structures
+// Look up the structures that share the character-class signature of the
+// input string.  Every other structure would reject the string with
+// kStructureNotFound, which never changes the result of lookup, lookupSum, or
+// countParses, so they can be skipped.
+const std::vector<unsigned int>* PCFG::findCandidateStructures(
+    const std::string& inputstring) const {
+  std::string signature;
+  if (inputstring.find('\x01') == std::string::npos)
+    signature = Structure::convertStringToStructureRepresentation(inputstring);
+  else
+    signature = Structure::convertStringToStructureRepresentation(
+      grammartools::StripBreakCharacterFromTerminal(inputstring));
+  auto it = structure_index_.find(signature);
+  if (it == structure_index_.end())
+    return NULL;
+  return &it->second;
+}
+
+
 uint64_t PCFG::countParses(const std::string& inputstring) const {
   uint64_t numparses = 0;
 
-  for (unsigned int i = 0; i < structures_size_; ++i) {
-    numparses += structures_[i].countParses(inputstring);
+  const std::vector<unsigned int>* candidates =
+    findCandidateStructures(inputstring);
+  if (candidates == NULL)
+    return numparses;
+  for (unsigned int i = 0; i < candidates->size(); ++i) {
+    numparses += structures_[(*candidates)[i]].countParses(inputstring);
   }
 
   return numparses;
 }
 
 
-// Lookup the given inputstring for each structure, and then "reduce" the
+// Lookup the given inputstring for each candidate structure (see
+// findCandidateStructures), and then "reduce" the
 // returned LookupData structs to the one with lowest probability.
 //
 // Since there might be hundreds of thousands of structures, keep the best
@@ -202,61 +565,72 @@ uint64_t PCFG::countParses(const std::string& inputstring) const {
 // 2. highest probability if parseable
 // 3. highest parse_status code if not parseable
 //
-LookupData* PCFG::lookup(const std::string& inputstring) const {
-  LookupData *overall_lookup_data = new LookupData;
-
+// Each structure is looked up into a single candidate LookupData, which is
+// swapped with lookup_data when it is better, so no LookupData is allocated
+// per structure.  Source ids are only added for the best structure.
+//
+// Candidate structures often share nonterminals at the same positions, so
+// when there are several, their terminal lookups go through one
+// NonterminalLookupMemo and each distinct terminal is looked up only once.
+//
+void PCFG::lookup(const std::string& inputstring,
+                  LookupData *lookup_data) const {
   // Pick a "low" initial value
-  overall_lookup_data->parse_status = kStructureNotFound;
-  // this initializes value to 0
-  mpz_init(overall_lookup_data->index);
-  overall_lookup_data->probability = -1;
+  lookup_data->clear();
+  lookup_data->parse_status = kStructureNotFound;
   bool overallCanParse = false;  // Is the current best parseable?
-
-  for (unsigned int i = 0; i < structures_size_; ++i) {
-    LookupData *structure_lookup = structures_[i].lookup(inputstring);
+  const Structure *best_structure = NULL;
+
+  LookupData structure_lookup;
+  const std::vector<unsigned int>* candidates =
+    findCandidateStructures(inputstring);
+  unsigned int candidates_size =
+    (candidates == NULL) ? 0 : static_cast<unsigned int>(candidates->size());
+  // A single structure never repeats a lookup, so it skips the memo
+  NonterminalLookupMemo shared_memo;
+  NonterminalLookupMemo *memo = (candidates_size > 1) ? &shared_memo : NULL;
+  for (unsigned int i = 0; i < candidates_size; ++i) {
+    const Structure& structure = structures_[(*candidates)[i]];
+    structure.lookup(inputstring, &structure_lookup, memo);
 
     // Implement three conditions that can make this structure better than the
     // current best structure.
-    bool structureCanParse = structure_lookup->parse_status & kCanParse;
+    bool structureCanParse = structure_lookup.parse_status & kCanParse;
     if ( (!overallCanParse && structureCanParse)  ||
 
          (overallCanParse && structureCanParse &&
-          (overall_lookup_data->probability < structure_lookup->probability)) ||
+          (lookup_data->probability < structure_lookup.probability)) ||
 
          (!overallCanParse &&
-          (static_cast<int>(overall_lookup_data->parse_status) <
-           static_cast<int>(structure_lookup->parse_status))) ) {
-      // Cleanup current best and make this structure the new best
-      mpz_clear(overall_lookup_data->index);
-      delete overall_lookup_data;
-      overall_lookup_data = structure_lookup;
+          (static_cast<int>(lookup_data->parse_status) <
+           static_cast<int>(structure_lookup.parse_status))) ) {
+      // Make this structure the new best
+      std::swap(*lookup_data, structure_lookup);
       overallCanParse = structureCanParse;
-    } else {
-      // Clear up this structure's lookup data and don't update current data
-      mpz_clear(structure_lookup->index);
-      delete structure_lookup;
+      best_structure = &structure;
     }
   }
 
-  return overall_lookup_data;
+  if (overallCanParse)
+    best_structure->addSourceIDs(inputstring, &lookup_data->source_ids);
 }
 
 
 
-// Lookup the given inputstring for each structure, and then "reduce" the
+// Lookup the given inputstring for each candidate structure (see
+// findCandidateStructures), and then "reduce" the
 // returned LookupData structs to one where all string probabilities from
 // matching structures are added together.
 //
-// The general structure of this function is very similar to lookup().
+// The general structure of this function is very similar to lookup(), but
+// source ids are not filled in.  Terminal lookups are shared through a
+// NonterminalLookupMemo in the same way.
 //
-LookupData* PCFG::lookupSum(const std::string& inputstring) const {
-  LookupData *overall_lookup_data = new LookupData;
-
+void PCFG::lookupSum(const std::string& inputstring,
+                     LookupData *lookup_data) const {
   // Pick a "low" initial value
-  overall_lookup_data->parse_status = kStructureNotFound;
-  // this initializes value to 0
-  mpz_init(overall_lookup_data->index);
-  overall_lookup_data->probability = -1;
+  lookup_data->clear();
+  lookup_data->parse_status = kStructureNotFound;
   bool overallCanParse = false;  // Is the current best parseable?
 
   // Store the accumulated probability -- we want the returned structure
@@ -266,39 +640,41 @@ LookupData* PCFG::lookupSum(const std::string& inputstring) const {
   // once) but we return an accurate probability.
   double total_probability = 0;
 
-  for (unsigned int i = 0; i < structures_size_; ++i) {
-    LookupData *structure_lookup = structures_[i].lookup(inputstring);
+  LookupData structure_lookup;
+  const std::vector<unsigned int>* candidates =
+    findCandidateStructures(inputstring);
+  unsigned int candidates_size =
+    (candidates == NULL) ? 0 : static_cast<unsigned int>(candidates->size());
+  // A single structure never repeats a lookup, so it skips the memo
+  NonterminalLookupMemo shared_memo;
+  NonterminalLookupMemo *memo = (candidates_size > 1) ? &shared_memo : NULL;
+  for (unsigned int i = 0; i < candidates_size; ++i) {
+    structures_[(*candidates)[i]].lookup(inputstring, &structure_lookup,
+                                         memo);
 
     // If the structure could parse this string, add the probability
     // of the string under this structure.
-    if (structure_lookup->parse_status & kCanParse) {
-      total_probability += structure_lookup->probability;
+    if (structure_lookup.parse_status & kCanParse) {
+      total_probability += structure_lookup.probability;
     }
 
     // Implement three conditions that can make this structure better than the
     // current best structure.
-    bool structureCanParse = structure_lookup->parse_status & kCanParse;
+    bool structureCanParse = structure_lookup.parse_status & kCanParse;
     if ( (!overallCanParse && structureCanParse)  ||
 
          (overallCanParse && structureCanParse &&
-          (overall_lookup_data->probability < structure_lookup->probability)) ||
+          (lookup_data->probability < structure_lookup.probability)) ||
 
          (!overallCanParse &&
-          (static_cast<int>(overall_lookup_data->parse_status) <
-           static_cast<int>(structure_lookup->parse_status))) ) {
-      mpz_clear(overall_lookup_data->index);
-      delete overall_lookup_data;
-      overall_lookup_data = structure_lookup;
+          (static_cast<int>(lookup_data->parse_status) <
+           static_cast<int>(structure_lookup.parse_status))) ) {
+      std::swap(*lookup_data, structure_lookup);
       overallCanParse = structureCanParse;
-    } else {
-      // Clear up this structure's lookup data and don't update current data
-      mpz_clear(structure_lookup->index);
-      delete structure_lookup;
     }
   }
 
   // Before returning, fix the probability value
-  overall_lookup_data->probability = total_probability;
-  return overall_lookup_data;
+  lookup_data->probability = total_probability;
 }
 
@@ -40,11 +40,16 @@
 #include <gmp.h>
 #include <string>
 #include <cstdint>
+#include <unordered_map>
+#include <vector>
 
+#include "big_count.h"
 #include "gcfmacros.h"
+#include "grammar_snapshot.h"
 #include "structure.h"
 #include "nonterminal_collection.h"
 #include "lookup_data.h"
+#include "pattern_writer.h"
 
 // Forward declare class because we have circular includes
 class Structure;
@@ -58,11 +63,14 @@ class PCFG {
   PCFG():
     structures_(NULL),
     structures_size_(0),
-    nonterminal_collection_(NULL) {}
+    nonterminal_collection_(NULL),
+    snapshot_reader_(NULL) {}
   ~PCFG();
 
   // Load the grammar from disk and initialize structures objects
   // This should be called before doing anything else with the PCFG object.
+  // structuresfilename may also be a grammar snapshot written by
+  // writeSnapshot, which loads much faster (see grammar_snapshot.h).
   //
   // Returns true on success, and dies on failure
   bool loadGrammar(
@@ -70,18 +78,42 @@ class PCFG {
     // The following folder name must end in "/"
     const std::string& terminals_folder
     );
+  // Write the loaded grammar to a snapshot file.  Return false on failure.
+  bool writeSnapshot(const std::string& snapshotfilename) const;
 
-  // By convention, mpz_t types are not returned, but are passed by reference
-  // See http://stackoverflow.com/a/13396028
-  void countStrings(mpz_t result) const;
+  void countStrings(BigCount& result) const;
+  // Print patterns to stdout from a single thread
   bool generatePatterns(const double cutoff) const;
-  bool generateStrings(const double cutoff, 
-                       const bool accurate_probabilities = false) const;
-
-  // Run lookups for each structure in the grammar and return a LookupData
-  // struct with the "best" lookup (highest probability / summed probabilities)
-  LookupData* lookup(const std::string& inputstring) const;
-  LookupData* lookupSum(const std::string& inputstring) const;
+  // Generate patterns using one worker thread per writer.  Each thread writes
+  // only to its own writer, so writers need not be thread-safe.  Output order
+  // is not deterministic.  If best_first is true, each structure's patterns
+  // are written in order of decreasing probability (see
+  // Structure::generateOrderedPatterns) and structures are not split.
+  bool generatePatterns(const double cutoff,
+                        const std::vector<PatternWriter*>& writers,
+                        const bool best_first = false) const;
+  // Write the patterns of all structures to writer in order of decreasing
+  // probability, by merging the OrderedPatternEnumerators of every structure.
+  // Stops at the cutoff or once the patterns written cover at least
+  // guess_budget strings, whichever comes first (a budget of zero means no
+  // limit).  Runs on the calling thread.
+  bool generateOrderedPatterns(const double cutoff,
+                               const BigCount& guess_budget,
+                               PatternWriter* writer) const;
+  // Print strings to stdout.  With more than one thread, strings are output
+  // in no particular order.  Accurate probabilities (see
+  // Structure::generateStrings) only involve structures with the same
+  // signature, so each group of such structures is an independent task.
+  bool generateStrings(const double cutoff,
+                       const bool accurate_probabilities = false,
+                       const unsigned int num_threads = 1) const;
+
+  // Run lookups for each structure in the grammar and fill in lookup_data
+  // with the "best" lookup (highest probability / summed probabilities).
+  // lookupSum does not fill in source ids.
+  void lookup(const std::string& inputstring, LookupData *lookup_data) const;
+  void lookupSum(const std::string& inputstring,
+                 LookupData *lookup_data) const;
   uint64_t countParses(const std::string& inputstring) const;
 
 
@@ -89,6 +121,9 @@ class PCFG {
  private:
   // Implementation limits
   static const unsigned int kMaxStructureLength = 40;
+  // When generating patterns in parallel, structures with more patterns than
+  // this are split into several tasks
+  static constexpr double kSplitPatternCount = 65536.0;
 
   // Structures are the top-level productions of the grammar.  They are
   // nonterminal strings produced directly from the start symbol. In this
@@ -106,6 +141,25 @@ class PCFG {
   // to all structures so they can pull objects from a common collection.
   NonterminalCollection* nonterminal_collection_;
 
+  // The grammar snapshot the grammar was loaded from, if any.  Nonterminals
+  // read their terminal groups from it on first use, so it stays mapped for
+  // as long as they do.
+  GrammarSnapshotReader* snapshot_reader_;
+
+  // Index from structure signature (see Structure::getSignature) to the
+  // indices of all structures with that signature, in grammar order.  Lookups
+  // only need to consider the structures listed under the signature of the
+  // input string.  Built in loadGrammar.
+  std::unordered_map<std::string, std::vector<unsigned int> > structure_index_;
+
+  // Helpers for loadGrammar
+  bool loadSnapshot(const std::string& snapshotfilename,
+                    const std::string& terminals_folder);
+  void buildStructureIndex();
+
+  // Return the structures that could parse inputstring, or NULL if none can
+  const std::vector<unsigned int>* findCandidateStructures(
+      const std::string& inputstring) const;
 
   // Disable copy and assignment
   DISALLOW_COPY_AND_ASSIGN(PCFG);
@@ -16,8 +16,7 @@
 // Includes not covered in header file
 #include <cstdlib>
 #include <cctype>  // for toupper
-#include <string.h> // strncpy
-#include <assert.h>
+#include <string.h> // strncmp
 
 #include "big_count.h"
 #include "grammar_tools.h"
@@ -25,46 +24,49 @@
 #include "seen_terminal_group.h"
 
 // Initialize the "first" string of the terminal and set out_matching_needed_
+//
+// Only the first line is parsed, so that creating a group does not build the
+// line table
 void SeenTerminalGroup::loadFirstString() {
-  if (mpz_cmp_ui(terminals_size_, 0) < 1) {
+  if (terminals_size_.isZero()) {
     fprintf(stderr, "terminals_size_ is 0 in SeenTerminalGroup::loadFirstString!"
                     " out_representation_: %s\n", out_representation_.c_str());
     exit(EXIT_FAILURE);
   }
 
-  unsigned int bytes_read;
-  if (!grammartools::ReadLineFromCharArray2(group_data_start_,
-                                           bytes_read)) {
+  const char *data_end = terminal_file_->data() + terminal_file_->size();
+  const char *newline = static_cast<const char *>(
+    memchr(group_data_start_, '\n', data_end - group_data_start_));
+  if (newline == NULL) {
     fprintf(stderr, "Failed read in SeenTerminalGroup::loadFirstString!\n");
     exit(EXIT_FAILURE);
-  }    
+  }
 
-  const char *terminal, *source_ids;
-  double probability;
-  if (!grammartools::ParseNonterminalLine(group_data_start_, bytes_read, &terminal,
-                                          probability, &source_ids)) {
+  grammartools::TerminalLine line;
+  if (!grammartools::ParseNonterminalLine(group_data_start_,
+                                          newline + 1 - group_data_start_,
+                                          &line)) {
     fprintf(stderr,
       "Line could not be parsed in SeenTerminalGroup::loadFirstString!\n");
     exit(EXIT_FAILURE);
-  }    
+  }
 
   // terminal is the first string in the terminal data, modify it to match
   // the out_representation_
   //
   // Check for a size mismatch -- we only check this here, in loadFirstString
   // and assume that this function will work for all other modifications
-  if (strlen(terminal) != out_representation_.size()) {
+  std::string terminalstr(line.terminal, line.terminal_length);
+  if (terminalstr.size() != out_representation_.size()) {
     fprintf(stderr,
       "out_representation could not be matched in "
       "SeenTerminalGroup::loadFirstString!\n"
       "out_representation_: %s\nterminal: %s\n",
-      out_representation_.c_str(), terminal);
-    exit(EXIT_FAILURE);    
+      out_representation_.c_str(), terminalstr.c_str());
+    exit(EXIT_FAILURE);
   }
 
   // Check if modifications are needed and record
-  std::string terminalstr(terminal);
-
   if (out_representation_.find('U') != std::string::npos) {
     out_matching_needed_ = true;
     matchOutRepresentation(terminalstr);
@@ -76,6 +78,57 @@ void SeenTerminalGroup::loadFirstString() {
 }
 
 
+// Once the table is built this is an atomic read and two comparisons.  The
+// checks catch a snapshot record that does not match the terminals file.
+void SeenTerminalGroup::loadLines() const {
+  if (!terminal_file_->parseLines() ||
+      first_line_ + lines_size_ > terminal_file_->seenLinesSize() ||
+      terminal_file_->line(first_line_).terminal != group_data_start_) {
+    fprintf(stderr,
+      "Terminal group does not match its terminals file in "
+      "SeenTerminalGroup::loadLines! out_representation_: %s\n",
+      out_representation_.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+// A snapshot record holds the constructor arguments that are not shared with
+// the nonterminal: probability, number of terminals, the first line of the
+// group in the line table, and its offset in the terminal data
+void SeenTerminalGroup::writeSnapshot(GrammarSnapshotWriter *writer) const {
+  writer->writeDouble(probability_);
+  writer->writeUint64(lines_size_);
+  writer->writeUint64(first_line_);
+  writer->writeUint64(group_data_start_ - terminal_data_);
+}
+
+
+SeenTerminalGroup* SeenTerminalGroup::readSnapshot(
+    GrammarSnapshotReader *reader,
+    const TerminalFile *terminal_file,
+    const std::string& out_representation) {
+  double probability;
+  uint64_t terminals_size, first_line, group_offset;
+  if (!reader->readDouble(&probability) ||
+      !reader->readUint64(&terminals_size) ||
+      !reader->readUint64(&first_line) ||
+      !reader->readUint64(&group_offset) ||
+      terminals_size == 0 ||
+      group_offset >= terminal_file->size()) {
+    return NULL;
+  }
+  return new SeenTerminalGroup(terminal_file, probability, terminals_size,
+                               out_representation, first_line,
+                               terminal_file->data() + group_offset);
+}
+
+
+bool SeenTerminalGroup::skipSnapshot(GrammarSnapshotReader *reader) {
+  const void *record;
+  return reader->readBytes(&record, sizeof(double) + 3 * sizeof(uint64_t));
+}
+
 
 // Simple getter function for first string
 const std::string& SeenTerminalGroup::getFirstString() const {
@@ -83,100 +136,76 @@ const std::string& SeenTerminalGroup::getFirstString() const {
 }
 
 
-// Return a LookupData struct with relevant fields set for the given terminal
+// Fill in lookup_data with relevant fields set for the given terminal
 //
-// Set lookup_data->index to -1 if no match, to match expected output of
-// indexInTerminalGroup, which calls this function to perform the lookup.
+// If there is no match, parse_status says so and the index is not set.
+// indexInTerminalGroup calls this function to perform the lookup.
 //
-// NOTE: This function assumes that terminals_size_ is accurate so we can
-// iterate up to terminals_size_ entries from the start of the group
-// (terminal_data_) without anything horrible happening.  Otherwise, we should
-// check the return values from ReadLineFromCharArray and ParseNonterminalLine
-// to make sure they work correctly.
+// Nonterminal::lookup finds seen terminals through a SeenTerminalIndex and
+// calls lookupLine directly, so this linear scan is only used when a single
+// group is queried.
 //
-// Die on failure to parse source_ids
-//
-LookupData* SeenTerminalGroup::lookup(const char *terminal) const {
-  // just for debug output
-  char space[1024];
-  char *read_buffer = space;
-
-  LookupData *lookup_data = new LookupData;
-
-  mpz_init(lookup_data->index);
-  unsigned long int index = 0;
-  unsigned long int terminalsSize = mpz_get_ui(terminals_size_);
-  const char* current_data_position = group_data_start_;
-  size_t bytes_remaining = group_data_size_;
+void SeenTerminalGroup::lookup(const char *terminal,
+                               TerminalLookupData *lookup_data) const {
+  loadLines();
+  size_t len = strlen(terminal);
 
   // Iterate over the group, looking for the input string
-  while(index < terminalsSize) {
-    unsigned int bytes_read;
-    grammartools::ReadLineFromCharArray2(current_data_position,
-                                        bytes_read);
-    // Parse the line
-    const char *read_terminal, *source_ids;
-    double probability;
-    // just for debug output
-    assert(bytes_read + 1 <= 1024);
-    strncpy(read_buffer, current_data_position, bytes_read);
-    read_buffer[bytes_read] = 0;
-
-    grammartools::ParseNonterminalLine(current_data_position, bytes_read, &read_terminal,
-                                       probability, &source_ids);
-
-    auto len = strlen(terminal);
-    if ((len == strlen(read_terminal)) && (strncmp(terminal, read_terminal, len) == 0)) {
-      lookup_data->parse_status = kCanParse;
-      if (probability_ != probability) {
-        fprintf(stderr,
-          "Probability of terminal group doesn't match in line %s in "
-          "SeenTerminalGroup::lookup (should be %f, found %f)!\n",
-          read_buffer, probability_, probability);
-        exit(EXIT_FAILURE);
-      }
-      lookup_data->probability = probability_;
-      // index is already set correctly
-      if (!grammartools::AddSourceIDsFromString(source_ids, 
-                                                lookup_data->source_ids)) {
-        fprintf(stderr,
-          "Could not parse source ids %s in line %s in "
-          "SeenTerminalGroup::lookup!\n",
-          source_ids, read_buffer);
-        exit(EXIT_FAILURE);
-      }
-      mpz_set_ui(lookup_data->index, index);
-      return lookup_data;
+  for (uint64_t i = first_line_; i < first_line_ + lines_size_; ++i) {
+    const grammartools::TerminalLine& line = terminal_file_->line(i);
+    if (len == line.terminal_length &&
+        strncmp(terminal, line.terminal, len) == 0) {
+      lookupLine(i, lookup_data);
+      return;
     }
-
-    // Increment counters
-    index++;
-    current_data_position += bytes_read;
-    bytes_remaining -= bytes_read;
   }
 
   // If we are here, then terminal was not found
   lookup_data->parse_status = kTerminalNotFound;
   lookup_data->probability = -1;
-  mpz_set_si(lookup_data->index, -1);
-  return lookup_data;
 }
 
 
+// Fill in lookup_data for the terminal on the given line of the line table,
+// which must be in this group
+//
+// The source ids are left unparsed (see TerminalLookupData)
+//
+void SeenTerminalGroup::lookupLine(const uint64_t line_index,
+                                   TerminalLookupData *lookup_data) const {
+  loadLines();
+  const grammartools::TerminalLine& line = terminal_file_->line(line_index);
 
-// Return the "index" of the given string in the terminal group (-1 if no match)
+  lookup_data->parse_status = kCanParse;
+  if (probability_ != line.probability) {
+    fprintf(stderr,
+      "Probability of terminal group doesn't match in line %.*s in "
+      "SeenTerminalGroup::lookup (should be %f, found %f)!\n",
+      static_cast<int>(line.length), line.terminal, probability_,
+      line.probability);
+    exit(EXIT_FAILURE);
+  }
+  lookup_data->probability = probability_;
+  lookup_data->source_ids = line.source_ids;
+  lookup_data->source_ids_length = line.source_ids_length;
+  lookup_data->index = line_index - first_line_;
+}
+
+
+
+// Set result to the "index" of the given string in the terminal group
+// (return false if no match)
 //
 // This function simply calls lookup, and then returns just the index
 //
-void SeenTerminalGroup::indexInTerminalGroup(mpz_t result, 
+bool SeenTerminalGroup::indexInTerminalGroup(BigCount& result,
                                              const char *teststring) const {
-  LookupData *lookup_data = lookup(teststring);
-  mpz_init(result);
-  mpz_set(result, lookup_data->index);
-
-  // Cleanup
-  mpz_clear(lookup_data->index);
-  delete lookup_data;
+  TerminalLookupData lookup_data;
+  lookup(teststring, &lookup_data);
+  if (!(lookup_data.parse_status & kCanParse))
+    return false;
+  result = lookup_data.index;
+  return true;
 }
 
 
@@ -193,8 +222,8 @@ SeenTerminalGroup::SeenTerminalGroupStringIterator*
 SeenTerminalGroup::SeenTerminalGroupStringIterator::
     SeenTerminalGroupStringIterator(const SeenTerminalGroup* const parent)
     : parent_(parent),
-      current_group_position_(parent->group_data_start_),
-      bytes_remaining_(parent->group_data_size_) {
+      next_line_(parent->first_line_) {
+  parent_->loadLines();
   // Use increment to read the first line and position the iterator counter
   // past the first entry
   increment();
@@ -207,8 +236,7 @@ SeenTerminalGroup::SeenTerminalGroupStringIterator::
 // Set the iterator back to the beginning
 void SeenTerminalGroup::SeenTerminalGroupStringIterator::
     restart() {
-  current_group_position_ = parent_->group_data_start_;
-  bytes_remaining_ = parent_->group_data_size_;
+  next_line_ = parent_->first_line_;
   increment();
 }
 
@@ -217,28 +245,14 @@ void SeenTerminalGroup::SeenTerminalGroupStringIterator::
 bool SeenTerminalGroup::SeenTerminalGroupStringIterator::
     increment() {
   if (!isEnd()) {
-    unsigned int bytes_read;
-    grammartools::ReadLineFromCharArray2(current_group_position_,
-                                        bytes_read);
-    // Parse the line
-    const char *terminal, *source_ids;
-    double probability;
-    grammartools::ParseNonterminalLine(current_group_position_, bytes_read, &terminal,
-                                       probability, &source_ids);
-    // Adjust class variables
-    current_group_position_ += bytes_read;
-    // Adjust bytes_remaining_ but make sure we don't overflow the unsigned in
-    if (bytes_read <= bytes_remaining_)
-      bytes_remaining_ -= bytes_read;
-    else
-      bytes_remaining_ = 0;
-
-    std::string terminalstr(terminal);
+    const grammartools::TerminalLine& line =
+      parent_->terminal_file_->line(next_line_);
+    ++next_line_;
+
+    current_string_.assign(line.terminal, line.terminal_length);
     // Uppercase the terminal in the correct positions, if needed
     if (parent_->out_matching_needed_)
-      parent_->matchOutRepresentation(terminalstr);
-
-    current_string_ = terminalstr.c_str();
+      parent_->matchOutRepresentation(current_string_);
     return true;
   }
   return false;
@@ -247,7 +261,7 @@ bool SeenTerminalGroup::SeenTerminalGroupStringIterator::
 // Simple check
 bool SeenTerminalGroup::SeenTerminalGroupStringIterator::
     isEnd() const {
-  return (bytes_remaining_ == 0);
+  return (next_line_ == parent_->first_line_ + parent_->lines_size_);
 }
 
 
@@ -16,41 +16,59 @@
 //   TerminalGroup abstract class.  It uses a memory-mapped file as a data
 //   source but it's operations should be restricted to a single section
 //   of the file pertaining to this particular group.
+//
+// The group is a run of lines of its TerminalFile's line table, starting at
+//   first_line.  Only the first line is parsed when the group is created, so
+//   groups read from a grammar snapshot do not parse the file; the table is
+//   built on the first lookup or iteration.
 
 #ifndef SEEN_TERMINAL_GROUP_H__
 #define SEEN_TERMINAL_GROUP_H__
 
 #include <string>
-#include <gmp.h>
-
+#include <cstdint>
+#include "grammar_snapshot.h"
+#include "terminal_file.h"
 #include "terminal_group.h"
 
 class SeenTerminalGroup : public TerminalGroup {
 public:
-  SeenTerminalGroup(const char *const terminal_data, 
+  SeenTerminalGroup(const TerminalFile *terminal_file,
                     const double probability,
-                    const mpz_t terminals_size,
+                    const uint64_t terminals_size,
                     const std::string& out_representation,
-                    const char *const group_data_start,
-                    const size_t group_data_size)
-      : TerminalGroup(terminal_data,
+                    const uint64_t first_line,
+                    const char *const group_data_start)
+      : TerminalGroup(terminal_file->data(),
                       probability,
                       out_representation),
-        group_data_start_(group_data_start),
-        group_data_size_(group_data_size) {
-    mpz_init_set(terminals_size_, terminals_size);
+        terminal_file_(terminal_file),
+        first_line_(first_line),
+        lines_size_(terminals_size),
+        group_data_start_(group_data_start) {
+    terminals_size_ = terminals_size;
     loadFirstString();
   }
-  // Destructor
-  ~SeenTerminalGroup() {
-    mpz_clear(terminals_size_);
-  };
 
-  // Return a LookupData struct with relevant fields set for the given terminal
-  LookupData* lookup(const char *terminal) const;
+  // Write this group to a grammar snapshot, or create a group from its
+  // snapshot record.  readSnapshot returns NULL if the record is truncated or
+  // does not fit in the terminal data.  skipSnapshot moves past a record
+  // without creating the group, and returns false if it is truncated.
+  void writeSnapshot(GrammarSnapshotWriter *writer) const;
+  static SeenTerminalGroup* readSnapshot(GrammarSnapshotReader *reader,
+                                         const TerminalFile *terminal_file,
+                                         const std::string& out_representation);
+  static bool skipSnapshot(GrammarSnapshotReader *reader);
+
+  // Fill in lookup_data with relevant fields set for the given terminal
+  void lookup(const char *terminal, TerminalLookupData *lookup_data) const;
+  // Same result as lookup, for a terminal already known to be on the given
+  // line of the line table (see SeenTerminalIndex)
+  void lookupLine(const uint64_t line, TerminalLookupData *lookup_data) const;
 
-  // Return the "index" of the given string in the terminal group (-1 if no match)
-  void indexInTerminalGroup(mpz_t result, const char *teststring) const;
+  // Set result to the "index" of the given string in the terminal group
+  // (return false if no match)
+  bool indexInTerminalGroup(BigCount& result, const char *teststring) const;
 
   // Return the "first" string of the terminal (used for string representation)
   const std::string& getFirstString() const;
@@ -67,9 +85,8 @@ public:
 
   private:
     const SeenTerminalGroup* const parent_;
-    const char* current_group_position_;
-    size_t group_data_size_;
-    size_t bytes_remaining_;
+    // The line table line that increment reads next
+    uint64_t next_line_;
     std::string current_string_;
   };
 
@@ -78,9 +95,15 @@ public:
 private:
   // Read from the terminal_data to set the first string
   void loadFirstString();
+  // Build the line table of terminal_file_ and check that this group is in
+  // its seen section, dying if not
+  void loadLines() const;
 
+  const TerminalFile *const terminal_file_;
+  const uint64_t first_line_;
+  const uint64_t lines_size_;
+  // The first line in the terminal data
   const char *const group_data_start_;
-  const size_t group_data_size_;
   bool out_matching_needed_;
 };
 
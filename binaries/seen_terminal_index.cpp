@@ -0,0 +1,81 @@
+// seen_terminal_index.cpp - a hash index over the seen terminals of a
+//   terminals file
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <cstring>
+
+#include "grammar_tools.h"
+
+#include "seen_terminal_index.h"
+
+// FNV-1a over the terminal bytes
+size_t SeenTerminalIndex::KeyHash::operator()(const Key& key) const {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < key.length; ++i) {
+    hash ^= static_cast<unsigned char>(key.terminal[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return static_cast<size_t>(hash);
+}
+
+
+bool SeenTerminalIndex::KeyEqual::operator()(const Key& a,
+                                             const Key& b) const {
+  return a.length == b.length &&
+         memcmp(a.terminal, b.terminal, a.length) == 0;
+}
+
+
+bool SeenTerminalIndex::build(const TerminalFile& terminal_file) {
+  if (built_.load(std::memory_order_acquire))
+    return build_succeeded_;
+  std::lock_guard<std::mutex> lock(build_mutex_);
+  if (!built_.load(std::memory_order_relaxed)) {
+    build_succeeded_ = indexTerminals(terminal_file);
+    built_.store(true, std::memory_order_release);
+  }
+  return build_succeeded_;
+}
+
+
+// Make one pass over the seen section of the line table, tracking group
+// boundaries by changes in probability
+bool SeenTerminalIndex::indexTerminals(const TerminalFile& terminal_file) {
+  if (!terminal_file.parseLines())
+    return false;
+
+  // Reserve first so the map never rehashes
+  uint64_t lines_size = terminal_file.seenLinesSize();
+  locations_.reserve(lines_size);
+
+  uint64_t group_index = 0;
+  for (uint64_t i = 0; i < lines_size; ++i) {
+    const grammartools::TerminalLine& line = terminal_file.line(i);
+    if (i > 0 && line.probability != terminal_file.line(i - 1).probability)
+      ++group_index;
+
+    Key key = { line.terminal, line.terminal_length };
+    Location location = { group_index, i };
+    // insert keeps the first occurrence of a duplicated terminal
+    locations_.insert(std::make_pair(key, location));
+  }
+
+  return true;
+}
+
+
+const SeenTerminalIndex::Location* SeenTerminalIndex::find(
+    const char *terminal, size_t length) const {
+  Key key = { terminal, length };
+  auto it = locations_.find(key);
+  if (it == locations_.end())
+    return NULL;
+  return &it->second;
+}
@@ -0,0 +1,89 @@
+// seen_terminal_index.h - a hash index over the seen terminals of a
+//   terminals file
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// SeenTerminalGroup::lookup scans its group line by line, and
+// Nonterminal::lookup tries every group in turn, so looking up a terminal
+// was linear in the size of the terminals file.  For nonterminals built on
+// dictionaries with millions of words this dominated lookup time.
+//
+// A SeenTerminalIndex maps each seen terminal to its location: the index of
+// its seen terminal group and its line in the TerminalFile's line table
+// (which holds its source ids).  Keys point into the memory-mapped terminal
+// data, so the index stores no strings of its own.  If a terminal appears
+// more than once, the first occurrence is kept, which is the one the linear
+// scan would have found.
+//
+// Group indices are assigned the same way Nonterminal::initializeTerminalGroups
+// assigns them: seen groups are runs of consecutive lines with the same
+// probability, numbered from 0, and the seen section ends at the first blank
+// line.  The index depends only on the terminals file, so nonterminals that
+// share a TerminalFile also share its index (see NonterminalCollection).
+// It is built by the first of them to look up a terminal, so build may be
+// called from several threads and more than once.
+//
+
+#ifndef SEEN_TERMINAL_INDEX_H__
+#define SEEN_TERMINAL_INDEX_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include "gcfmacros.h"
+#include "terminal_file.h"
+
+class SeenTerminalIndex {
+ public:
+  struct Location {
+    uint64_t group_index;
+    uint64_t line;
+  };
+
+  SeenTerminalIndex(): built_(false), build_succeeded_(false) {}
+
+  // Index the seen section of the given terminal file, building its line
+  // table if needed.  Return false if a line cannot be parsed.  Only the
+  // first call does any work; later calls wait for it and return its result.
+  // find must not be called until build has returned true.
+  bool build(const TerminalFile& terminal_file);
+
+  // Return the location of the given terminal, or NULL if it was not seen
+  const Location* find(const char *terminal, size_t length) const;
+
+  size_t size() const { return locations_.size(); }
+
+ private:
+  // A terminal in the terminal data -- not null-terminated
+  struct Key {
+    const char *terminal;
+    size_t length;
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+  struct KeyEqual {
+    bool operator()(const Key& a, const Key& b) const;
+  };
+
+  // Does the work of build
+  bool indexTerminals(const TerminalFile& terminal_file);
+
+  std::unordered_map<Key, Location, KeyHash, KeyEqual> locations_;
+  // Set, under build_mutex_, once locations_ is complete
+  std::atomic<bool> built_;
+  bool build_succeeded_;
+  std::mutex build_mutex_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(SeenTerminalIndex);
+};
+
+
+#endif  // SEEN_TERMINAL_INDEX_H__
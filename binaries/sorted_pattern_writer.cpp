@@ -0,0 +1,242 @@
+// sorted_pattern_writer.cpp - a PatternWriter that sorts patterns in memory,
+//   spills sorted runs to disk, and merges them into a lookup table
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <unistd.h>
+
+#include "sorted_pattern_writer.h"
+
+// Size of the stdio buffer given to each run file
+static const size_t kRunBufferSize = 1 << 20;
+
+
+// A cursor walks through one sorted run.  In-memory runs are read in place;
+// runs on disk are read one record at a time into a private buffer.
+//
+// On disk, each record is stored as:
+//   double probability, uint32_t count length, uint32_t pattern length,
+//   count bytes, pattern bytes
+class SortedPatternWriter::RunCursor {
+ public:
+  RunCursor(FILE *run_file)
+    : run_file_(run_file), records_(NULL), next_index_(0), current_(NULL) {}
+  RunCursor(const std::vector<PatternRecord>* records)
+    : run_file_(NULL), records_(records), next_index_(0), current_(NULL) {}
+
+  // Move to the next record, returning false at the end of the run.  Sets
+  // *error on read failure.
+  bool advance(bool *error) {
+    if (records_ != NULL) {
+      if (next_index_ >= records_->size())
+        return false;
+      current_ = &(*records_)[next_index_++];
+      return true;
+    }
+
+    double probability;
+    uint32_t lengths[2];
+    if (fread(&probability, sizeof(probability), 1, run_file_) != 1)
+      return false;  // Clean end of run
+    if (fread(lengths, sizeof(lengths), 1, run_file_) != 1) {
+      *error = true;
+      return false;
+    }
+    buffer_.probability = probability;
+    buffer_.count.resize(lengths[0]);
+    buffer_.pattern.resize(lengths[1]);
+    if ((lengths[0] > 0 &&
+         fread(&buffer_.count[0], lengths[0], 1, run_file_) != 1) ||
+        (lengths[1] > 0 &&
+         fread(&buffer_.pattern[0], lengths[1], 1, run_file_) != 1)) {
+      *error = true;
+      return false;
+    }
+    current_ = &buffer_;
+    return true;
+  }
+
+  const PatternRecord& current() const { return *current_; }
+
+ private:
+  FILE *run_file_;
+  const std::vector<PatternRecord>* records_;
+  size_t next_index_;
+  const PatternRecord* current_;
+  PatternRecord buffer_;
+};
+
+
+SortedPatternWriter::~SortedPatternWriter() {
+  for (unsigned int i = 0; i < run_files_.size(); ++i)
+    fclose(run_files_[i]);
+}
+
+
+// Order records as "LC_ALL=C sort -gr" orders the lines of the raw table.
+// Equal probabilities print the same hex float, so ties are broken by the
+// rest of the line, "count<tab>pattern", in descending byte order.  A tab
+// sorts below every digit, so comparing the count strings and then the
+// patterns gives the same order as comparing the joined strings.
+bool SortedPatternWriter::recordPrecedes(const PatternRecord& a,
+                                         const PatternRecord& b) {
+  if (a.probability != b.probability)
+    return a.probability > b.probability;
+  int count_comparison = a.count.compare(b.count);
+  if (count_comparison != 0)
+    return count_comparison > 0;
+  return a.pattern.compare(b.pattern) > 0;
+}
+
+
+// Buffer the pattern and spill a run if we are out of memory
+bool SortedPatternWriter::writePattern(const double probability,
+                                       const BigCount& count,
+                                       const std::string& pattern) {
+  records_.push_back(PatternRecord());
+  PatternRecord& record = records_.back();
+  record.probability = probability;
+  record.count = count.toString();
+  record.pattern = pattern;
+
+  memory_used_ += sizeof(PatternRecord) + record.count.size() +
+                  record.pattern.size();
+  if (memory_used_ >= memory_limit_)
+    return spillRun();
+  return true;
+}
+
+
+bool SortedPatternWriter::flush() {
+  std::sort(records_.begin(), records_.end(), recordPrecedes);
+  return true;
+}
+
+
+// Sort the in-memory records and write them to an anonymous temporary file
+bool SortedPatternWriter::spillRun() {
+  flush();
+
+  std::string filename = temp_folder_ + "/gcf-patterns-XXXXXX";
+  std::vector<char> filename_buffer(filename.begin(), filename.end());
+  filename_buffer.push_back('\0');
+  int fd = mkstemp(&filename_buffer[0]);
+  if (fd == -1) {
+    fprintf(stderr, "Could not create temporary file in %s while sorting "
+                    "patterns!\n", temp_folder_.c_str());
+    return false;
+  }
+  // The file lives on as long as we hold it open
+  unlink(&filename_buffer[0]);
+  FILE *run_file = fdopen(fd, "w+b");
+  if (run_file == NULL) {
+    close(fd);
+    return false;
+  }
+  setvbuf(run_file, NULL, _IOFBF, kRunBufferSize);
+  run_files_.push_back(run_file);
+
+  for (unsigned int i = 0; i < records_.size(); ++i) {
+    const PatternRecord& record = records_[i];
+    uint32_t lengths[2] = { static_cast<uint32_t>(record.count.size()),
+                            static_cast<uint32_t>(record.pattern.size()) };
+    if (fwrite(&record.probability, sizeof(record.probability), 1,
+               run_file) != 1 ||
+        fwrite(lengths, sizeof(lengths), 1, run_file) != 1 ||
+        fwrite(record.count.data(), 1, record.count.size(), run_file) !=
+          record.count.size() ||
+        fwrite(record.pattern.data(), 1, record.pattern.size(), run_file) !=
+          record.pattern.size()) {
+      fprintf(stderr, "Error writing sorted run to temporary file in %s!\n",
+                      temp_folder_.c_str());
+      return false;
+    }
+  }
+  if (fflush(run_file) != 0) {
+    fprintf(stderr, "Error writing sorted run to temporary file in %s!\n",
+                    temp_folder_.c_str());
+    return false;
+  }
+
+  // Release the memory, not just the contents
+  std::vector<PatternRecord>().swap(records_);
+  memory_used_ = 0;
+  return true;
+}
+
+
+// k-way merge of all runs using a heap of cursors, feeding the merged stream
+// to a LookupTableWriter to accumulate guess numbers
+bool SortedPatternWriter::mergeToLookupTable(
+    const std::vector<SortedPatternWriter*>& writers, FILE *outfile) {
+  std::vector<RunCursor*> cursors;
+  for (unsigned int i = 0; i < writers.size(); ++i) {
+    SortedPatternWriter* writer = writers[i];
+    writer->flush();
+    for (unsigned int j = 0; j < writer->run_files_.size(); ++j) {
+      FILE *run_file = writer->run_files_[j];
+      if (fseeko(run_file, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Could not rewind sorted run!\n");
+        for (unsigned int k = 0; k < cursors.size(); ++k)
+          delete cursors[k];
+        return false;
+      }
+      cursors.push_back(new RunCursor(run_file));
+    }
+    cursors.push_back(new RunCursor(&writer->records_));
+  }
+
+  // The heap keeps the cursor whose current record comes first on top
+  auto cursor_after = [](const RunCursor* a, const RunCursor* b) {
+    return recordPrecedes(b->current(), a->current());
+  };
+  std::priority_queue<RunCursor*, std::vector<RunCursor*>,
+                      decltype(cursor_after)> heap(cursor_after);
+  bool error = false;
+  for (unsigned int i = 0; i < cursors.size(); ++i) {
+    if (cursors[i]->advance(&error))
+      heap.push(cursors[i]);
+  }
+
+  LookupTableWriter table_writer(outfile);
+  BigCount count;
+  bool success = !error;
+
+  while (success && !heap.empty()) {
+    RunCursor* cursor = heap.top();
+    heap.pop();
+    const PatternRecord& record = cursor->current();
+
+    BigCount::setString(count, record.count.c_str());
+    if (!table_writer.writePattern(record.probability, count,
+                                   record.pattern)) {
+      success = false;
+      break;
+    }
+
+    if (cursor->advance(&error))
+      heap.push(cursor);
+    if (error)
+      success = false;
+  }
+
+  if (success)
+    success = table_writer.finish();
+  if (!success)
+    fprintf(stderr, "Error while merging sorted patterns!\n");
+
+  for (unsigned int i = 0; i < cursors.size(); ++i)
+    delete cursors[i];
+  return success;
+}
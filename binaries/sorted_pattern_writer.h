@@ -0,0 +1,91 @@
+// sorted_pattern_writer.h - a PatternWriter that sorts patterns in memory,
+//   spills sorted runs to disk, and merges them into a lookup table
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Building a lookup table used to require writing the raw pattern table as
+// text, sorting it with "sort -gr" (which reparses every hex float), and then
+// piping the sorted table through sortedcountaggregator.  This class replaces
+// that pipeline inside GeneratePatterns.
+//
+// Each writer collects patterns in memory.  When the memory it is allowed to
+// use runs out, it sorts the patterns by decreasing probability and spills
+// them to an anonymous temporary file as a "run" in a compact binary format.
+// Once pattern generation is finished, mergeToLookupTable does a k-way merge
+// over every run of every writer (plus the patterns still held in memory) and
+// writes lines in the format produced by sortedcountaggregator:
+//   probability<tab>guess number of the pattern's first string<tab>pattern
+// followed by a "Total count" line.
+//
+// Patterns with equal probability are ordered as "LC_ALL=C sort -gr" would
+// order them, i.e., by descending byte order of the rest of the line, so the
+// output is identical to the output of the old pipeline.
+//
+// Run files are unlinked as soon as they are created, so nothing is left
+// behind if the process dies.
+//
+
+#ifndef SORTED_PATTERN_WRITER_H__
+#define SORTED_PATTERN_WRITER_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gcfmacros.h"
+#include "pattern_writer.h"
+
+class SortedPatternWriter : public PatternWriter {
+ public:
+  // Runs are written to temp_folder.  memory_limit is the approximate number
+  // of bytes of patterns to hold in memory before spilling a run.
+  SortedPatternWriter(const std::string& temp_folder,
+                      const size_t memory_limit)
+    : temp_folder_(temp_folder),
+      memory_limit_(memory_limit),
+      memory_used_(0) {}
+  // Closes (and so deletes) any run files
+  ~SortedPatternWriter();
+
+  bool writePattern(const double probability,
+                    const BigCount& count,
+                    const std::string& pattern);
+  // Sort the patterns held in memory.  They are kept in memory and used as
+  // the last run of this writer.
+  bool flush();
+
+  // Merge all runs of the given writers and write the lookup table to
+  // outfile.  Writers must not be written to after this is called.
+  // Return false on failure.
+  static bool mergeToLookupTable(
+      const std::vector<SortedPatternWriter*>& writers, FILE *outfile);
+
+ private:
+  struct PatternRecord {
+    double probability;
+    std::string count;  // Base 10, as in the raw table
+    std::string pattern;
+  };
+  // A position in one sorted run, either in memory or on disk
+  class RunCursor;
+  // Compare by descending probability, then descending count and pattern
+  static bool recordPrecedes(const PatternRecord& a, const PatternRecord& b);
+
+  // Sort the in-memory patterns and write them to a new run file
+  bool spillRun();
+
+  std::string temp_folder_;
+  size_t memory_limit_;
+  size_t memory_used_;
+  std::vector<PatternRecord> records_;
+  std::vector<FILE*> run_files_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(SortedPatternWriter);
+};
+
+
+#endif  // SORTED_PATTERN_WRITER_H__
@@ -5,7 +5,7 @@
 // Use of this source code is governed by the GPLv2 license that can be found
 //   in the LICENSE file.
 //
-// Version 0.2
+// Version 0.4
 // Author: Saranga Komanduri
 //
 // Modified: Thu Sep 11 12:17:50 2014
@@ -22,64 +22,391 @@
 // "using namespace std" here which is not used in any of the newer code.
 // Overall, the code could definitely use revision.
 //
+// Fields are now parsed in place and lines formatted with the text codec
+// (see text_codec.h), and counts are kept in a BigCount, so the GMP string
+// functions are only used for counts of 2^64 or more.
+//
+// With more than one thread, when stdin is a regular file (e.g.,
+// "sortedcountaggregator -threads 8 < sorted.txt" rather than a pipe from
+// sort), the table is memory-mapped and aggregated in two parallel passes
+// over chunks of whole lines:
+//
+//   1. Each chunk is parsed, checked for decreasing probabilities, and its
+//      counts summed.  The boundaries between chunks are then checked, and
+//      a prefix sum over the chunk totals gives the guess number of the
+//      first line of every chunk.
+//   2. Each chunk's lines are formatted with their accumulated guess numbers
+//      into a buffer, and the buffers are written to stdout in order.  Only
+//      a window of chunks is formatted ahead of the writer, which bounds
+//      memory use.
+//
+// The output is the same as that of the line-by-line loop, which is still
+// used for pipes and for a single thread, since it parses every line once
+// instead of twice.  Binary output is written by one thread in pass 2, since
+// BinaryLookupTableWriter is sequential, but still benefits from pass 1.
+//
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <future>
 #include <iostream>
 #include <iomanip>
 #include <gmp.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "big_count.h"
+#include "binary_lookup_table.h"
+#include "text_codec.h"
+#include "work_stealing_pool.h"
 
 using namespace std;
 
+// Chunks are about this size, or smaller so that every thread gets several
+static const size_t kMaxChunkSize = 1 << 24;
+static const unsigned int kChunksPerThread = 4;
+
+// A run of whole lines of a memory-mapped table
+struct Chunk {
+  const char *begin;
+  const char *end;
+  // Filled in by pass 1
+  BigCount count;            // Sum of the counts of the lines
+  double first_probability;  // Probabilities of the first and last lines,
+  double last_probability;   //   only set if the chunk has any lines
+  uint64_t lines;
+  string error;              // Empty unless parsing or checking failed
+  // Guess number of the first line, from the prefix sum
+  BigCount first_guess;
+  // Formatted text lines, filled in by pass 2
+  string output;
+};
+
+
+// Parse the line at line, which ends at the next newline or at end.  Set
+// the out-parameters to the probability, the count, and the terminal string.
+// Return a pointer past the line, or NULL (with error set) if the line does
+// not have three tab-separated fields or the count cannot be parsed.
+static const char* ParseTableLine(const char *line, const char *end,
+                                  double *prob, BigCount *count,
+                                  const char **term, size_t *term_length,
+                                  string *error) {
+  const char *line_end =
+    static_cast<const char*>(memchr(line, '\n', end - line));
+  if (line_end == NULL)
+    line_end = end;
+  const char *marker1 =
+    static_cast<const char*>(memchr(line, '\t', line_end - line));
+  const char *marker2 = (marker1 == NULL) ? NULL :
+    static_cast<const char*>(memchr(marker1 + 1, '\t',
+                                    line_end - marker1 - 1));
+  if (marker2 == NULL) {
+    *error = "Line does not contain three tab-separated fields: " +
+             string(line, line_end);
+    return NULL;
+  }
+
+  // Probability is the first field
+  *prob = textcodec::ParseDouble(line);
+  // Count is the second field
+  if (!BigCount::setString(*count, marker1 + 1, marker2 - marker1 - 1)) {
+    *error = "Count could not be parsed: " + string(line, line_end);
+    return NULL;
+  }
+  // Terminal string is the third field and goes to the end of the line
+  *term = marker2 + 1;
+  *term_length = line_end - *term;
+
+  return (line_end == end) ? end : line_end + 1;
+}
+
+
+// Return false, and set error, if prob is larger than last_prob
+static bool CheckDecreasing(const double last_prob, const double prob,
+                            string *error) {
+  if (last_prob < prob) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "Found instance where input table is not sorted by "
+             "decreasing probability! Found probability %a followed "
+             "by %a!", last_prob, prob);
+    *error = buffer;
+    return false;
+  }
+  return true;
+}
+
+
+// Append a line of the output table to output
+static void FormatTableLine(const double prob, const BigCount& acc,
+                            const char *term, const size_t term_length,
+                            string *output) {
+  textcodec::AppendHexFloat(prob, output);
+  output->push_back('\t');
+  acc.appendTo(output);
+  output->push_back('\t');
+  output->append(term, term_length);
+  output->push_back('\n');
+}
+
+
+// Pass 1: count the lines of a chunk, sum their counts, and check that their
+// probabilities decrease
+static void SumChunk(Chunk *chunk) {
+  BigCount cur;
+  double prob;
+  const char *term;
+  size_t term_length;
+  chunk->lines = 0;
+  const char *position = chunk->begin;
+  while (position < chunk->end) {
+    position = ParseTableLine(position, chunk->end, &prob, &cur, &term,
+                              &term_length, &chunk->error);
+    if (position == NULL)
+      return;
+    if (chunk->lines == 0)
+      chunk->first_probability = prob;
+    else if (!CheckDecreasing(chunk->last_probability, prob, &chunk->error))
+      return;
+    chunk->last_probability = prob;
+    BigCount::add(chunk->count, chunk->count, cur);
+    ++chunk->lines;
+  }
+}
+
+
+// Pass 2: format the lines of a chunk, which were checked in pass 1
+static void FormatChunk(Chunk *chunk) {
+  BigCount acc = chunk->first_guess;
+  BigCount cur;
+  double prob;
+  const char *term;
+  size_t term_length;
+  chunk->output.reserve(chunk->end - chunk->begin + chunk->lines * 8);
+  const char *position = chunk->begin;
+  while (position < chunk->end) {
+    position = ParseTableLine(position, chunk->end, &prob, &cur, &term,
+                              &term_length, &chunk->error);
+    FormatTableLine(prob, acc, term, term_length, &chunk->output);
+    BigCount::add(acc, acc, cur);
+  }
+}
+
+
+// Aggregate the table mapped at data.  Return the total count through
+// total, or die on failure.
+static void AggregateMappedTable(const char *data, const size_t size,
+                                 const unsigned int num_threads,
+                                 BinaryLookupTableWriter *binary_writer,
+                                 BigCount *total) {
+  // Split the table into chunks of whole lines
+  size_t num_chunks = num_threads * kChunksPerThread;
+  if (size / kMaxChunkSize + 1 > num_chunks)
+    num_chunks = size / kMaxChunkSize + 1;
+  vector<Chunk> chunks;
+  chunks.reserve(num_chunks);
+  const char *data_end = data + size;
+  const char *chunk_begin = data;
+  for (size_t i = 1; i <= num_chunks && chunk_begin < data_end; ++i) {
+    const char *chunk_end = data + (size / num_chunks) * i;
+    if (i == num_chunks || chunk_end >= data_end) {
+      chunk_end = data_end;
+    } else if (chunk_end < chunk_begin) {
+      continue;
+    } else {
+      chunk_end = static_cast<const char*>(
+        memchr(chunk_end, '\n', data_end - chunk_end));
+      chunk_end = (chunk_end == NULL) ? data_end : chunk_end + 1;
+    }
+    chunks.push_back(Chunk());
+    chunks.back().begin = chunk_begin;
+    chunks.back().end = chunk_end;
+    chunk_begin = chunk_end;
+  }
+
+  WorkStealingPool pool(num_threads);
+
+  // Pass 1
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    Chunk *chunk = &chunks[i];
+    pool.submit([chunk](unsigned int) { SumChunk(chunk); });
+  }
+  pool.wait();
+
+  // Report the first error in the table, check the chunk boundaries, and
+  // take the prefix sum
+  BigCount acc(1);  // Start at the first guess
+  double last_prob = 1;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    string error = chunks[i].error;
+    if (error.empty() && chunks[i].lines > 0 &&
+        CheckDecreasing(last_prob, chunks[i].first_probability, &error))
+      last_prob = chunks[i].last_probability;
+    if (!error.empty()) {
+      fprintf(stderr, "%s\n", error.c_str());
+      exit(EXIT_FAILURE);
+    }
+    chunks[i].first_guess = acc;
+    BigCount::add(acc, acc, chunks[i].count);
+  }
+  // acc is the index of the next guess, but there is no next guess at the
+  // end of the file
+  BigCount::sub(*total, acc, 1);
+
+  // Pass 2
+  if (binary_writer != NULL) {
+    mpz_t accmpz;
+    mpz_init(accmpz);
+    BigCount cur;
+    double prob;
+    const char *term;
+    size_t term_length;
+    string error;
+    acc = 1;
+    const char *position = data;
+    while (position < data_end) {
+      position = ParseTableLine(position, data_end, &prob, &cur, &term,
+                                &term_length, &error);
+      BigCount::get(accmpz, acc);
+      if (!binary_writer->addEntry(prob, accmpz, string(term, term_length)))
+        exit(EXIT_FAILURE);
+      BigCount::add(acc, acc, cur);
+    }
+    mpz_clear(accmpz);
+    return;
+  }
+
+  // Keep a window of chunks being formatted ahead of the one being written
+  size_t window = 2 * pool.size();
+  vector<promise<void> > formatted(chunks.size());
+  auto submit_format = [&chunks, &formatted, &pool](size_t i) {
+    Chunk *chunk = &chunks[i];
+    promise<void> *done = &formatted[i];
+    pool.submit([chunk, done](unsigned int) {
+      FormatChunk(chunk);
+      done->set_value();
+    });
+  };
+  for (size_t i = 0; i < chunks.size() && i < window; ++i)
+    submit_format(i);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    formatted[i].get_future().wait();
+    if (fwrite(chunks[i].output.data(), 1, chunks[i].output.size(), stdout) !=
+        chunks[i].output.size()) {
+      perror("Error writing lookup table: ");
+      exit(EXIT_FAILURE);
+    }
+    string().swap(chunks[i].output);
+    if (i + window < chunks.size())
+      submit_format(i + window);
+  }
+}
+
+
+// Map stdin if it is a regular file.  Return NULL if it cannot be mapped.
+static const char* MapStdin(size_t *size) {
+  struct stat sb;
+  if (fstat(STDIN_FILENO, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+      sb.st_size == 0 || lseek(STDIN_FILENO, 0, SEEK_CUR) != 0)
+    return NULL;
+  *size = static_cast<size_t>(sb.st_size);
+  void *mapping = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+  if (mapping == MAP_FAILED)
+    return NULL;
+  return static_cast<const char*>(mapping);
+}
+
+
+// With "-binary <file>", the table is written to <file> in the binary format
+// of binary_lookup_table.h instead of as text to stdout.  With
+// "-threads <n>", a table given as a regular file on stdin is aggregated on
+// n threads.
 int main(int argc, char *argv[]) {
-  string inputLine;
-  char accstring[255];
-  mpz_t acc;
-  mpz_t cur;
-  mpz_init_set_ui(acc,1);   // Start at the first guess
-  mpz_init(cur);
-  int marker1, marker2;
-  double prob, last_prob = 1;
-  string curTerm;
-
-  cin.sync_with_stdio(false);  // This makes line-by-line reading from stdin significantly faster!
-
-  while (getline(cin,inputLine)) {
-    mpz_set_ui(cur,0);
-    // Find the counter
-    marker1 = inputLine.find("\t");
-    // Probability is the first field
-    prob = strtod((inputLine.substr(0, marker1)).c_str(), NULL);
-    //cout << inputLine.substr(0, marker1) << endl;
-
-    // Make sure probabilities are always decreasing
-    if (last_prob < prob) {
-      fprintf(stderr, "Found instance where input table is not sorted by "
-                      "decreasing probability! Found probability %a followed "
-                      "by %a!\n", last_prob, prob);
+  BinaryLookupTableWriter binary_writer;
+  bool binary_output = false;
+  unsigned int num_threads = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (string(argv[i]) == "-binary" && i + 1 < argc) {
+      binary_output = true;
+      if (!binary_writer.open(argv[++i]))
+        exit(EXIT_FAILURE);
+    } else if (string(argv[i]) == "-threads" && i + 1 < argc &&
+               sscanf(argv[i + 1], "%u", &num_threads) == 1 &&
+               num_threads > 0) {
+      ++i;
+    } else {
+      fprintf(stderr, "Usage: %s [-binary <output file>] [-threads <n>] "
+                      "< sortedtable\n", argv[0]);
       exit(EXIT_FAILURE);
     }
+  }
+
+  BigCount acc(1);   // Start at the first guess
+  mpz_t accmpz;      // Copy of acc for the binary writer
+  mpz_init(accmpz);
 
-    // Count is the second field
-    marker2 = (inputLine.substr(marker1+1, inputLine.size())).find("\t");
-    mpz_set_str(cur,(inputLine.substr(marker1+1,marker2)).c_str(), 10);
-    //cout << inputLine.substr(marker1+1,marker2) << endl;
+  size_t mapped_size;
+  const char *mapped_table = (num_threads > 1) ? MapStdin(&mapped_size) : NULL;
+  if (mapped_table != NULL) {
+    AggregateMappedTable(mapped_table, mapped_size, num_threads,
+                         binary_output ? &binary_writer : NULL, &acc);
+    munmap(const_cast<char*>(mapped_table), mapped_size);
+  } else {
+    string inputLine;
+    string outputLine;
+    string error;
+    BigCount cur;
+    double prob, last_prob = 1;
+    const char *curTerm;
+    size_t curTermLength;
 
-    // Terminal string is the third field and goes to the end of the line
-    curTerm = inputLine.substr(marker1+marker2+2, inputLine.size());
-    //cout << curTerm << endl;
+    cin.sync_with_stdio(false);  // This makes line-by-line reading from stdin significantly faster!
 
-    mpz_get_str(accstring, 10, acc);
-    printf("%a\t%s\t%s\n", prob, accstring, curTerm.c_str());
-    // cout << prob << "\t" << acc << "\t" << curTerm << endl;
+    while (getline(cin,inputLine)) {
+      const char *line = inputLine.c_str();
+      if (ParseTableLine(line, line + inputLine.size(), &prob, &cur, &curTerm,
+                         &curTermLength, &error) == NULL) {
+        fprintf(stderr, "%s\n", error.c_str());
+        exit(EXIT_FAILURE);
+      }
 
-    mpz_add(acc, acc, cur);
-    last_prob = prob;
+      // Make sure probabilities are always decreasing
+      if (!CheckDecreasing(last_prob, prob, &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        exit(EXIT_FAILURE);
+      }
+
+      if (binary_output) {
+        BigCount::get(accmpz, acc);
+        if (!binary_writer.addEntry(prob, accmpz,
+                                    string(curTerm, curTermLength)))
+          exit(EXIT_FAILURE);
+      } else {
+        outputLine.clear();
+        FormatTableLine(prob, acc, curTerm, curTermLength, &outputLine);
+        fwrite(outputLine.data(), 1, outputLine.size(), stdout);
+      }
+
+      BigCount::add(acc, acc, cur);
+      last_prob = prob;
+    }
+
+    BigCount::sub(acc, acc, 1);  // Adjust total count by 1 because acc is actually the index of the next guess, but there is no next guess at the end of the file
+  }
+
+  if (binary_output) {
+    BigCount::get(accmpz, acc);
+    if (!binary_writer.finish(accmpz))
+      exit(EXIT_FAILURE);
+  } else {
+    printf("Total count\t%s\n", acc.toString().c_str());
   }
+  mpz_clear(accmpz);
 
-  mpz_sub_ui(acc, acc, 1);  // Adjust total count by 1 because acc is actually the index of the next guess, but there is no next guess at the end of the file
-  mpz_get_str(accstring, 10, acc);
-  printf("Total count\t%s\n", accstring);
-  
   exit(0);
 }
@@ -17,9 +17,11 @@
 #include <sstream>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 #include "pattern_manager.h"
 #include "terminal_group.h"
 #include "grammar_tools.h"
+#include "text_codec.h"
 
 #include "structure.h"
 
@@ -90,29 +92,49 @@ bool Structure::loadStructure(const std::string& representation,
     return false;    
   }
 
+  // Build the pattern metadata shared by all pattern managers over this
+  // structure
+  if (!pattern_metadata_.Init(representation_,
+                              kStructureBreakChar,
+                              nonterminals_size_,
+                              nonterminals_,
+                              probability_)) {
+    fprintf(stderr,
+      "Error initializing pattern metadata for structure \"%s\"!\n",
+      representation_.c_str());
+    return false;
+  }
+
   return true;
 }
 
 
+// PCFG::loadSnapshot reads these fields back and calls loadStructure
+void Structure::writeSnapshot(GrammarSnapshotWriter *writer) const {
+  writer->writeDouble(probability_);
+  writer->writeString(representation_);
+  writer->writeString(source_ids_);
+}
+
+
 // Return the total count of strings for this structure
 //
 // Since this is a context free grammar, we can simply multiply the string
 // counts over the nonterminals
-void Structure::countStrings(mpz_t result) const {
-  mpz_init_set_ui(result, 1);
+void Structure::countStrings(BigCount& result) const {
+  result = 1;
 
+  BigCount nonterminal_count;
   for (unsigned int i = 0; i < nonterminals_size_; ++i) {
-    mpz_t nonterminal_count;
     nonterminals_[i]->countStrings(nonterminal_count);
-    mpz_mul(result, result, nonterminal_count);
-    mpz_clear(nonterminal_count);
+    BigCount::mul(result, result, nonterminal_count);
   }
 }
 
 
 // Generate all "patterns" from this structure whose probability is above
 // the given cutoff.
-// Output to stdout.
+// Output to the given PatternWriter.
 //
 // A "pattern" is a set of sequences of TerminalGroups that share a
 // probability, so this function could simply iterate over all terminal
@@ -125,26 +147,49 @@ void Structure::countStrings(mpz_t result) const {
 // greatly reduces the output of this function with no loss in accuracy.
 // It does greatly increase the complexity of the code, though.
 //
+// If split_begin and split_end are given, only patterns whose split place
+// digit is in [split_begin, split_end) are generated.  Every place before the
+// split place has a single terminal group, so the split place is the most
+// significant digit that varies, and the patterns in a range form a
+// contiguous run of the pattern counter.  Starting the counter at
+// split_begin and stopping at split_end therefore visits exactly the
+// patterns that a full traversal would visit in that range.
+//
 // Return true on success.
 //
-bool Structure::generatePatterns(const double cutoff) const {
+bool Structure::generatePatterns(const double cutoff,
+                                 PatternWriter* writer,
+                                 const uint64_t split_begin,
+                                 const uint64_t split_end) const {
+  if (probability_ < cutoff)
+    return true;
+
   // To facilitate iterating over all combinations of terminal groups produced
   // by this structure, we use a very specialized structure called a
   // PatternManager.  This structure will handle the complexity of
   // generating patterns, including pattern compaction and intelligent skipping
   PatternManager *pattern_manager = new PatternManager;
-  if (!pattern_manager->Init(representation_,
-                            kStructureBreakChar,
-                            nonterminals_size_,
-                            nonterminals_,
-                            probability_)) {
+  if (!pattern_manager->Init(pattern_metadata_)) {
+    delete pattern_manager;
     return false;
   }
 
+  // Move to the start of the requested range
+  unsigned int split_place = findSplitPlace();
+  if (split_begin > 0 &&
+      !pattern_manager->setPatternCounterPlace(split_place, split_begin)) {
+    // Range starts past the last terminal group, so there is nothing to do
+    delete pattern_manager;
+    return true;
+  }
+
   // Now that we have the pattern manager, use it to iterate over patterns and
-  // output them to stdout
+  // output them to the writer
   bool patterns_left = true;
   while (patterns_left) {
+    // Stop at the end of the requested range
+    if (pattern_manager->getPatternCounterPlace(split_place) >= split_end)
+      break;
 
     // First check if the current pattern is below the cutoff, if not use
     // intelligent skipping to jump ahead
@@ -158,42 +203,118 @@ bool Structure::generatePatterns(const double cutoff) const {
     if (pattern_manager->isFirstPermutation()) {
       // Compute number of strings this pattern and all permutations would
       // produce (this is pattern compaction)
-      mpz_t string_count;
+      BigCount string_count;
       pattern_manager->countStrings(string_count);
-      mpz_t permutation_count;
+      BigCount permutation_count;
       pattern_manager->countPermutations(permutation_count);
-      mpz_t total_count;
-      mpz_init(total_count);
-      mpz_mul(total_count, string_count, permutation_count);
-      char counterstring[1024];
-      // Write out the GMP number to a C-style string in base 10
-      mpz_get_str(counterstring, 10, total_count);
+      BigCount total_count;
+      BigCount::mul(total_count, string_count, permutation_count);
 
       // Get the pattern identifier -- I use the first string that would be
       // produced by the pattern
       std::string pattern_representation = 
         pattern_manager->getFirstStringOfPattern();
 
-      // Output to stdout
-      printf("%a\t%s\t%s\n", pattern_probability, counterstring,
-                             pattern_representation.c_str());
-      mpz_clear(string_count);
-      mpz_clear(permutation_count);
-      mpz_clear(total_count);
+      bool written = writer->writePattern(pattern_probability, total_count,
+                                          pattern_representation);
+      if (!written) {
+        fprintf(stderr, "Error writing pattern in Structure::generatePatterns!\n");
+        delete pattern_manager;
+        return false;
+      }
     }
     patterns_left = pattern_manager->incrementPatternCounter();
   }
 
   // If we are here, we have iterated over the complete space of patterns
-  // covered by this structure!
+  // covered by this structure (or the requested part of it)!
   delete pattern_manager;
   return true;
 }
 
 
+// Generate this structure's patterns in order of decreasing probability
+//
+// Return true on success.
+//
+bool Structure::generateOrderedPatterns(const double cutoff,
+                                        const BigCount& guess_budget,
+                                        PatternWriter* writer) const {
+  if (probability_ < cutoff)
+    return true;
+
+  OrderedPatternEnumerator* enumerator = newOrderedPatternEnumerator(cutoff);
+  if (enumerator == NULL)
+    return false;
+
+  bool success = true;
+  bool has_budget = !guess_budget.isZero();
+  BigCount strings_written;
+  BigCount total_count;
+  while (enumerator->next()) {
+    enumerator->countStrings(total_count);
+    bool written = writer->writePattern(enumerator->getPatternProbability(),
+                                        total_count,
+                                        enumerator->getFirstStringOfPattern());
+    BigCount::add(strings_written, strings_written, total_count);
+    if (!written) {
+      fprintf(stderr,
+              "Error writing pattern in Structure::generateOrderedPatterns!\n");
+      success = false;
+      break;
+    }
+    if (has_budget && BigCount::cmp(strings_written, guess_budget) >= 0)
+      break;
+  }
+
+  delete enumerator;
+  return success;
+}
+
+
+// Create and initialize an enumerator for this structure
+OrderedPatternEnumerator* Structure::newOrderedPatternEnumerator(
+    const double cutoff) const {
+  OrderedPatternEnumerator* enumerator = new OrderedPatternEnumerator;
+  if (!enumerator->Init(pattern_metadata_, cutoff)) {
+    delete enumerator;
+    return NULL;
+  }
+  return enumerator;
+}
+
+
+// Return the first place whose nonterminal produces more than one terminal
+// group
+unsigned int Structure::findSplitPlace() const {
+  for (unsigned int i = 0; i < nonterminals_size_; ++i) {
+    if (nonterminals_[i]->countTerminalGroups() > 1)
+      return i;
+  }
+  return 0;
+}
+
+
+// See header comment
+uint64_t Structure::getSplitRadix() const {
+  if (nonterminals_size_ == 0)
+    return 1;
+  return nonterminals_[findSplitPlace()]->countTerminalGroups();
+}
+
+
+// The number of patterns is the product of the terminal group counts
+double Structure::estimatePatternCount() const {
+  double result = 1.0;
+  for (unsigned int i = 0; i < nonterminals_size_; ++i)
+    result *= static_cast<double>(nonterminals_[i]->countTerminalGroups());
+  return result;
+}
+
+
 // Generate all strings from this structure whose probability is above
 // the given cutoff.
-// Output to stdout.
+// Output to the given writer.
 //
 // This uses the same structure as generatePatterns, because using patterns
 // allows us to use the intelligentSkip function to traverse the space more
@@ -202,19 +323,29 @@ bool Structure::generatePatterns(const double cutoff) const {
 // Return true on success.
 //
 bool Structure::generateStrings(
-    const double cutoff, 
+    const double cutoff,
+    TextStringWriter* writer,
     const bool accurate_probabilities,
     const PCFG *const parent) const {
+  if (probability_ < cutoff)
+    return true;
+
   // Initialize pattern manager
   PatternManager *pattern_manager = new PatternManager;
-  if (!pattern_manager->Init(representation_,
-                            kStructureBreakChar,
-                            nonterminals_size_,
-                            nonterminals_,
-                            probability_)) {
+  if (!pattern_manager->Init(pattern_metadata_)) {
     return false;
   }
 
+  // Reused for every accurate probability lookup
+  LookupData total_lookup;
+
+  // The current string is assembled in one buffer that is reused for every
+  // string of every pattern.  The terminal of nonterminal i starts at
+  // terminal_starts[i], so when an increment changes the terminals from
+  // place i on, only that suffix of the buffer is rewritten.
+  std::string current_string;
+  std::vector<size_t> terminal_starts(nonterminals_size_, 0);
+
   // Iterate over all patterns
   bool patterns_left = true;
   while (patterns_left) {
@@ -234,22 +365,25 @@ bool Structure::generateStrings(
       pattern_manager->getStringIterators();
 
     // Iterate until the first iterator overflows -- an overflow is indicated
-    // by false returned from an increment call
+    // by false returned from an increment call.  Every terminal is new for
+    // the first string of a pattern.
     bool strings_left = true;
+    unsigned int first_changed_place = 0;
     while (strings_left) {
-      // TODO: We can be more efficient here because typically only the last
-      // piece of the current_string will change on each iteration
-
-      // Build the current string and output to stdout or check and return
-      std::string current_string = "";
-      for (unsigned int i = 0; i < nonterminals_size_; ++i)
+      bool written = true;
+      // Rebuild the current string from the first terminal that changed and
+      // output to the writer or check and return
+      current_string.resize(terminal_starts[first_changed_place]);
+      for (unsigned int i = first_changed_place; i < nonterminals_size_; ++i) {
+        terminal_starts[i] = current_string.size();
         current_string.append(iterators[i]->getCurrentString());
+      }
       if (accurate_probabilities) {
-        LookupData *total_lookup = parent->lookupSum(current_string);
+        parent->lookupSum(current_string, &total_lookup);
 
         // Check for catastrophic failure
-        if ( (total_lookup->parse_status & kUnexpectedFailure) ||
-             !(total_lookup->parse_status & kCanParse) ) {
+        if ( (total_lookup.parse_status & kUnexpectedFailure) ||
+             !(total_lookup.parse_status & kCanParse) ) {
           fprintf(stderr,
             "String generation returned a string that could not be parsed?!?"
             " for structure %s and inputstring %s!\n",
@@ -265,13 +399,19 @@ bool Structure::generateStrings(
         // for this structure (otherwise we wouldn't be producing it), so the 
         // highest probability structure for this string must also have it
         // above the cutoff.
-        if (total_lookup->first_string_of_pattern == first_string_of_pattern) {
-          printf("%a\t%s\n", total_lookup->probability,
-                             current_string.c_str());          
-        }
+        if (total_lookup.first_string_of_pattern == first_string_of_pattern)
+          written = writer->writeString(total_lookup.probability,
+                                        current_string);
       } else {
-        printf("%a\t%s\n", pattern_probability,
-                           current_string.c_str());
+        written = writer->writeString(pattern_probability, current_string);
+      }
+      if (!written) {
+        fprintf(stderr, "Error writing string in Structure::generateStrings!\n");
+        for (unsigned int i = 0; i < nonterminals_size_; ++i)
+          delete iterators[i];
+        delete[] iterators;
+        delete pattern_manager;
+        return false;
       }
 
       // Increment the string iterators as needed
@@ -286,6 +426,8 @@ bool Structure::generateStrings(
           break;
         }
       }
+      if (strings_left)
+        first_changed_place = static_cast<unsigned int>(iter_index);
     }
     // Free iterators
     for (unsigned int i = 0; i < nonterminals_size_; ++i)
@@ -302,6 +444,21 @@ bool Structure::generateStrings(
 }
 
 
+// Convert a single character of an input string to USLDE
+char Structure::convertCharacterToStructureRepresentation(const char c) {
+  if( c >= 'a' && c <= 'z' )
+    return 'L';
+  else if( c >= 'A' && c <= 'Z' )
+    return 'U';
+  else if( c >= '0' && c <= '9' )
+    return 'D';
+  else if( c == 1 )
+    return kStructureBreakChar;
+  else
+    return 'S';
+}
+
+
 // Convert a string to a "representation" of non-terminal symbols in the grammar
 // Note that this function is extremely specific to the particular restricted
 // PCFG used in the current guess calculator framework.
@@ -314,21 +471,13 @@ bool Structure::generateStrings(
 // call sys.exit with failure.
 //
 std::string Structure::convertStringToStructureRepresentation(
-    const std::string& inputstring) const {
+    const std::string& inputstring) {
   std::string representation;
   representation.reserve(inputstring.size());
   for (unsigned int i = 0; i < inputstring.size(); ++i) {
     // Convert the inputstring to a USLDE structure
-    if( inputstring[i] >= 'a' && inputstring[i] <= 'z' )
-      representation.push_back('L');
-    else if( inputstring[i] >= 'A' && inputstring[i] <= 'Z' )
-      representation.push_back('U');
-    else if( inputstring[i] >= '0' && inputstring[i] <= '9' )
-      representation.push_back('D');
-    else if( inputstring[i] == 1 )
-      representation.push_back(kStructureBreakChar);
-    else
-      representation.push_back('S');
+    representation.push_back(
+      convertCharacterToStructureRepresentation(inputstring[i]));
   }
 
   // representation should not exceed the size of inputstring
@@ -343,8 +492,21 @@ std::string Structure::convertStringToStructureRepresentation(
 }
 
 
+// The signature is the concatenation of the nonterminal representations
+std::string Structure::getSignature() const {
+  std::string signature;
+  signature.reserve(representation_.size());
+  for (unsigned int i = 0; i < representation_.size(); ++i) {
+    if (representation_[i] != kStructureBreakChar)
+      signature.push_back(representation_[i]);
+  }
+  return signature;
+}
+
+
 // Given a string, determine if it can be produced by this structure and
-// return a LookupData struct with relevant fields set
+// fill in lookup_data with the relevant fields, except for source ids (see
+// addSourceIDs)
 //
 // With the current restricted PCFG setup, we can easily shortcut parsing.
 // We can "determine" the nonterminals in a given string based solely on
@@ -355,115 +517,126 @@ std::string Structure::convertStringToStructureRepresentation(
 // First, check that the structure representation of the input string matches
 // this structure.  If not, set parse_status to kStructureNotFound and return.
 // This comparison is performed using nonterminals only, because we want to
-// ignore breaks in the structure on lookup.  This complicates the algorithm
-// slightly because we need to track where we are in the input string and in the
-// nonterminals, and make sure we have consumed all of both and never go out of
-// bounds on the input string.
+// ignore breaks in the structure on lookup, so it is the same as comparing
+// against the signature of this structure.
 // 
 // Then use a PatternManager object to perform the rest of the lookups, because
 // determining an index for the given string requires knowledge of pattern
-// compaction, which is encapsulated in the PatternManager class.  However,
-// the PatternManager doesn't know the enclosing structure source ids, 
-// so this is folded in to the LookupData before returning.
+// compaction, which is encapsulated in the PatternManager class.
 //
 // If the \x01 character is found in the string it is ignored as it represents
 // the structure break character in terminal strings.
 //
 // Die on any failures.
 //
-LookupData* Structure::lookup(const std::string& inputstring) const {
-  // Remove any break characters from the input before parsing
-  std::string unbroken_input = 
-    grammartools::StripBreakCharacterFromTerminal(inputstring);
+void Structure::lookup(const std::string& inputstring,
+                       LookupData *lookup_data,
+                       NonterminalLookupMemo *memo) const {
+  // Remove any break characters from the input before parsing.  Most input
+  // has none, so avoid the copy.
+  std::string stripped_input;
+  const std::string *unbroken_input = &inputstring;
+  if (inputstring.find('\x01') != std::string::npos) {
+    stripped_input = grammartools::StripBreakCharacterFromTerminal(inputstring);
+    unbroken_input = &stripped_input;
+  }
 
   // Match the structure representation of the inputstring with the 
-  // representation of the nonterminals in this structure
-  std::string inputstring_representation =
-    convertStringToStructureRepresentation(unbroken_input);
-
-  // Break the structure into terminals and check each terminal
-  unsigned int string_position = 0;
+  // representation of the nonterminals in this structure, one character at a
+  // time
   bool parseable = true;
-  std::string *terminals = new std::string[nonterminals_size_];
-  // Iterate over the nonterminals
+  size_t string_position = 0;
   for (unsigned int i = 0; i < nonterminals_size_ && parseable; ++i) {
-    // Check the nonterminal representation first
-    std::string nonterminal_representation = 
+    const std::string& nonterminal_representation =
       nonterminals_[i]->getRepresentation();
     for (unsigned int j = 0; j < nonterminal_representation.size(); ++j) {
       // Make sure we are not going past the end of the inputstring
-      if (string_position >= inputstring_representation.size()) {
-        parseable = false;
-        break;
-      }
-      if (inputstring_representation[string_position++] != 
+      if (string_position >= unbroken_input->size() ||
+          convertCharacterToStructureRepresentation(
+            (*unbroken_input)[string_position++]) !=
           nonterminal_representation[j]) {
         parseable = false;
         break;
       }
     }
-    // Extract this part of the input string
-    if (parseable) {
-      unsigned int length = nonterminal_representation.size();
-      unsigned int start_position = string_position - length;
-      terminals[i] = unbroken_input.substr(start_position, length).c_str();
-    }
   }
   // Finally, check that there isn't more the inputstring that wasn't yet
   // captured
-  if (parseable) {
-    if (string_position != inputstring_representation.size())
-      parseable = false;
-  }
-  if (!parseable) {
-    delete[] terminals;
-    // Make a new lookup_data object to return
-    LookupData *lookup_data = new LookupData;
-    mpz_init(lookup_data->index);    
+  if (!parseable || string_position != unbroken_input->size()) {
     lookup_data->parse_status = kStructureNotFound;
     lookup_data->probability = -1;
-    mpz_set_si(lookup_data->index, -1);
-    return lookup_data;    
+    return;
   }
 
-  // Instantiate a pattern manager
+  // Instantiate a pattern manager over the shared metadata
   PatternManager pattern_manager;
-  if (!pattern_manager.Init(representation_,
-                            kStructureBreakChar,
-                            nonterminals_size_,
-                            nonterminals_,
-                            probability_)) {
+  if (!pattern_manager.Init(pattern_metadata_)) {
     fprintf(stderr,
       "Error instantiating pattern manager for structure %s and "
       "inputstring %s!\n",
       representation_.c_str(), inputstring.c_str());
     exit(EXIT_FAILURE);
   }
-  LookupData *pattern_lookup = pattern_manager.lookupAndSetPattern(terminals);
-  delete[] terminals;
+  pattern_manager.lookupAndSetPattern(unbroken_input->data(), lookup_data,
+                                     memo);
   
   // Check for catastrophic failure
-  if (pattern_lookup->parse_status & kUnexpectedFailure) {
+  if (lookup_data->parse_status & kUnexpectedFailure) {
     fprintf(stderr,
       "Pattern manager reported unexpected failure for structure %s and "
       "inputstring %s!\n",
       representation_.c_str(), inputstring.c_str());
     exit(EXIT_FAILURE);    
   }
-  // If inputstring was not parsed, return the struct
-  if (!(pattern_lookup->parse_status & kCanParse)) {
-    return pattern_lookup;
+}
+
+
+// Add the source ids of the structure and of each terminal of the given
+// string to source_ids.  The string must be parseable by this structure.
+//
+// This repeats the terminal lookups of lookup, but it is only called for the
+// structure that wins a PCFG::lookup, so the source id sets of the losing
+// structures are never built.
+//
+// Die on any failures.
+//
+void Structure::addSourceIDs(const std::string& inputstring,
+                             std::unordered_set<std::string>* source_ids)
+    const {
+  std::string unbroken_input =
+    grammartools::StripBreakCharacterFromTerminal(inputstring);
+
+  TerminalLookupData terminal_lookup;
+  size_t string_position = 0;
+  for (unsigned int i = 0; i < nonterminals_size_; ++i) {
+    size_t length = nonterminals_[i]->getRepresentation().size();
+    if (string_position + length > unbroken_input.size()) {
+      terminal_lookup.parse_status = kStructureNotFound;
+    } else {
+      nonterminals_[i]->lookup(unbroken_input.data() + string_position, length,
+                               &terminal_lookup);
+    }
+    if (!(terminal_lookup.parse_status & kCanParse) ||
+        !grammartools::AddSourceIDsFromString(
+          std::string(terminal_lookup.source_ids,
+                      terminal_lookup.source_ids_length),
+          *source_ids)) {
+      fprintf(stderr,
+        "Unable to add terminal source ids for structure %s and "
+        "inputstring %s to lookup data!\n",
+        representation_.c_str(), inputstring.c_str());
+      exit(EXIT_FAILURE);
+    }
+    string_position += length;
   }
-  if (!grammartools::AddSourceIDsFromString(source_ids_, 
-                                            pattern_lookup->source_ids)) {
+
+  if (!grammartools::AddSourceIDsFromString(source_ids_, *source_ids)) {
     fprintf(stderr,
       "Unable to add source ids \"%s\" for structure %s and "
       "inputstring %s to lookup data!\n",
       source_ids_.c_str(), representation_.c_str(), inputstring.c_str());
     exit(EXIT_FAILURE);
   }
-
-  return pattern_lookup;
 }
 
 
@@ -472,11 +645,11 @@ LookupData* Structure::lookup(const std::string& inputstring) const {
 // Returns 0 if the string cannot be parsed, otherwise returns 1.
 // 
 uint64_t Structure::countParses(const std::string& inputstring) const {
-  LookupData *pattern_lookup = lookup(inputstring);
-  // Free the index since we don't need it
-  mpz_clear(pattern_lookup->index);
+  LookupData pattern_lookup;
+  lookup(inputstring, &pattern_lookup);
+  bool can_parse = (pattern_lookup.parse_status & kCanParse);
 
-  if (pattern_lookup->parse_status & kCanParse)
+  if (can_parse)
     return 1;
   else
     return 0;
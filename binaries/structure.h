@@ -24,12 +24,19 @@
 #include <gmp.h>
 #include <string>
 #include <cstdint>
+#include <unordered_set>
 
 #include "pcfg.h"
+#include "big_count.h"
 #include "gcfmacros.h"
+#include "grammar_snapshot.h"
 #include "nonterminal.h"
 #include "nonterminal_collection.h"
+#include "nonterminal_lookup_memo.h"
 #include "lookup_data.h"
+#include "pattern_writer.h"
+#include "ordered_pattern_enumerator.h"
+#include "pattern_manager.h"
 
 // Forward declare class because we have circular includes to make generateStrings
 // work (it needs to query the parent PCFG for each string if we want accurate
@@ -55,31 +62,83 @@ public:
                      const std::string& source_ids,
                      NonterminalCollection* nonterminal_collection);
 
-  // By convention, mpz_t types are not returned, but are passed by reference
-  // See http://stackoverflow.com/a/13396028
-  void countStrings(mpz_t result) const;
-  bool generatePatterns(const double cutoff) const;
+  // Write the arguments of loadStructure to a grammar snapshot
+  void writeSnapshot(GrammarSnapshotWriter *writer) const;
+
+  // No pattern of this structure is more probable than the structure itself,
+  // so callers can skip structures below a cutoff without loading their
+  // nonterminals
+  double getProbability() const { return probability_; }
+
+  void countStrings(BigCount& result) const;
+  // Patterns are handed to the given writer.  To allow a structure to be
+  // split across threads, generation can be limited to patterns whose
+  // "split place" (see getSplitRadix) lies in [split_begin, split_end).
+  bool generatePatterns(const double cutoff,
+                        PatternWriter* writer,
+                        const uint64_t split_begin = 0,
+                        const uint64_t split_end = UINT64_MAX) const;
+  // Same patterns as generatePatterns, but written in order of decreasing
+  // probability using an OrderedPatternEnumerator.  Generation also stops
+  // once the patterns written cover at least guess_budget strings; a budget
+  // of zero means no limit.
+  bool generateOrderedPatterns(const double cutoff,
+                               const BigCount& guess_budget,
+                               PatternWriter* writer) const;
+  // Return a new, initialized enumerator over this structure's patterns, or
+  // NULL on failure.  The caller owns the enumerator.
+  OrderedPatternEnumerator* newOrderedPatternEnumerator(const double cutoff)
+    const;
+  // The split place is the first nonterminal with more than one terminal
+  // group.  Return the number of terminal groups at that place (1 if there is
+  // no such place, i.e., the structure has a single pattern).
+  uint64_t getSplitRadix() const;
+  // Return the number of patterns in this structure (ignoring the cutoff) as
+  // a double, for estimating how much work generatePatterns will be
+  double estimatePatternCount() const;
   // generateStrings has two "modes": returning the probability under this structure
   // and returning an "accurate" probability in which the probability of each string
   // under all structures is accumulated.  The second mode requires "calling up" to
   // the PCFG to query all structures, so we use a parent object.  Otherwise, we
   // have to generate some array of strings to send back to the PCFG and this might
-  // not fit in memory.
-  bool generateStrings(const double cutoff, 
+  // not fit in memory.  Strings are written to writer.
+  bool generateStrings(const double cutoff,
+                       TextStringWriter* writer,
                        const bool accurate_probabilities = false,
                        const PCFG* parent = NULL) const;
-  std::string 
-    convertStringToStructureRepresentation(const std::string& inputstring) const;
+  // Convert a string to its character-class representation, e.g., "pass12!"
+  // becomes "LLLLDDS"
+  static std::string 
+    convertStringToStructureRepresentation(const std::string& inputstring);
+  // Return the representation without break characters.  Only strings whose
+  // converted representation (with break characters stripped) equals this
+  // signature can be parsed by the structure.
+  std::string getSignature() const;
 
   // Count the number of ways the input string could be parsed by this structure
   // Returns 0 if the string cannot be parsed
   uint64_t countParses(const std::string& inputstring) const;
 
   // Given a string, determine if it can be produced by this structure and
-  // return a LookupData struct with relevant fields set
-  LookupData* lookup(const std::string& inputstring) const;
+  // fill in lookup_data with the relevant fields, except for source ids.  If
+  // memo is given, terminals are looked up through it (see
+  // nonterminal_lookup_memo.h).
+  void lookup(const std::string& inputstring, LookupData *lookup_data,
+              NonterminalLookupMemo *memo = NULL) const;
+  // Add the structure and terminal source ids for a string that this
+  // structure can parse
+  void addSourceIDs(const std::string& inputstring,
+                    std::unordered_set<std::string>* source_ids) const;
 
 private:
+  // Convert a single character to its character class, as in
+  // convertStringToStructureRepresentation
+  static char convertCharacterToStructureRepresentation(const char c);
+
+  // Index of the first nonterminal with more than one terminal group, or 0 if
+  // there is none
+  unsigned int findSplitPlace() const;
+
   // This must match the value used when the grammar was written
   static const char kStructureBreakChar = 'E';
 
@@ -89,6 +148,9 @@ private:
   std::string representation_;
   double probability_;
   unsigned int nonterminals_size_;
+  // Group ids, counts, and radices shared by the pattern managers created by
+  // lookups and generation methods
+  PatternMetadata pattern_metadata_;
 
   // Disable copy and assignment
   DISALLOW_COPY_AND_ASSIGN(Structure);
@@ -0,0 +1,208 @@
+// terminal_file.cpp - a read-only memory mapping of a terminals file
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "terminal_file.h"
+
+unsigned int TerminalFile::access_advice_ = TerminalFile::kAdviseNone;
+
+TerminalFile::~TerminalFile() {
+  if (data_ != NULL)
+    munmap(data_, size_);
+}
+
+
+// Open the file, get its length, and memory map it.  This is the code that
+// used to live in Nonterminal::loadNonterminal.
+bool TerminalFile::load(const std::string& filename,
+                        const std::string& representation) {
+  // Open the terminal file with open
+  int file_handle;
+  file_handle = open(filename.c_str(), O_RDONLY | O_NONBLOCK);
+  if (file_handle < 0) {
+    int saved_errno = errno;
+    perror("Error opening terminal file: ");
+    fprintf(stderr,
+      "Terminal filename: %s\nCalled for nonterminal represented by %s\n",
+      filename.c_str(), representation.c_str());
+    // Check if there error is too many open files in the process and output a
+    // special error message
+    if (saved_errno == EMFILE) {
+      fprintf(stderr,
+        "Error: Increase the open file limit of the OS. See INSTALL.md\n");
+    }
+    return false;
+  }
+
+  // Get file length
+  struct stat file_statistics;
+  if (fstat(file_handle, &file_statistics) < 0) {
+    perror("Error getting file size: ");
+    fprintf(stderr,
+      "Terminal filename: %s\nCalled for nonterminal represented by %s\n",
+      filename.c_str(), representation.c_str());
+    close(file_handle);
+    return false;
+  }
+  // Make sure we can cast these types and set size_
+  if (sizeof(off_t) == sizeof(size_t)) {
+    size_ = static_cast<size_t>(file_statistics.st_size);
+  } else {
+    fprintf(stderr,
+      "Unable to cast off_t as size_t in TerminalFile::load!"
+      " off_t has size %zu and size_t has size %zu!\n",
+      sizeof(off_t), sizeof(size_t));
+    close(file_handle);
+    return false;
+  }
+
+  // Memory map the terminal data file
+  int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (access_advice_ & kAdvisePopulate)
+    map_flags |= MAP_POPULATE;
+#endif
+  void *mapping = mmap(static_cast<caddr_t>(0), size_, PROT_READ, map_flags,
+                       file_handle, 0);
+  // waste not want not
+  close(file_handle);
+  if (mapping == MAP_FAILED) {
+    perror("Error in memory mapping terminal data file: ");
+    fprintf(stderr,
+      "Terminal filename: %s\nCalled for nonterminal represented by %s\n",
+      filename.c_str(), representation.c_str());
+    size_ = 0;
+    return false;
+  }
+  data_ = static_cast<char *>(mapping);
+  filename_ = filename;
+  inode_ = file_statistics.st_ino;
+  mtime_sec_ = file_statistics.st_mtim.tv_sec;
+  mtime_nsec_ = file_statistics.st_mtim.tv_nsec;
+  applyAccessAdvice();
+
+  return true;
+}
+
+
+// Same locking as SeenTerminalIndex::build
+bool TerminalFile::parseLines() const {
+  if (lines_parsed_.load(std::memory_order_acquire))
+    return parse_succeeded_;
+  std::lock_guard<std::mutex> lock(parse_mutex_);
+  if (!lines_parsed_.load(std::memory_order_relaxed)) {
+    parse_succeeded_ = parseLinesOnce();
+    if (!parse_succeeded_)
+      fprintf(stderr, "Error parsing terminals file %s!\n", filename_.c_str());
+    lines_parsed_.store(true, std::memory_order_release);
+  }
+  return parse_succeeded_;
+}
+
+
+// The seen section ends at the first blank line
+bool TerminalFile::parseLinesOnce() const {
+  // Count lines first so the table is allocated once
+  const char *data_end = data_ + size_;
+  size_t line_count = 0;
+  for (const char *newline = data_;
+       (newline = static_cast<const char *>(
+          memchr(newline, '\n', data_end - newline))) != NULL;
+       ++newline) {
+    ++line_count;
+  }
+  lines_.reserve(line_count + 1);
+
+  bool in_seen_lines = true;
+  const char *data_position = data_;
+  while (data_position < data_end) {
+    const char *newline = static_cast<const char *>(
+      memchr(data_position, '\n', data_end - data_position));
+    unsigned int length = (newline == NULL) ?
+      data_end - data_position : newline + 1 - data_position;
+    if (length == 1 && *data_position == '\n') {
+      in_seen_lines = false;
+    } else {
+      grammartools::TerminalLine line;
+      if (!grammartools::ParseNonterminalLine(data_position, length, &line))
+        return false;
+      lines_.push_back(line);
+      if (in_seen_lines)
+        seen_lines_size_ = lines_.size();
+    }
+    data_position += length;
+  }
+  return true;
+}
+
+
+// madvise errors are ignored, since the advice only affects performance
+void TerminalFile::applyAccessAdvice() const {
+  if (size_ == 0)
+    return;
+  if (access_advice_ & kAdviseSequential)
+    madvise(data_, size_, MADV_SEQUENTIAL);
+  if (access_advice_ & kAdviseWillNeed)
+    madvise(data_, size_, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+  if (access_advice_ & kAdviseHugePage)
+    madvise(data_, size_, MADV_HUGEPAGE);
+#endif
+}
+
+
+void TerminalFile::setAccessAdvice(const unsigned int advice) {
+  access_advice_ = advice;
+}
+
+
+bool TerminalFile::parseAccessAdvice(const std::string& names,
+                                     unsigned int *advice) {
+  unsigned int result = kAdviseNone;
+  std::istringstream namestream(names);
+  std::string name;
+  while (getline(namestream, name, ',')) {
+    if (name == "none")
+      continue;
+    else if (name == "sequential")
+      result |= kAdviseSequential;
+    else if (name == "willneed")
+      result |= kAdviseWillNeed;
+    else if (name == "hugepage")
+      result |= kAdviseHugePage;
+    else if (name == "populate")
+      result |= kAdvisePopulate;
+    else
+      return false;
+  }
+  *advice = result;
+  return true;
+}
+
+
+bool TerminalFile::setAccessAdviceOption(const char *names) {
+  unsigned int advice;
+  if (names == NULL || !parseAccessAdvice(names, &advice)) {
+    fprintf(stderr, "\nError: -madvise must be followed by a list of "
+                    "sequential, willneed, hugepage, and populate!\n");
+    return false;
+  }
+  setAccessAdvice(advice);
+  return true;
+}
@@ -0,0 +1,145 @@
+// terminal_file.h - a read-only memory mapping of a terminals file
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Nonterminals whose representations differ only in case (e.g., "UL" and
+// "LL") read the same terminals file, because terminals are stored
+// downcased.  A TerminalFile owns one mapping of such a file and is shared
+// between those nonterminals through a std::shared_ptr, so the file is mapped
+// once and unmapped when its last user is destroyed.
+//
+// NonterminalCollection keeps the TerminalFile objects, replacing the
+// function-local cache that Nonterminal::loadNonterminal used to keep.
+//
+// Terminals files can be many gigabytes, and on a cold page cache the page
+// faults of the first passes over them (building the seen terminal index,
+// finding terminal groups, and the repeated scans of the seen section by
+// unseen groups) can take longer than the rest of a job.  Access advice,
+// set once for the process with setAccessAdvice before the grammar is
+// loaded, is applied to every mapping:
+//
+//   sequential   madvise(MADV_SEQUENTIAL): aggressive readahead, and pages
+//                behind the reader are dropped first
+//   willneed     madvise(MADV_WILLNEED): start reading the whole file in the
+//                background.  Unseen terminals are a few lines at the end of
+//                a terminals file, so this is in effect the seen section.
+//   hugepage     madvise(MADV_HUGEPAGE), where the kernel supports it
+//   populate     map with MAP_POPULATE, reading the whole file before load
+//                returns
+//
+// Advice is only a hint, so a kernel that rejects it is not an error.  The
+// default is no advice, which leaves the kernel's usual readahead.
+//
+// The lines of the file are parsed once, by the first caller of parseLines,
+// into a table owned by the TerminalFile.  Terminal groups, their string
+// iterators, and the seen terminal index read terminals from the table
+// instead of parsing lines again, and since the table never changes once it
+// is built, they need no lock to read it.  The table points into the mapping,
+// so it lives exactly as long as the mapping does.
+//
+// A grammar snapshot records which terminals files it was compiled from, so
+// that it can be rejected once a file changes (see Nonterminal::loadSnapshot).
+// Each file is identified by its size, inode, and modification time, so that
+// an edit that keeps the size of the file is still caught.  The contents are
+// not hashed: that would read every terminals file in full whenever a
+// snapshot is loaded.
+//
+
+#ifndef TERMINAL_FILE_H__
+#define TERMINAL_FILE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gcfmacros.h"
+#include "grammar_tools.h"
+
+class TerminalFile {
+ public:
+  // Initialization is deferred to load
+  TerminalFile(): data_(NULL), size_(0), inode_(0), mtime_sec_(0),
+                  mtime_nsec_(0), seen_lines_size_(0), lines_parsed_(false),
+                  parse_succeeded_(false) {}
+  ~TerminalFile();
+
+  // Map the given file into memory.  representation is only used in error
+  // messages.  Return false on failure.
+  bool load(const std::string& filename, const std::string& representation);
+
+  // Access advice flags, combined with bitwise or
+  static const unsigned int kAdviseNone = 0;
+  static const unsigned int kAdviseSequential = 1;
+  static const unsigned int kAdviseWillNeed = 2;
+  static const unsigned int kAdviseHugePage = 4;
+  static const unsigned int kAdvisePopulate = 8;
+
+  // Set the advice used by later calls to load
+  static void setAccessAdvice(const unsigned int advice);
+  // Parse a comma-separated list of advice names, as in the header comment,
+  // or "none".  Return false if a name is not recognized.
+  static bool parseAccessAdvice(const std::string& names,
+                                unsigned int *advice);
+  // Handle the argument of a tool's -madvise option, which is NULL if the
+  // option was last on the command line: parse it and set the advice, or
+  // print an error and return false.
+  static bool setAccessAdviceOption(const char *names);
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Parse the lines of the file into the line table.  Only the first call
+  // does any work; later calls wait for it and return its result.  Return
+  // false if a line cannot be parsed.
+  bool parseLines() const;
+
+  // The line table, valid once parseLines has returned true.  Blank lines are
+  // left out, so the seen terminals are lines [0, seenLinesSize()), and the
+  // unseen terminal groups are the lines after them.
+  const grammartools::TerminalLine& line(const uint64_t index) const {
+    return lines_[index];
+  }
+  uint64_t linesSize() const { return lines_.size(); }
+  uint64_t seenLinesSize() const { return seen_lines_size_; }
+
+  // The identity of the file when it was loaded, as recorded in grammar
+  // snapshots
+  uint64_t inode() const { return inode_; }
+  int64_t mtimeSeconds() const { return mtime_sec_; }
+  int64_t mtimeNanoseconds() const { return mtime_nsec_; }
+
+ private:
+  // Apply access_advice_ to the current mapping
+  void applyAccessAdvice() const;
+  // Does the work of parseLines
+  bool parseLinesOnce() const;
+
+  static unsigned int access_advice_;
+
+  char *data_;
+  size_t size_;
+  std::string filename_;
+  uint64_t inode_;
+  int64_t mtime_sec_;
+  int64_t mtime_nsec_;
+
+  // Filled in by parseLines, hence mutable
+  mutable std::vector<grammartools::TerminalLine> lines_;
+  mutable uint64_t seen_lines_size_;
+  // Set, under parse_mutex_, once lines_ is complete
+  mutable std::atomic<bool> lines_parsed_;
+  mutable bool parse_succeeded_;
+  mutable std::mutex parse_mutex_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(TerminalFile);
+};
+
+
+#endif  // TERMINAL_FILE_H__
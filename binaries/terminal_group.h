@@ -29,9 +29,9 @@
 #ifndef TERMINAL_GROUP_H__
 #define TERMINAL_GROUP_H__
 
-#include <gmp.h>
 #include <string>
 
+#include "big_count.h"
 #include "lookup_data.h"
 
 class TerminalGroup {
@@ -45,22 +45,21 @@ public:
 
   virtual ~TerminalGroup() {}
 
-  void countStrings(mpz_t result) { 
-    mpz_init_set(result, terminals_size_); 
+  void countStrings(BigCount& result) const {
+    result = terminals_size_;
   }
   double getProbability() { return probability_; }
   // Return the "first" string of the terminal (used for string representation)
   virtual const std::string& getFirstString() const = 0;
 
-  // Look up a terminal in this group
-  // Returns a LookupData struct with relevant fields set
-  virtual LookupData* lookup(const char *terminal) const = 0;
+  // Look up a terminal in this group and fill in lookup_data, except for
+  // terminal_group_index, which is up to the caller
+  virtual void lookup(const char *terminal,
+                      TerminalLookupData *lookup_data) const = 0;
 
-  // Return just the "index" of the given string in the terminal group (-1 if 
-  // no match).  
-  // By convention, mpz_t types are not returned, but are passed by reference.
-  // See http://stackoverflow.com/a/13396028
-  virtual void indexInTerminalGroup(mpz_t result, 
+  // Set result to just the "index" of the given string in the terminal group
+  // and return true, or return false if there is no match.
+  virtual bool indexInTerminalGroup(BigCount& result,
                                     const char *teststring) const = 0;
 
   class TerminalGroupStringIterator {
@@ -105,7 +104,7 @@ protected:
 
   // For convenience we need to have the number of terminals covered by this
   // group available and the first string.
-  mpz_t terminals_size_;
+  BigCount terminals_size_;
   std::string first_string_;
 };
 
@@ -0,0 +1,220 @@
+// text_codec.cpp - conversion of probabilities and counts to and from the text
+//   used by the grammar, raw tables, and lookup tables
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+// Includes not covered in header file
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "text_codec.h"
+
+namespace textcodec {
+
+namespace {
+
+const char kHexDigits[] = "0123456789abcdef";
+
+// Pairs of decimal digits, "00" through "99"
+const char kDigitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// Fields of an IEEE 754 double
+const int kMantissaBits = 52;
+const int kMantissaDigits = kMantissaBits / 4;
+const uint64_t kMantissaMask = (UINT64_C(1) << kMantissaBits) - 1;
+const int kExponentMask = 0x7ff;
+const int kExponentBias = 1023;
+
+// Return the value of a hex digit, or -1
+inline int HexDigitValue(const char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+}  // namespace
+
+
+// glibc writes normal numbers as 0x1.<fraction>p<exponent> and subnormals
+// and zero as 0x0.<fraction>p-1022 (0x0p+0 for zero), dropping trailing zero
+// digits of the fraction and the point if none are left
+size_t FormatHexFloat(const double value, char *buffer) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int biased_exponent = static_cast<int>(bits >> kMantissaBits) & kExponentMask;
+  if (biased_exponent == kExponentMask)
+    return snprintf(buffer, kHexFloatBufferSize, "%a", value);
+  uint64_t mantissa = bits & kMantissaMask;
+
+  char *position = buffer;
+  *position = '-';
+  position += (bits >> 63);
+  *position++ = '0';
+  *position++ = 'x';
+  *position++ = (biased_exponent != 0) ? '1' : '0';
+
+  int exponent;
+  if (biased_exponent != 0)
+    exponent = biased_exponent - kExponentBias;
+  else
+    exponent = (mantissa != 0) ? 1 - kExponentBias : 0;
+
+  if (mantissa != 0) {
+    int digits = kMantissaDigits - __builtin_ctzll(mantissa) / 4;
+    *position++ = '.';
+    for (int i = 0; i < digits; ++i)
+      position[i] = kHexDigits[(mantissa >> (kMantissaBits - 4 * (i + 1))) &
+                               0xf];
+    position += digits;
+  }
+
+  *position++ = 'p';
+  *position++ = (exponent < 0) ? '-' : '+';
+  unsigned int magnitude = (exponent < 0) ? -exponent : exponent;
+  position += FormatUint64(magnitude, position);
+  return position - buffer;
+}
+
+
+void AppendHexFloat(const double value, std::string *output) {
+  char buffer[kHexFloatBufferSize];
+  output->append(buffer, FormatHexFloat(value, buffer));
+}
+
+
+// The direct path takes [-]0x1[.<at most 13 digits>]p<sign><digits> for a
+// normal exponent, which holds exactly the bits of the result
+double ParseDouble(const char *str, const char **end) {
+  const char *position = str;
+  bool negative = (*position == '-');
+  position += negative;
+  if (position[0] != '0' || (position[1] != 'x' && position[1] != 'X') ||
+      position[2] != '1')
+    goto fallback;
+  position += 3;
+
+  {
+    uint64_t mantissa = 0;
+    int digits = 0;
+    if (*position == '.') {
+      ++position;
+      int digit;
+      while ((digit = HexDigitValue(*position)) >= 0) {
+        if (digits == kMantissaDigits)
+          goto fallback;
+        mantissa = (mantissa << 4) | digit;
+        ++digits;
+        ++position;
+      }
+    }
+    mantissa <<= 4 * (kMantissaDigits - digits);
+
+    if (*position != 'p' && *position != 'P')
+      goto fallback;
+    ++position;
+    bool negative_exponent = (*position == '-');
+    if (*position == '-' || *position == '+')
+      ++position;
+    int exponent = 0;
+    int exponent_digits = 0;
+    while (*position >= '0' && *position <= '9') {
+      if (exponent_digits == 4)
+        goto fallback;
+      exponent = exponent * 10 + (*position - '0');
+      ++exponent_digits;
+      ++position;
+    }
+    if (exponent_digits == 0)
+      goto fallback;
+    if (negative_exponent)
+      exponent = -exponent;
+    if (exponent < 1 - kExponentBias || exponent > kExponentBias)
+      goto fallback;
+
+    uint64_t bits = (static_cast<uint64_t>(negative) << 63) |
+                    (static_cast<uint64_t>(exponent + kExponentBias) <<
+                       kMantissaBits) |
+                    mantissa;
+    double result;
+    memcpy(&result, &bits, sizeof(result));
+    if (end != NULL)
+      *end = position;
+    return result;
+  }
+
+ fallback:
+  char *strtod_end;
+  double result = strtod(str, &strtod_end);
+  if (end != NULL)
+    *end = strtod_end;
+  return result;
+}
+
+
+// Digits are produced two at a time from the end
+size_t FormatUint64(const uint64_t value, char *buffer) {
+  char digits[kUint64BufferSize];
+  char *position = digits + sizeof(digits);
+  uint64_t remaining = value;
+  while (remaining >= 100) {
+    unsigned int pair = static_cast<unsigned int>(remaining % 100);
+    remaining /= 100;
+    position -= 2;
+    memcpy(position, &kDigitPairs[2 * pair], 2);
+  }
+  if (remaining >= 10) {
+    position -= 2;
+    memcpy(position, &kDigitPairs[2 * remaining], 2);
+  } else {
+    *--position = static_cast<char>('0' + remaining);
+  }
+
+  size_t length = digits + sizeof(digits) - position;
+  memcpy(buffer, position, length);
+  buffer[length] = '\0';
+  return length;
+}
+
+
+void AppendUint64(const uint64_t value, std::string *output) {
+  char buffer[kUint64BufferSize];
+  output->append(buffer, FormatUint64(value, buffer));
+}
+
+
+// Numbers of up to 19 digits always fit; a 20th digit needs overflow checks
+bool ParseUint64(const char *str, const size_t length, uint64_t *value) {
+  if (length == 0 || length > 20)
+    return false;
+  uint64_t result = 0;
+  for (size_t i = 0; i < length; ++i) {
+    unsigned int digit = static_cast<unsigned char>(str[i]) - '0';
+    if (digit > 9)
+      return false;
+    if (i < 19) {
+      result = result * 10 + digit;
+    } else if (__builtin_mul_overflow(result, 10, &result) ||
+               __builtin_add_overflow(result, digit, &result)) {
+      return false;
+    }
+  }
+  *value = result;
+  return true;
+}
+
+}  // namespace textcodec
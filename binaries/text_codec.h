@@ -0,0 +1,63 @@
+// text_codec.h - conversion of probabilities and counts to and from the text
+//   used by the grammar, raw tables, and lookup tables
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Probabilities are exchanged between tools as hex floats (printf "%a") so
+// that they round-trip exactly, and counts and guess numbers as base-10
+// integers.  Every line of every table goes through these conversions at
+// least twice, and printf, strtod, and the GMP string functions, which handle
+// every locale, format, and base, were measurable in each stage of the
+// pipeline.
+//
+// The functions below produce and accept exactly the text the tools always
+// have.  Hex floats are formatted straight from the bits of the double, so
+// the output matches glibc's "%a" (lowercase, no trailing zero digits, and an
+// explicit exponent sign); infinities and NaNs, which no table should
+// contain, are handed to snprintf.  Parsing takes the direct path for that
+// same format and falls back to strtod for anything else, e.g., decimal
+// probabilities or a hex float with more digits than a double holds.
+// Integers have native paths for values below 2^64; BigCount uses them, and
+// hands larger values to GMP.
+//
+// Functions are declared within the textcodec namespace
+//
+
+#ifndef TEXT_CODEC_H__
+#define TEXT_CODEC_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace textcodec {
+
+// Buffer sizes, including the terminating null, that hold any output of
+// FormatHexFloat and FormatUint64
+const size_t kHexFloatBufferSize = 32;
+const size_t kUint64BufferSize = 24;
+
+// Write value as printf("%a") would, null-terminated, and return its length
+size_t FormatHexFloat(const double value, char *buffer);
+void AppendHexFloat(const double value, std::string *output);
+
+// Parse a floating-point number at the start of str as strtod does, and set
+// *end (if not NULL) to the first character after it
+double ParseDouble(const char *str, const char **end = NULL);
+
+// Write value in base 10, null-terminated, and return its length
+size_t FormatUint64(const uint64_t value, char *buffer);
+void AppendUint64(const uint64_t value, std::string *output);
+
+// Parse the length base-10 digits at str.  Return false, leaving value
+// unchanged, if they are not all digits, there are none, or the number does
+// not fit in 64 bits.
+bool ParseUint64(const char *str, const size_t length, uint64_t *value);
+
+}  // namespace textcodec
+
+
+#endif  // TEXT_CODEC_H__
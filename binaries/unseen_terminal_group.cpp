@@ -19,8 +19,8 @@
 #include <cstdint>
 #include <climits>
 #include <memory> // shared
+#include <algorithm>
 #include "grammar_tools.h"
-#include "bit_array.h"
 
 #include <string.h>
 
@@ -41,10 +41,10 @@ UnseenTerminalGroup::UnseenTerminalGroup(const char *terminal_data,
                     out_representation),
       terminal_data_size_(terminal_data_size),
       generator_mask_(generator_mask),
-      total_probability_mass_(probability) {
+      total_probability_mass_(probability),
+      seen_index_limbs_(0),
+      index_width_(kIndexWidthGMP) {
   // Iterate over the terminal data to get the number of seen terminals
-  mpz_init(terminals_size_);
-
   // To work quickly with terminals, there are a number of class variables that
   // need to be initialized
   initCharacterLookups();
@@ -64,6 +64,50 @@ UnseenTerminalGroup::UnseenTerminalGroup(const char *terminal_data,
 }
 
 
+// Same as the constructor above, but with the seen_indices_size limbs of the
+// sorted seen indices already found (see readSnapshot), so the seen terminals
+// are not scanned
+UnseenTerminalGroup::UnseenTerminalGroup(const char *terminal_data, 
+                                         const double probability,
+                                         const std::string& generator_mask,
+                                         const std::string& out_representation,
+                                         const size_t terminal_data_size,
+                                         const void *seen_indices,
+                                         const size_t seen_indices_size)
+    : TerminalGroup(terminal_data,
+                    0,
+                    out_representation),
+      terminal_data_size_(terminal_data_size),
+      generator_mask_(generator_mask),
+      total_probability_mass_(probability),
+      seen_index_limbs_(0),
+      index_width_(kIndexWidthGMP) {
+  initCharacterLookups();
+  out_matching_needed_ = (out_representation_.find('U') != std::string::npos);
+
+  initTotalTerminals();
+  initNativeIndexing();
+  seen_index_limbs_ = mpz_size(total_terminals_);
+  if (seen_indices_size % seen_index_limbs_ != 0) {
+    fprintf(stderr, "Seen indices do not match generator mask: %s in "
+                    "UnseenTerminalGroup with out_representation_: %s!\n",
+                    generator_mask_.c_str(), out_representation_.c_str());
+    exit(EXIT_FAILURE);
+  }
+  // seen_indices need not be aligned
+  seen_indices_.resize(seen_indices_size);
+  if (seen_indices_size > 0)
+    memcpy(seen_indices_.data(), seen_indices,
+           seen_indices_size * sizeof(mp_limb_t));
+
+  if (!initUnseenTerminals()) {
+    fprintf(stderr, "Failed processing seen terminals in UnseenTerminalGroup"
+                    " constructor!\n");
+    exit(EXIT_FAILURE);    
+  }
+}
+
+
 // Called from the constructor, this routine iterates over the seen terminals
 // in terminal_data_ and determines the count of seen terminals 
 // (seen_terminals_size_), count of unseen terminals (terminals_size_),
@@ -77,8 +121,17 @@ bool UnseenTerminalGroup::processSeenTerminals() {
   // Iterate over terminal_data_ until we reach a blank line
   const char *data_position = terminal_data_;
   size_t bytes_remaining = terminal_data_size_;
-  unsigned long int seen_terminals_size = 0;
   unsigned long int seen_terminals_cant_be_generated = 0;
+
+  // total_terminals_ gives the width of the seen indices recorded below
+  initTotalTerminals();
+  initNativeIndexing();
+  seen_index_limbs_ = mpz_size(total_terminals_);
+  mpz_t terminal_index;
+  mpz_init(terminal_index);
+  // Terminals are not null-terminated in the terminal data
+  std::string terminal;
+
   while (bytes_remaining > 0) {
     // Read the current line
     unsigned int bytes_read;
@@ -90,14 +143,20 @@ bool UnseenTerminalGroup::processSeenTerminals() {
     }
 
     // Else parse the line
-    const char *terminal, *source_ids;
-    double probability;
-    grammartools::ParseNonterminalLine(data_position, bytes_read, &terminal,
-                                       probability, &source_ids);
+    grammartools::TerminalLine line;
+    if (!grammartools::ParseNonterminalLine(data_position, bytes_read, &line)) {
+      mpz_clear(terminal_index);
+      return false;
+    }
+    terminal.assign(line.terminal, line.terminal_length);
 
     // Check if this terminal can actually be produced by the generator mask
-    if (canGenerateTerminal(terminal)) {
-      seen_terminals_size++;
+    if (canGenerateTerminal(terminal.c_str())) {
+      // Record its index in terminal space
+      terminalIndex(terminal_index, terminal.c_str());
+      size_t position = seen_indices_.size();
+      seen_indices_.resize(position + seen_index_limbs_);
+      exportSeenIndex(terminal_index, &seen_indices_[position]);
     } else {
       seen_terminals_cant_be_generated++;
     }
@@ -106,85 +165,47 @@ bool UnseenTerminalGroup::processSeenTerminals() {
     data_position += bytes_read;
     bytes_remaining -= bytes_read;
   }  // end while (bytes_remaining > 0)
+  mpz_clear(terminal_index);
+  sortSeenIndices();
 
-  // Set total_terminals_ and terminals_size_
-  // do they have to be mp ints? if so, they couldn't fit in a file.
-  initTotalTerminals();
-  mpz_t sts;
-  mpz_init_set_ui(sts, seen_terminals_size);
-  if (mpz_cmp(sts, total_terminals_) >= 0) {
-    char *sts_string = mpz_get_str(NULL, 10, sts);
-    char *tt_string  = mpz_get_str(NULL, 10, total_terminals_);
+  return initUnseenTerminals();
+}
+
+
+// Set terminals_size_, probability_, and first_string_ from seen_indices_,
+// which must be sorted
+//
+// Return false on any error
+//
+bool UnseenTerminalGroup::initUnseenTerminals() {
+  uint64_t seen_terminals_size = countSeenIndices();
+
+  // Set terminals_size_
+  BigCount total_terminals(total_terminals_);
+  if (BigCount::cmp(total_terminals, seen_terminals_size) <= 0) {
     fprintf(stderr, "Unexpected error!\n"
                     "seen_terminals_size exceeds total_terminals_ found!\n"
-                    "seen_terminals_size: %s\n"
+                    "seen_terminals_size: %lu\n"
                     "total_terminals_: %s\n",
-                    sts_string, tt_string);
+                    static_cast<unsigned long>(seen_terminals_size),
+                    total_terminals.toString().c_str());
     return false;
   }
-  mpz_sub(terminals_size_, total_terminals_, sts);
-  probability_ = total_probability_mass_ / mpz_get_d(terminals_size_);
-  // Cleanup intermediate BigInts
-  mpz_clear(sts);
-
-
-  // Finally, we need to determine the value of the first unseen string.
-  // We use the findUnseenTerminals method to make a pass through all seen
-  // terminals and mark them in a BitArray.
-  // After one pass, we check for the smallest index *not* found in the vector.
-  // If the vector is full, we move to the next region of the terminal
-  // space and perform another pass.  This continues until some unseen string
-  // has been found.
-  mpz_t region_start;
-  mpz_init_set_ui(region_start, 0);
-  bool first_open_index_found = false;
-  bool space_traversed = false;
-  if (static_bitarray == nullptr) {
-    // fprintf(stderr, "Initializing static BitArray object...");
-    static_bitarray = new BitArray(kTerminalSearchRegionSize);    
-    // fprintf(stderr, "done!\n");
-  }
-  if (ba_in_use) {
-    fprintf(stderr, "BitArray seems to be in use!\n");
-    exit(EXIT_FAILURE);
-  }
-  ba_in_use = true;
-  BitArray *found_terminals = static_bitarray;
-  while (!first_open_index_found && !space_traversed) {
-    findUnseenTerminals(region_start, kTerminalSearchRegionSize, found_terminals);
-
-    // Check if this iteration took us to the end of the region
-    mpz_t region_end;
-    mpz_init(region_end);
-    mpz_add_ui(region_end, region_start, kTerminalSearchRegionSize);
-    if (mpz_cmp(total_terminals_, region_end) < 0) {
-      space_traversed = true;
-    }
+  BigCount::sub(terminals_size_, total_terminals, seen_terminals_size);
+  probability_ = total_probability_mass_ / terminals_size_.getDouble();
 
-    // Check BitArray for an unseen terminal
-    unsigned long int open_terminal = found_terminals->findNextOpenSpace(0);
-    if (open_terminal < found_terminals->getSize()) {
-      // Found an unseen terminal!
-      mpz_t open_terminal_index;
-      mpz_init(open_terminal_index);
-      mpz_add_ui(open_terminal_index, region_start, open_terminal);
-
-      // Set first string using the open terminal index
-      // Use c_str() to ensure a deep copy
-      first_string_ = generateTerminal(open_terminal_index).c_str();
-
-      // Set flag so we don't loop anymore
-      first_open_index_found = true;
-      mpz_clear(open_terminal_index);
-    }
 
-    // Move region forward
-    mpz_set(region_start, region_end);
-    mpz_clear(region_end);
-  }  // end while (!first_open_index_found && !space_traversed)  
-  // delete found_terminals;
-  ba_in_use = false;  // free the lock
-  mpz_clear(region_start);
+  // Finally, we need to determine the value of the first unseen string, the
+  // first index in terminal space that is not taken by a seen terminal.
+  mpz_t first_open_index;
+  mpz_init(first_open_index);
+  bool first_open_index_found = findFirstUnseenIndex(first_open_index);
+  if (first_open_index_found) {
+    // Set first string using the open terminal index
+    // Use c_str() to ensure a deep copy
+    first_string_ = generateTerminal(first_open_index).c_str();
+  }
+  mpz_clear(first_open_index);
 
   if (!first_open_index_found) {
     // If here, we traversed the whole space and didn't find an open spot
@@ -200,6 +221,64 @@ bool UnseenTerminalGroup::processSeenTerminals() {
 
 
 
+// A snapshot record holds the constructor arguments that are not shared with
+// the nonterminal, and the sorted seen indices: probability mass, generator
+// mask, limbs per index, and the number of limbs followed by the limbs
+void UnseenTerminalGroup::writeSnapshot(GrammarSnapshotWriter *writer) const {
+  writer->writeDouble(total_probability_mass_);
+  writer->writeString(generator_mask_);
+  writer->writeUint64(seen_index_limbs_);
+  writer->writeUint64(seen_indices_.size());
+  writer->writeBytes(seen_indices_.data(),
+                     seen_indices_.size() * sizeof(mp_limb_t));
+}
+
+
+UnseenTerminalGroup* UnseenTerminalGroup::readSnapshot(
+    GrammarSnapshotReader *reader,
+    const char *terminal_data,
+    const size_t terminal_data_size,
+    const std::string& out_representation) {
+  double probability;
+  std::string generator_mask;
+  uint64_t seen_index_limbs, seen_indices_size;
+  const void *seen_indices;
+  if (!reader->readDouble(&probability) ||
+      !reader->readString(&generator_mask) ||
+      !reader->readUint64(&seen_index_limbs) ||
+      !reader->readUint64(&seen_indices_size) ||
+      seen_indices_size > SIZE_MAX / sizeof(mp_limb_t) ||
+      !reader->readBytes(&seen_indices,
+                         seen_indices_size * sizeof(mp_limb_t))) {
+    return NULL;
+  }
+
+  UnseenTerminalGroup *group =
+    new UnseenTerminalGroup(terminal_data, probability, generator_mask,
+                            out_representation, terminal_data_size,
+                            seen_indices, seen_indices_size);
+  // Limb counts would differ if the snapshot came from a different build
+  if (group->seen_index_limbs_ != seen_index_limbs) {
+    delete group;
+    return NULL;
+  }
+  return group;
+}
+
+
+bool UnseenTerminalGroup::skipSnapshot(GrammarSnapshotReader *reader) {
+  uint64_t generator_mask_size, seen_indices_size;
+  const void *field;
+  return reader->readBytes(&field, sizeof(double)) &&
+         reader->readUint64(&generator_mask_size) &&
+         reader->readBytes(&field, generator_mask_size) &&
+         reader->readBytes(&field, sizeof(uint64_t)) &&
+         reader->readUint64(&seen_indices_size) &&
+         seen_indices_size <= SIZE_MAX / sizeof(mp_limb_t) &&
+         reader->readBytes(&field, seen_indices_size * sizeof(mp_limb_t));
+}
+
+
 // Initialize character lookup arrays -- these arrays allow for quick
 // lookups of character types rather than checking for values in an ASCII
 // range or searching through the kGeneratorSymbols string
@@ -293,6 +372,109 @@ bool UnseenTerminalGroup::canGenerateTerminal(const char *terminal) const {
 }
 
 
+// Private initialization function -- build the per-position tables of the
+// generator mask and choose the native integer width for indices, now that
+// total_terminals_ is known.  initTotalTerminals has already rejected any
+// unexpected characters in the mask.
+//
+void UnseenTerminalGroup::initNativeIndexing() {
+  mask_bases_.resize(generator_mask_.size());
+  mask_char_to_int_.resize(generator_mask_.size());
+  mask_int_to_char_.resize(generator_mask_.size());
+  for (unsigned int i = 0; i < generator_mask_.size(); ++i) {
+    switch (generator_mask_[i]) {
+      case 'L':
+        mask_bases_[i] = 26;
+        mask_char_to_int_[i] = l_char_to_int_;
+        mask_int_to_char_[i] = l_int_to_char_;
+        break;
+      case 'D':
+        mask_bases_[i] = 10;
+        mask_char_to_int_[i] = d_char_to_int_;
+        mask_int_to_char_[i] = d_int_to_char_;
+        break;
+      default:  // 'S'
+        mask_bases_[i] = kGeneratorSymbols.size();
+        mask_char_to_int_[i] = s_char_to_int_;
+        mask_int_to_char_[i] = kGeneratorSymbols.c_str();
+        break;
+    }
+  }
+
+  // Every index is below total_terminals_
+  size_t index_bits = mpz_sizeinbase(total_terminals_, 2);
+  if (index_bits <= 64 && sizeof(unsigned long int) >= sizeof(uint64_t))
+    index_width_ = kIndexWidth64;
+#ifdef __SIZEOF_INT128__
+  else if (index_bits <= 128)
+    index_width_ = kIndexWidth128;
+#endif
+  else
+    index_width_ = kIndexWidthGMP;
+}
+
+
+#ifdef __SIZEOF_INT128__
+// Conversions between mpz_t and 128-bit integers, through 64-bit words
+static void SetMpzFromUint128(mpz_t result, unsigned __int128 value) {
+  uint64_t words[2] = { static_cast<uint64_t>(value),
+                        static_cast<uint64_t>(value >> 64) };
+  mpz_import(result, 2, -1, sizeof(uint64_t), 0, 0, words);
+}
+
+static unsigned __int128 GetUint128FromMpz(const mpz_t value) {
+  uint64_t words[2] = { 0, 0 };
+  mpz_export(words, NULL, -1, sizeof(uint64_t), 0, 0, value);
+  return (static_cast<unsigned __int128>(words[1]) << 64) | words[0];
+}
+#endif
+
+
+void UnseenTerminalGroup::reportUngeneratableCharacter(const char *terminal,
+                                                       int position) const {
+  fprintf(stderr, "character_index for character i: %d in generator_mask_"
+                  ": %s is -1 indicating that this character: %c in "
+                  "terminal: %s cannot be generated!\n"
+                  "  In terminalIndex with out_representation_: %s!\n",
+                  position, generator_mask_.c_str(), terminal[position],
+                  terminal, out_representation_.c_str());
+  exit(EXIT_FAILURE);
+}
+
+
+// Same mixed-radix conversion as terminalIndex, in a native integer
+template <typename IndexType>
+IndexType UnseenTerminalGroup::terminalIndexNative(const char *terminal) const {
+  IndexType result = 0;
+  for (int i = static_cast<int>(mask_bases_.size()) - 1; i >= 0; --i) {
+    int character_index = mask_char_to_int_[i][(unsigned char)terminal[i]];
+    if (character_index < 0)
+      reportUngeneratableCharacter(terminal, i);
+    result = result * mask_bases_[i] + static_cast<unsigned int>(character_index);
+  }
+  return result;
+}
+
+
+// Same conversion as generateTerminal, in a native integer
+template <typename IndexType>
+std::string UnseenTerminalGroup::generateTerminalNative(
+    IndexType terminal_index) const {
+  std::string generated_terminal(mask_bases_.size(), '\0');
+  for (unsigned int i = 0; i < mask_bases_.size(); ++i) {
+    unsigned int character_value =
+      static_cast<unsigned int>(terminal_index % mask_bases_[i]);
+    generated_terminal[i] = mask_int_to_char_[i][character_value];
+    terminal_index /= mask_bases_[i];
+  }
+
+  if (out_matching_needed_)
+    matchOutRepresentation(generated_terminal);
+
+  return generated_terminal;
+}
+
+
 // Given a terminal that can be generated, return its index
 // NOTE: assumes that canGenerateTerminal has already been called!  If this
 // terminal cannot be generated, the return value is indeterminate.
@@ -310,6 +492,22 @@ bool UnseenTerminalGroup::canGenerateTerminal(const char *terminal) const {
 void UnseenTerminalGroup::terminalIndex(mpz_t resultout,
                                         const char *terminal, 
                                         mpz_t region_end /*= NULL*/) const {
+  // Use a native integer if terminal space is small enough.  The full index
+  // is cheap to compute, so region_end is not needed.
+  switch (index_width_) {
+    case kIndexWidth64:
+      mpz_set_ui(resultout, terminalIndexNative<uint64_t>(terminal));
+      return;
+#ifdef __SIZEOF_INT128__
+    case kIndexWidth128:
+      SetMpzFromUint128(resultout,
+                        terminalIndexNative<unsigned __int128>(terminal));
+      return;
+#endif
+    default:
+      break;
+  }
+
   // 15% of values repeat
   BigCount result;
   std::shared_ptr<BigCount> end;
@@ -379,6 +577,18 @@ void UnseenTerminalGroup::terminalIndex(mpz_t resultout,
 // Note: This function will *destroy* the value of terminal_index.
 //
 std::string UnseenTerminalGroup::generateTerminal(mpz_t terminal_index) const {
+  switch (index_width_) {
+    case kIndexWidth64:
+      return generateTerminalNative<uint64_t>(mpz_get_ui(terminal_index));
+#ifdef __SIZEOF_INT128__
+    case kIndexWidth128:
+      return generateTerminalNative<unsigned __int128>(
+        GetUint128FromMpz(terminal_index));
+#endif
+    default:
+      break;
+  }
+
   // String to store the result
   std::string generated_terminal = "";
 
@@ -436,84 +646,93 @@ std::string UnseenTerminalGroup::generateTerminal(mpz_t terminal_index) const {
 }
 
 
-// Helper function -- given an index to the start of a region in terminal space,
-// a size for that region, and a BitArray, modify the BitArray so that elements
-// are marked true for seen terminals, and false otherwise.
+// Return the lowest index in terminal space that is not a seen terminal, in
+// result, which must be initialized.  Return false if every index is seen.
 //
-void UnseenTerminalGroup::findUnseenTerminals(
-    mpz_t region_start, unsigned long int region_size, BitArray *found_terminals) const {
-
-  // Determine true region size if region_start + region_size is greater than
-  // total_terminals_
-  unsigned long int true_region_size = region_size;
-  mpz_t region_end;
-  mpz_init(region_end);
-  mpz_add_ui(region_end, region_start, region_size - 1);
-  // total_terminals_ is a count, but region* are zero-indexed values, so
-  // region_end should be at most total_terminals_ - 1, so if total_terminals_
-  // is equal to region_end, we still need to shrink the region
-  if (mpz_cmp(total_terminals_, region_end) <= 0) {
-    mpz_sub_ui(region_end, total_terminals_, 1);
-    // Get true region size = region_end - region_start + 1
-    mpz_t true_size;
-    mpz_init(true_size);
-    mpz_sub(true_size, region_end, region_start);
-    mpz_add_ui(true_size, true_size, 1);
-    true_region_size = mpz_get_ui(true_size);
-    mpz_clear(true_size);
+// seen_indices_ is sorted, so the first unseen index is the first gap in it.
+bool UnseenTerminalGroup::findFirstUnseenIndex(mpz_t result) const {
+  size_t limbs = seen_index_limbs_;
+  uint64_t count = countSeenIndices();
+  std::vector<mp_limb_t> candidate(limbs, 0);
+  for (uint64_t position = 0; position < count; ++position) {
+    int comparison = mpn_cmp(&seen_indices_[position * limbs],
+                             candidate.data(), limbs);
+    if (comparison > 0)
+      break;  // Found a gap at candidate
+    if (comparison == 0)
+      mpn_add_1(candidate.data(), candidate.data(), limbs, 1);
+    // Duplicates of an index below the candidate are skipped
   }
-  // Set the region to false
-  found_terminals->clear(true_region_size);
-
-  // Pass over all seen terminals, convert them to lexicographic indices
-  // in base-10, e.g., aaaaa = 0, aaaab = 1, etc., and mark the found
-  // indices in a boolean vector of fixed size, e.g., from 0 to
-  // region_size - 1.
-  //
-  // To speed determination of whether a given seen terminal is in our region
-  // we use the region_end argument of terminalIndex (see below).
-  const char *data_position = terminal_data_;
-  size_t bytes_remaining = terminal_data_size_;
+  mpz_import(result, limbs, -1, sizeof(mp_limb_t), 0, 0, candidate.data());
+  return mpz_cmp(result, total_terminals_) < 0;
+}
 
-  // init this once, rely on terminalIndex overwriting it
-  mpz_t terminal_index;
-  mpz_init(terminal_index);
 
-  while (bytes_remaining > 0) {
-    // Read the current line
-    unsigned int bytes_read;
-    grammartools::ReadLineFromCharArray2(data_position,
-                                        bytes_read);
-    if (bytes_read == 1) {
-      break;
-    }
-    const char *terminal, *source_ids;
-    double probability;
-    grammartools::ParseNonterminalLine(data_position, bytes_read, &terminal,
-                                       probability, &source_ids);
-
-    // If this terminal can be generated, get its index and store in
-    // the BitArray if the index of the terminal is within our region
-    // of consideration
-    if (canGenerateTerminal(terminal)) {
-      terminalIndex(terminal_index, terminal, region_end);
-      if (mpz_cmp(terminal_index, region_end) <= 0 &&
-          mpz_cmp(region_start, terminal_index) <= 0) {
-        // Adjust terminal index based on the region offset
-        mpz_sub(terminal_index, terminal_index, region_start);
-        unsigned long int bitarray_index = mpz_get_ui(terminal_index);
-        found_terminals->markIndex(bitarray_index);
-      }
-    }
-    // Move counters forward
-    data_position += bytes_read;
-    bytes_remaining -= bytes_read;
-  }  // end while (bytes_remaining > 0)
-  // Clear the allocated BigInt before exiting
-  mpz_clear(terminal_index);
-  mpz_clear(region_end);
-  
-  return;
+// Write the limbs of a terminal-space index to destination, least
+// significant limb first, padded with zero limbs to seen_index_limbs_
+void UnseenTerminalGroup::exportSeenIndex(const mpz_t index,
+                                          mp_limb_t *destination) const {
+  for (size_t i = 0; i < seen_index_limbs_; ++i)
+    destination[i] = mpz_getlimbn(index, i);
+}
+
+
+// Sort the seen indices recorded by processSeenTerminals in increasing order.
+// Duplicate terminals are kept, since the linear scan that this replaced
+// counted each occurrence.
+void UnseenTerminalGroup::sortSeenIndices() {
+  size_t limbs = seen_index_limbs_;
+  size_t count = countSeenIndices();
+  if (limbs == 1) {
+    std::sort(seen_indices_.begin(), seen_indices_.end());
+    return;
+  }
+
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; ++i)
+    order[i] = i;
+  const mp_limb_t *indices = seen_indices_.data();
+  std::sort(order.begin(), order.end(), [indices, limbs](size_t a, size_t b) {
+    return mpn_cmp(indices + a * limbs, indices + b * limbs, limbs) < 0;
+  });
+  std::vector<mp_limb_t> sorted(seen_indices_.size());
+  for (size_t i = 0; i < count; ++i)
+    std::copy(indices + order[i] * limbs, indices + (order[i] + 1) * limbs,
+              sorted.begin() + i * limbs);
+  seen_indices_.swap(sorted);
+}
+
+
+// Return the number of seen indices less than index, and set *is_seen if
+// index is itself a seen index
+uint64_t UnseenTerminalGroup::rankSeenIndex(const mpz_t index,
+                                            bool *is_seen) const {
+  size_t limbs = seen_index_limbs_;
+  std::vector<mp_limb_t> key(limbs);
+  exportSeenIndex(index, key.data());
+
+  // Binary search for the first seen index not less than key
+  const mp_limb_t *indices = seen_indices_.data();
+  uint64_t low = 0, high = countSeenIndices();
+  while (low < high) {
+    uint64_t mid = low + (high - low) / 2;
+    if (mpn_cmp(indices + mid * limbs, key.data(), limbs) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  *is_seen = (low < countSeenIndices() &&
+              mpn_cmp(indices + low * limbs, key.data(), limbs) == 0);
+  return low;
+}
+
+
+uint64_t UnseenTerminalGroup::rankSeenIndex(const uint64_t index,
+                                            bool *is_seen) const {
+  auto it = std::lower_bound(seen_indices_.begin(), seen_indices_.end(),
+                             static_cast<mp_limb_t>(index));
+  *is_seen = (it != seen_indices_.end() && *it == index);
+  return it - seen_indices_.begin();
 }
 
 
@@ -523,113 +742,73 @@ const std::string& UnseenTerminalGroup::getFirstString() const {
 }
 
 
-// Return a LookupData struct with relevant fields set for the given terminal
+// Fill in lookup_data with relevant fields set for the given terminal
 //
 // source_id is set to "UNSEEN"
 //
-// Set lookup_data->index to -1 if no match, to match expected output of
-// indexInTerminalGroup, which calls this function to perform the lookup.
+// If there is no match, parse_status says why and the index is not set.
+// indexInTerminalGroup calls this function to perform the lookup.
 //
 // The operation of this function is fairly straightforward if you've seen
 // the other methods of this class.  Use terminalIndex on the input string,
-// and then subtract the number of seen terminals with a lower index.
+// and then subtract the number of seen terminals with a lower index, found by
+// binary search in seen_indices_.
 //
-LookupData* UnseenTerminalGroup::lookup(const char *terminal) const {
-  LookupData *lookup_data = new LookupData;
-
-  if (canGenerateTerminal(terminal)) {
-    mpz_init(lookup_data->index);
-    terminalIndex(lookup_data->index, terminal);
-  } else {
+void UnseenTerminalGroup::lookup(const char *terminal,
+                                 TerminalLookupData *lookup_data) const {
+  if (!canGenerateTerminal(terminal)) {
     lookup_data->parse_status = kTerminalNotFound | kTerminalCantBeGenerated;
     lookup_data->probability = -1;    
-    mpz_init(lookup_data->index);
-    mpz_set_si(lookup_data->index, -1);
-    return lookup_data;
+    return;
   }
 
-  const char *data_position = terminal_data_;
-  size_t bytes_remaining = terminal_data_size_;
-  mpz_t lower_count;
-  mpz_init_set_ui(lower_count, 0);
-
-  // init terminal_index outside the loop, rely on terminalIndex overwriting it
-  mpz_t terminal_index;
-  mpz_init(terminal_index);
-
-  while (bytes_remaining > 0) {
-    // Read the current line
-    unsigned int bytes_read;
-    grammartools::ReadLineFromCharArray2(data_position,
-                                        bytes_read);
-    // If current line is blank, expect unseen terminals next and terminate
-    if (bytes_read == 1) {  // Blank line = just the newline character was read
-      break;
-    }
-    // Else parse the line
-    const char *read_terminal, *source_ids;
-    double probability;
-    grammartools::ParseNonterminalLine(data_position, bytes_read, &read_terminal,
-                                       probability, &source_ids);
-
-    // Check if this terminal can actually be produced by the generator mask
-    if (canGenerateTerminal(read_terminal)) {
-      // Check if the index of this terminal is less than our index
-      terminalIndex(terminal_index, read_terminal);
-      int compare_result = mpz_cmp(terminal_index, lookup_data->index);
-      if (compare_result < 0) {
-        mpz_add_ui(lower_count, lower_count, 1);
-      } else if (compare_result == 0) {
-        // Our input string matches a seen terminal, so return -1, but perform
-        // a sanity check to make sure things are working properly.
-        auto len = strlen(terminal);
-        if ((len != strlen(read_terminal)) || (strncmp(terminal, read_terminal, len) != 0)) {
-          fprintf(stderr, "string: %s has same index as terminal: %s "
-                          "in indexInTerminalGroup with out_representation_: %s"
-                          " but strings are not equal!\n",
-                          terminal, read_terminal,
-                          out_representation_.c_str());
-          exit(EXIT_FAILURE);
-        }
-        mpz_clear(terminal_index);
-        lookup_data->parse_status = kTerminalNotFound | kTerminalCollision;
-        lookup_data->probability = -1;    
-        mpz_set_si(lookup_data->index, -1);
-        mpz_clear(terminal_index);
-        mpz_clear(lower_count);
-        return lookup_data;
-      }      
-    }
-    // Move counters forward
-    data_position += bytes_read;
-    bytes_remaining -= bytes_read;
-  }  // end while (bytes_remaining > 0)
+  // Find our index and count the seen terminals with a lower index.  Small
+  // terminal spaces are handled without GMP.
+  bool is_seen;
+  uint64_t lower_count;
+  if (index_width_ == kIndexWidth64 && seen_index_limbs_ == 1 &&
+      sizeof(mp_limb_t) == sizeof(uint64_t)) {
+    uint64_t terminal_index = terminalIndexNative<uint64_t>(terminal);
+    lower_count = rankSeenIndex(terminal_index, &is_seen);
+    lookup_data->index = terminal_index;
+  } else {
+    mpz_t terminal_index;
+    mpz_init(terminal_index);
+    terminalIndex(terminal_index, terminal);
+    lower_count = rankSeenIndex(terminal_index, &is_seen);
+    BigCount::set(lookup_data->index, terminal_index);
+    mpz_clear(terminal_index);
+  }
+  if (is_seen) {
+    // Our input string matches a seen terminal
+    lookup_data->parse_status = kTerminalNotFound | kTerminalCollision;
+    lookup_data->probability = -1;    
+    lookup_data->index = 0;
+    return;
+  }
 
   lookup_data->parse_status = kCanParse;
   lookup_data->probability = probability_;    
-  mpz_sub(lookup_data->index, lookup_data->index, lower_count);
-  mpz_clear(lower_count);
-  mpz_clear(terminal_index);
+  BigCount::sub(lookup_data->index, lookup_data->index, lower_count);
   // Set source id
-  lookup_data->source_ids.insert("UNSEEN");
-  return lookup_data;
+  lookup_data->source_ids = "UNSEEN";
+  lookup_data->source_ids_length = 6;
 }
 
 
-// Return the "index" of the given string in the unseen terminals 
-// (negative result if no match)
+// Set result to the "index" of the given string in the unseen terminals
+// (return false if no match)
 //
 // This function simply calls lookup, and then returns just the index
 // 
-void UnseenTerminalGroup::indexInTerminalGroup(mpz_t result,
+bool UnseenTerminalGroup::indexInTerminalGroup(BigCount& result,
                                                const char *teststring) const {
-  LookupData *lookup_data = lookup(teststring);
-  mpz_init(result);
-  mpz_set(result, lookup_data->index);
-
-  // Cleanup
-  mpz_clear(lookup_data->index);
-  delete lookup_data;
+  TerminalLookupData lookup_data;
+  lookup(teststring, &lookup_data);
+  if (!(lookup_data.parse_status & kCanParse))
+    return false;
+  result = lookup_data.index;
+  return true;
 }
 
 
@@ -643,99 +822,86 @@ UnseenTerminalGroup::UnseenTerminalGroupStringIterator*
 }
 
 
-// Constructor for iterator -- unlike the SeenTerminalGroup iterator we will
-// maintain (and manage) a bit array that holds the next unseen terminals
-// to generate.
+// Constructor for iterator -- unseen terminals are the gaps between the
+// sorted seen_indices_ of the parent, so the iterator walks terminal space
+// with a cursor into seen_indices_ and skips each seen index as it reaches
+// it.  Its memory does not depend on the size of terminal space.
 //
 // *** Class logic ***
 // After construction and after execution of each method:
-// - if isEnd is true, then found_terminals, current_bitarray_index,
-//     and current_string_ are all indeterminate, otherwise:
-//   - found_terminals will be a valid BitArray for the region starting at
-//       region_start_
-//   - current_bitarray_index_ will point at the location in the BitArray
-//       that corresponds to current_string_
-// - isEnd is true iff region_start is greater than total_terminals_, i.e.,
-//     we have moved outside the range of generatable terminals.
+// - if isEnd is true, then current_string_ is indeterminate, otherwise:
+//   - current_index_ is the index in terminal space of current_string_
+//   - next_index_ is current_index_ + 1
+//   - seen_position_ is the position of the first seen index not below
+//       next_index_
+// - isEnd is true iff an increment has failed because no unseen terminals
+//     are left after current_index_.
 //
 UnseenTerminalGroup::UnseenTerminalGroupStringIterator::
     UnseenTerminalGroupStringIterator(const UnseenTerminalGroup* const parent)
-    : parent_(parent) {
-  mpz_init_set_ui(region_start_, 0);
-  found_terminals_ = new BitArray(kTerminalSearchRegionSize);
-  parent_->findUnseenTerminals(
-    region_start_, kTerminalSearchRegionSize, found_terminals_);
-  current_bitarray_index_ = -1;  
+    : parent_(parent),
+      next_index_(parent->seen_index_limbs_, 0),
+      seen_position_(0),
+      is_end_(false) {
+  mpz_init(current_index_);
   increment();
 }
 
 UnseenTerminalGroup::UnseenTerminalGroupStringIterator::
     ~UnseenTerminalGroupStringIterator() {
-  mpz_clear(region_start_);
-  delete found_terminals_;
+  mpz_clear(current_index_);
 }
 
 // Increment the iterator by one and set current_string_ to the new value
 // Return false if we are past the end
+//
+// Every seen index is below total_terminals_, which fits in the limbs of
+// next_index_, so adding one to next_index_ below never carries out of them.
 bool UnseenTerminalGroup::UnseenTerminalGroupStringIterator::
-    increment() {      
-  if (!isEnd()) {
-    unsigned long int new_index = 
-      found_terminals_->findNextOpenSpace(static_cast<unsigned long int>(current_bitarray_index_ + 1));
-
-    // Recurse if no unseen terminals left in the current region
-    if (new_index >= found_terminals_->getSize()) {
-      // Move ahead to a new region
-      mpz_add_ui(region_start_, region_start_, kTerminalSearchRegionSize);
-      // Check if past the end
-      if (mpz_cmp(region_start_, parent_->total_terminals_) >= 0) {
-        return false;
-      }
-      parent_->findUnseenTerminals(
-        region_start_, kTerminalSearchRegionSize, found_terminals_);
-      current_bitarray_index_ = -1;
-      return increment();
-    }
-
-    if (new_index > LONG_MAX) {
-        fprintf(stderr, "new_index too large in UnseenTerminalGroupStringIterator::increment!"
-                        " Maybe the BitArray size is too large?\n");
-        exit(EXIT_FAILURE);
-    }
-    // This is an unsigned to signed conversion, hence the above check
-    current_bitarray_index_ = new_index;
-    // Found an unseen terminal!
-    mpz_t open_terminal_index;
-    mpz_init(open_terminal_index);
-    mpz_add_ui(open_terminal_index, region_start_, new_index);
+    increment() {
+  if (isEnd())
+    return false;
 
-    // Set first string using the open terminal index
-    // Use c_str() to ensure a deep copy
-    current_string_ = (parent_->generateTerminal(open_terminal_index)).c_str();
+  // Skip past the seen indices at or below next_index_.  Duplicate terminals
+  // leave duplicate seen indices, which are passed over as lower ones.
+  const size_t limbs = parent_->seen_index_limbs_;
+  const uint64_t seen_count = parent_->countSeenIndices();
+  while (seen_position_ < seen_count) {
+    int comparison =
+      mpn_cmp(&parent_->seen_indices_[seen_position_ * limbs],
+              next_index_.data(), limbs);
+    if (comparison > 0)
+      break;
+    if (comparison == 0)
+      mpn_add_1(next_index_.data(), next_index_.data(), limbs, 1);
+    ++seen_position_;
+  }
 
-    mpz_clear(open_terminal_index);
-    return true;
-  } else {
+  mpz_import(current_index_, limbs, -1, sizeof(mp_limb_t), 0, 0,
+             next_index_.data());
+  if (mpz_cmp(current_index_, parent_->total_terminals_) >= 0) {
+    is_end_ = true;
     return false;
   }
+  // Found an unseen terminal!
+  current_string_ = parent_->generateTerminal(current_index_);
+  mpn_add_1(next_index_.data(), next_index_.data(), limbs, 1);
+  return true;
 }
 
 // Set the iterator back to the beginning
 void UnseenTerminalGroup::UnseenTerminalGroupStringIterator::
     restart() {
-  mpz_set_ui(region_start_, 0);
-  current_bitarray_index_ = -1;
-  parent_->findUnseenTerminals(
-    region_start_, kTerminalSearchRegionSize, found_terminals_);
-  increment();  
+  std::fill(next_index_.begin(), next_index_.end(), 0);
+  seen_position_ = 0;
+  is_end_ = false;
+  increment();
 }
 
 // Simple check
 bool UnseenTerminalGroup::UnseenTerminalGroupStringIterator::
     isEnd() const {
-  // total_terminals_ is a count, but region_start is zero-indexed, so if
-  // total_terminals_ == region_start_ then we are past the end.
-  return (mpz_cmp(region_start_, parent_->total_terminals_) >= 0);
+  return is_end_;
 }
 
 
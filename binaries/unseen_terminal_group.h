@@ -42,10 +42,12 @@
 #define UNSEEN_TERMINAL_GROUP_H__
 
 #include <string>
+#include <cstdint>
+#include <vector>
 #include <gmp.h>
 
 #include "terminal_group.h"
-#include "bit_array.h"
+#include "grammar_snapshot.h"
 
 class UnseenTerminalGroup : public TerminalGroup {
 public:
@@ -57,14 +59,27 @@ public:
   ~UnseenTerminalGroup() { 
     // Not much to do
     mpz_clear(total_terminals_);
-    mpz_clear(terminals_size_);
   }
 
-  // Return a LookupData struct with relevant fields set for the given terminal
-  LookupData* lookup(const char *terminal) const;
-
-  // Return the "index" of the given string in the terminal group (-1 if no match)
-  void indexInTerminalGroup(mpz_t result, const char *teststring) const;
+  // Write this group to a grammar snapshot, or create a group from its
+  // snapshot record without scanning the seen terminals.  readSnapshot
+  // returns NULL if the record is truncated or does not match this build.
+  // skipSnapshot moves past a record without creating the group, and returns
+  // false if it is truncated.
+  void writeSnapshot(GrammarSnapshotWriter *writer) const;
+  static UnseenTerminalGroup* readSnapshot(
+      GrammarSnapshotReader *reader,
+      const char *terminal_data,
+      const size_t terminal_data_size,
+      const std::string& out_representation);
+  static bool skipSnapshot(GrammarSnapshotReader *reader);
+
+  // Fill in lookup_data with relevant fields set for the given terminal
+  void lookup(const char *terminal, TerminalLookupData *lookup_data) const;
+
+  // Set result to the "index" of the given string in the terminal group
+  // (return false if no match)
+  bool indexInTerminalGroup(BigCount& result, const char *teststring) const;
 
   // Return the "first" string of the terminal (used for string representation)
   const std::string& getFirstString() const;
@@ -82,9 +97,15 @@ public:
 
   private:
     const UnseenTerminalGroup* const parent_;
-    mpz_t region_start_;
-    BitArray *found_terminals_;
-    long int current_bitarray_index_;
+    // The lowest index in terminal space that increment may return next, in
+    // the limb layout of the parent's seen_indices_
+    std::vector<mp_limb_t> next_index_;
+    // Position in the parent's seen_indices_ of the first seen index that
+    // is not below next_index_, or past the last one
+    uint64_t seen_position_;
+    // The index in terminal space of current_string_
+    mpz_t current_index_;
+    bool is_end_;
     std::string current_string_;
   };
 
@@ -92,12 +113,22 @@ public:
 
 private:
   static const std::string kGeneratorSymbols;  // This is assigned in the .cpp file
-  static const unsigned int kTerminalSearchRegionSize = 0x40000000;
 
-  // Helper initialization functions for the constructor
+  // Used by readSnapshot
+  UnseenTerminalGroup(const char *terminal_data, 
+                      const double probability,
+                      const std::string& generator_mask,
+                      const std::string& out_representation,
+                      const size_t terminal_data_size,
+                      const void *seen_indices,
+                      const size_t seen_indices_size);
+
+  // Helper initialization functions for the constructors
   void initCharacterLookups();
   bool processSeenTerminals();
+  bool initUnseenTerminals();
   void initTotalTerminals();
+  void initNativeIndexing();
 
   // Given a string from terminal_data_, determine if it can be produced
   // by the generator mask.
@@ -117,16 +148,32 @@ private:
                      const char *terminal, 
                      mpz_t region_end = NULL) const;
   
+  // Native-integer versions of terminalIndex and generateTerminal, used when
+  // every index in terminal space fits in IndexType (see index_width_)
+  template <typename IndexType>
+  IndexType terminalIndexNative(const char *terminal) const;
+  template <typename IndexType>
+  std::string generateTerminalNative(IndexType terminal_index) const;
+  // Die with a message about an ungeneratable character at position
+  void reportUngeneratableCharacter(const char *terminal, int position) const;
+
   // Given an index in terminal space, generate a terminal
   // The result is matched to out_representation_, so if this includes
   // uppercase, canGenerateTerminal will return false if given the result.
   // This is expected behavior.
   std::string generateTerminal(mpz_t terminal_index) const;
-  // Given a starting index and region size in terminal space, return a BitArray
-  // with seen terminals marked.  Used in generating unseen terminals.
-  void findUnseenTerminals(mpz_t region_start, 
-                           unsigned long int region_size,
-                           BitArray *found_terminals) const;
+  // Helpers for seen_indices_
+  bool findFirstUnseenIndex(mpz_t result) const;
+  void exportSeenIndex(const mpz_t index, mp_limb_t *destination) const;
+  void sortSeenIndices();
+  uint64_t countSeenIndices() const {
+    return seen_index_limbs_ == 0 ? 0 : seen_indices_.size() / seen_index_limbs_;
+  }
+  // Return the number of seen terminals with a lower index in terminal space
+  // and set *is_seen if index belongs to a seen terminal
+  uint64_t rankSeenIndex(const mpz_t index, bool *is_seen) const;
+  // Same, for terminal spaces whose indices fit in a single 64-bit limb
+  uint64_t rankSeenIndex(const uint64_t index, bool *is_seen) const;
 
 
   const size_t terminal_data_size_;
@@ -134,6 +181,14 @@ private:
   mpz_t total_terminals_;
   double total_probability_mass_;
 
+  // Terminal-space indices of the seen terminals that the generator mask can
+  // produce, in increasing order.  Each index is stored as seen_index_limbs_
+  // GMP limbs (least significant first), enough to hold total_terminals_.
+  // Built by processSeenTerminals so lookup can rank terminals by binary
+  // search instead of rescanning the seen terminals.
+  std::vector<mp_limb_t> seen_indices_;
+  size_t seen_index_limbs_;
+
   // Lookup arrays built for speed -- initialized by initCharacterLookups
   int l_char_to_int_[256];
   int d_char_to_int_[256];
@@ -143,6 +198,17 @@ private:
     // A version for symbols is not needed, since we can look up characters
     // in GENERATED_SYMBOLS_
 
+  // Radix and character tables for each position of the generator mask,
+  // pointing into the lookup arrays above -- set by initNativeIndexing
+  std::vector<unsigned int> mask_bases_;
+  std::vector<const int*> mask_char_to_int_;
+  std::vector<const char*> mask_int_to_char_;
+
+  // The narrowest integer type that holds every index in terminal space.
+  // terminalIndex and generateTerminal only use GMP for kIndexWidthGMP.
+  enum IndexWidth { kIndexWidth64, kIndexWidth128, kIndexWidthGMP };
+  IndexWidth index_width_;
+
   bool out_matching_needed_;
 };
 
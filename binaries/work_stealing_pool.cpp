@@ -0,0 +1,133 @@
+// work_stealing_pool.cpp - a small thread pool with per-worker task queues and
+//   work stealing, used to run independent pieces of the guess calculator
+//   framework in parallel on a single loaded grammar
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// See header file for additional information
+
+#include "work_stealing_pool.h"
+
+// Identify the pool and worker (if any) that the current thread belongs to, so
+// that tasks submitted from inside a task go to the submitting worker's queue
+static thread_local const WorkStealingPool* current_pool = nullptr;
+static thread_local unsigned int current_worker = 0;
+
+
+WorkStealingPool::WorkStealingPool(unsigned int num_threads)
+    : queued_tasks_(0),
+      pending_tasks_(0),
+      next_queue_(0),
+      shutting_down_(false) {
+  if (num_threads == 0)
+    num_threads = 1;
+  for (unsigned int i = 0; i < num_threads; ++i)
+    queues_.push_back(new WorkerQueue);
+  for (unsigned int i = 0; i < num_threads; ++i)
+    threads_.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+}
+
+
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    shutting_down_ = true;
+  }
+  work_available_.notify_all();
+  for (unsigned int i = 0; i < threads_.size(); ++i)
+    threads_[i].join();
+  for (unsigned int i = 0; i < queues_.size(); ++i)
+    delete queues_[i];
+}
+
+
+void WorkStealingPool::submit(const Task& task) {
+  {
+    // Lock order is always state_mutex_ before a queue mutex.  Counting the
+    // task while holding both means the counters never lag the queues.
+    std::lock_guard<std::mutex> state_lock(state_mutex_);
+    unsigned int queue_index;
+    if (current_pool == this) {
+      queue_index = current_worker;
+    } else {
+      queue_index = next_queue_;
+      next_queue_ = (next_queue_ + 1) % queues_.size();
+    }
+    ++pending_tasks_;
+    ++queued_tasks_;
+
+    std::lock_guard<std::mutex> queue_lock(queues_[queue_index]->mutex);
+    queues_[queue_index]->tasks.push_back(task);
+  }
+  work_available_.notify_one();
+}
+
+
+void WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  while (pending_tasks_ > 0)
+    work_finished_.wait(lock);
+}
+
+
+bool WorkStealingPool::takeTask(unsigned int worker_index, Task& task) {
+  // Newest task from our own queue first -- it is the most likely to share
+  // data with what we just ran
+  {
+    WorkerQueue* own = queues_[worker_index];
+    std::lock_guard<std::mutex> lock(own->mutex);
+    if (!own->tasks.empty()) {
+      task = own->tasks.back();
+      own->tasks.pop_back();
+      return true;
+    }
+  }
+
+  // Otherwise steal the oldest task from another worker
+  for (unsigned int i = 1; i < queues_.size(); ++i) {
+    WorkerQueue* victim = queues_[(worker_index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    if (!victim->tasks.empty()) {
+      task = victim->tasks.front();
+      victim->tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void WorkStealingPool::workerLoop(unsigned int worker_index) {
+  current_pool = this;
+  current_worker = worker_index;
+
+  while (true) {
+    // Sleep until some queue has work for us (or we are told to stop)
+    {
+      std::unique_lock<std::mutex> lock(state_mutex_);
+      while (queued_tasks_ == 0 && !shutting_down_)
+        work_available_.wait(lock);
+      if (queued_tasks_ == 0 && shutting_down_)
+        return;
+    }
+
+    Task task;
+    if (!takeTask(worker_index, task))
+      continue;  // Another worker got there first
+    {
+      std::lock_guard<std::mutex> lock(state_mutex_);
+      --queued_tasks_;
+    }
+
+    task(worker_index);
+
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    --pending_tasks_;
+    if (pending_tasks_ == 0)
+      work_finished_.notify_all();
+  }
+}
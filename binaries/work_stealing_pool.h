@@ -0,0 +1,84 @@
+// work_stealing_pool.h - a small thread pool with per-worker task queues and
+//   work stealing, used to run independent pieces of the guess calculator
+//   framework in parallel on a single loaded grammar
+//
+// Use of this source code is governed by the GPLv2 license that can be found
+//   in the LICENSE file.
+//
+// Version 0.1
+//
+// Each worker thread owns a double-ended queue of tasks.  A worker pops tasks
+// from the back of its own queue, and when its queue is empty it "steals"
+// from the front of another worker's queue.  Tasks submitted from outside the
+// pool are dealt to the workers round-robin, while tasks submitted from
+// inside a running task are pushed onto the submitting worker's own queue.
+// This keeps related work on one core while still letting idle cores pick up
+// the long tail, e.g., when one giant structure produces most of the patterns.
+//
+// Tasks receive the index of the worker that runs them (0 to size() - 1), so
+// callers can keep per-worker state, such as output buffers, without locking.
+//
+// Tasks must not throw.  wait() blocks until every submitted task (including
+// tasks submitted by other tasks) has finished.
+//
+
+#ifndef WORK_STEALING_POOL_H__
+#define WORK_STEALING_POOL_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gcfmacros.h"
+
+class WorkStealingPool {
+ public:
+  typedef std::function<void(unsigned int worker_index)> Task;
+
+  // Start num_threads worker threads (at least one is always started)
+  explicit WorkStealingPool(unsigned int num_threads);
+  // Waits for all tasks to finish and joins the worker threads
+  ~WorkStealingPool();
+
+  // Queue a task for execution.  Safe to call from any thread, including
+  // from inside a running task.
+  void submit(const Task& task);
+
+  // Block until all submitted tasks have finished
+  void wait();
+
+  unsigned int size() const { return static_cast<unsigned int>(threads_.size()); }
+
+ private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerLoop(unsigned int worker_index);
+  // Take a task from the back of our own queue, or steal one from the front
+  // of another worker's queue.  Returns false if no task could be found.
+  bool takeTask(unsigned int worker_index, Task& task);
+
+  std::vector<WorkerQueue*> queues_;
+  std::vector<std::thread> threads_;
+
+  // The following are protected by state_mutex_
+  std::mutex state_mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable work_finished_;
+  uint64_t queued_tasks_;   // Tasks sitting in some queue
+  uint64_t pending_tasks_;  // Tasks queued or running
+  unsigned int next_queue_;
+  bool shutting_down_;
+
+  // Disable copy and assignment
+  DISALLOW_COPY_AND_ASSIGN(WorkStealingPool);
+};
+
+
+#endif  // WORK_STEALING_POOL_H__
@@ -591,7 +591,10 @@ print "========== Aggregate Counts to Build Lookup Table ==========\n";
 $thisstage = 4;
 $doStage   = !MiscUtils::checkStageFiles(@{ $newFiles[$thisstage] });
 if ($doStage) {
+  # The sorted table is a regular file, so the aggregator can map it and
+  # aggregate it on all cores
   my $cmd = "./$options->{rootName}/sortedcountaggregator " .
+    "-threads $options->{cores} " .
     "< @{$newFiles[$thisstage-1]}[0] " .
     "> @{$newFiles[$thisstage]}[0]";
   print "executing: $cmd \n";